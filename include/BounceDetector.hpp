@@ -11,19 +11,21 @@
 #include <net/if.h>
 #endif
 #include <cstring>
-#include <array>
+#include <memory>
+#include <vector>
 #include <SpeedwireHeader.hpp>
 #include <SpeedwireEmeterProtocol.hpp>
 #include <SpeedwireEncryptionProtocol.hpp>
 #include <SpeedwireInverterProtocol.hpp>
 #include <SpeedwirePacketSender.hpp>
+#include <TimerWheel.hpp>
 
 
 /**
  *  Speedwire packet bounce detector
  *  Multicast packets may bounce indefinetely back and forth between subnets, if they are 
  *  routed. This class holds a limited history of previously received packets and checks
- *  if they were received shortly before
+ *  if they were received shortly before. Discovery fingerprints expire through timers.
  */
 class BounceDetector {
 public:
@@ -62,11 +64,13 @@ public:
         }
     };
 
-    typedef std::array<Fingerprint, 16> History;
+    typedef std::vector<Fingerprint> History;
 
 protected:
     History history;
-    int replace_index;
+    std::unique_ptr<TimerWheel::Timer[]> expiry_timers;
+    TimerWheel& timer_wheel;
+    size_t replace_index;
 
     bool setFingerprint(Fingerprint& fingerprint, const libspeedwire::SpeedwireEmeterProtocol&   packet, const struct sockaddr& src) const;
     bool setFingerprint(Fingerprint& fingerprint, const libspeedwire::SpeedwireInverterProtocol& packet, const struct sockaddr& src) const;
@@ -74,7 +78,8 @@ protected:
     bool setFingerprint(Fingerprint& fingerprint, const libspeedwire::SpeedwireHeader& speedwire_packet, const struct sockaddr& src) const;
 
 public:
-    BounceDetector(void);
+    BounceDetector(size_t history_size = 16, TimerWheel& timer_wheel = TimerWheel::getInstance());
+    void setHistorySize(size_t history_size);
     template<class T> void receive(const T& packet, const struct sockaddr& src);
     template<class T> bool isBouncedPacket(const T& packet, const struct sockaddr& src) const;
     const History& getHistory(void) const { return history; }
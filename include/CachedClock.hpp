@@ -0,0 +1,55 @@
+#ifndef __CACHEDCLOCK_HPP__
+#define __CACHEDCLOCK_HPP__
+
+#include <cstdint>
+#ifdef _WIN32
+#include <chrono>
+#else
+#include <time.h>
+#endif
+#include <LocalHost.hpp>
+
+
+/**
+ *  Cached monotonic clock
+ *  The event loop takes a single timestamp per wakeup; all processing stages reuse this timestamp instead
+ *  of querying the system clock for each packet. Timers and expiry are based on the monotonic time, which is
+ *  not affected by steps of the wall clock, e.g. by ntp. The wall clock time of the same wakeup is kept for
+ *  timestamps published outside the router, like shared memory readings and captured packets. The clock can
+ *  also be set explicitly, e.g. to drive it from a virtual time source.
+ */
+class CachedClock {
+protected:
+    static uint64_t& time_in_ms(void) {
+        static uint64_t time = getMonotonicTimeInMs();
+        return time;
+    }
+    static uint64_t& epoch_time_in_ms(void) {
+        static uint64_t time = libspeedwire::LocalHost::getUnixEpochTimeInMs();
+        return time;
+    }
+
+public:
+    static uint64_t getTimeInMs(void) { return time_in_ms(); }
+    static uint64_t getEpochTimeInMs(void) { return epoch_time_in_ms(); }
+    static uint64_t update(void) {
+        epoch_time_in_ms() = libspeedwire::LocalHost::getUnixEpochTimeInMs();
+        return (time_in_ms() = getMonotonicTimeInMs());
+    }
+    static void setTimeInMs(uint64_t time) { time_in_ms() = time; epoch_time_in_ms() = time; }
+
+    /**
+     *  Get the current monotonic time in ms; on Linux, this is the time base of CLOCK_MONOTONIC timerfds
+     */
+    static uint64_t getMonotonicTimeInMs(void) {
+#ifdef _WIN32
+        return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000ull + (uint64_t)ts.tv_nsec / 1000000ull;
+#endif
+    }
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef __CONFIGMANAGER_HPP__
+#define __CONFIGMANAGER_HPP__
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <EventLoop.hpp>
+#include <RouterConfig.hpp>
+
+
+/**
+ *  Configuration manager
+ *  Holds the current configuration snapshot. On reload, a new snapshot is parsed from the configuration file
+ *  and published with a single atomic pointer swap. Readers take the snapshot once per packet and keep using it,
+ *  such that a packet never sees a half-applied configuration; a snapshot stays alive as long as it is referenced.
+ *  Reloads are triggered by SIGHUP or by a change of the configuration file.
+ */
+class ConfigManager : public EventLoop::IEventHandler {
+public:
+    typedef std::function<void(const RouterConfig& config)> ReloadListener;
+
+protected:
+    std::shared_ptr<const RouterConfig> snapshot;
+    std::string path;
+    std::atomic<bool> reload_requested;
+    std::vector<ReloadListener> listeners;
+    int watch_fd;
+    TimerWheel::Timer watch_timer;
+    int64_t modification_time;
+
+    ConfigManager(void);
+    ~ConfigManager(void);
+    static int64_t getModificationTime(const std::string& path);
+
+public:
+    static ConfigManager& getInstance(void);
+
+    std::shared_ptr<const RouterConfig> get(void) const { return std::atomic_load(&snapshot); }
+    bool load(const std::string& path);
+    bool reload(void);
+    void publish(const std::shared_ptr<const RouterConfig>& config);
+
+    void addReloadListener(const ReloadListener& listener) { listeners.push_back(listener); }
+    void watch(EventLoop& event_loop);
+    virtual void handleEvent(int fd, uint32_t events);
+
+    // called from signal handlers; the reload itself takes place in the event loop
+    void requestReload(void) { reload_requested = true; }
+    bool reloadIfRequested(void);
+};
+
+#endif
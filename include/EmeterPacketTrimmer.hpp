@@ -0,0 +1,33 @@
+#ifndef __EMETERPACKETTRIMMER_HPP__
+#define __EMETERPACKETTRIMMER_HPP__
+
+#include <cstdint>
+#include <vector>
+#include <SpeedwireHeader.hpp>
+#include <SpeedwireEmeterProtocol.hpp>
+#include <ObisData.hpp>
+
+
+/**
+ *  Speedwire emeter packet trimmer class
+ *  Remote consumers often read just a few obis elements out of each emeter packet. This class copies
+ *  an emeter packet into a given buffer, keeping only the obis elements found in its allow-list.
+ */
+class EmeterPacketTrimmer {
+protected:
+    std::vector<uint32_t> allow_list;     //!< allowed obis elements, each encoded as channel << 24 | index << 16 | type << 8 | tariff
+
+    static uint32_t getObisKey(uint8_t channel, uint8_t index, uint8_t type, uint8_t tariff);
+    static unsigned long getObisElementLength(const void* const obis);
+
+public:
+    EmeterPacketTrimmer(void);
+    void addObisElement(const libspeedwire::ObisData& obis);
+    void addObisElement(uint8_t channel, uint8_t index, uint8_t type, uint8_t tariff);
+    void clear(void) { allow_list.clear(); }
+    bool isEnabled(void) const { return allow_list.size() > 0; }
+    bool isAllowed(const void* const obis) const;
+    unsigned long trim(const libspeedwire::SpeedwireHeader& packet, uint8_t* const buffer, const unsigned long buffer_size) const;
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __EVENTLOOP_HPP__
+#define __EVENTLOOP_HPP__
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <TimerWheel.hpp>
+
+
+/**
+ *  Event loop
+ *  A reactor multiplexing file descriptor readiness and timer expiry. On Linux, it is based on epoll with a
+ *  timerfd armed for the next expiry of the timer wheel; on other platforms it falls back to poll. Each
+ *  wakeup takes a single timestamp into the cached clock, which is reused by all processing stages.
+ */
+class EventLoop {
+public:
+    static const uint32_t READABLE = 0x01;
+    static const uint32_t WRITABLE = 0x02;
+
+    /**
+     *  Interface for handlers of file descriptor events
+     */
+    class IEventHandler {
+    public:
+        virtual ~IEventHandler(void) {}
+        virtual void handleEvent(int fd, uint32_t events) = 0;
+    };
+
+protected:
+    TimerWheel& timer_wheel;
+    std::vector<std::pair<int, IEventHandler*> > handlers;
+    std::vector<std::pair<int, uint32_t> > interests;
+    int epoll_fd;
+    int timer_fd;
+    uint64_t armed_expiry;
+
+    IEventHandler* findHandler(int fd) const;
+    void armTimer(int64_t timeout_in_ms);
+
+public:
+    EventLoop(TimerWheel& timer_wheel);
+    ~EventLoop(void);
+
+    bool add(int fd, uint32_t events, IEventHandler& handler);
+    bool modify(int fd, uint32_t events);
+    void remove(int fd);
+    TimerWheel& getTimerWheel(void) { return timer_wheel; }
+
+    int runOnce(int max_timeout_in_ms);
+};
+
+#endif
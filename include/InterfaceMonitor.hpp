@@ -0,0 +1,53 @@
+#ifndef __INTERFACEMONITOR_HPP__
+#define __INTERFACEMONITOR_HPP__
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <LocalHost.hpp>
+#include <SpeedwireSocket.hpp>
+#include <SpeedwireSocketFactory.hpp>
+#include <SpeedwirePacketSender.hpp>
+#include <PacketDispatcher.hpp>
+#include <EventLoop.hpp>
+#include <InterfaceTable.hpp>
+
+
+/**
+ *  Local interface monitor
+ *  Listens for netlink address notifications (RTM_NEWADDR / RTM_DELADDR) and incrementally attaches or
+ *  detaches the receive sockets and packet senders of the affected interface, while all other interfaces keep
+ *  forwarding. Changes are recorded in the interface table and reported to change listeners, e.g. to set up
+ *  unicast senders for peers reachable through the interface. On platforms without netlink, the monitor is inactive.
+ */
+class InterfaceMonitor : public EventLoop::IEventHandler {
+public:
+    typedef std::function<void(const std::string& ip, bool added)> ChangeListener;
+
+protected:
+    libspeedwire::LocalHost& localhost;
+    EventLoop& event_loop;
+    PacketDispatcher& dispatcher;
+    std::vector<SpeedwirePacketSender*>& senders;
+    int netlink_fd;
+    std::vector<ChangeListener> listeners;
+
+    void joinGroup(const libspeedwire::SpeedwireSocket& socket, const std::string& ip);
+    void detachSocket(const libspeedwire::SpeedwireSocket& socket, const std::string& ip);
+
+public:
+    InterfaceMonitor(libspeedwire::LocalHost& host, EventLoop& event_loop, PacketDispatcher& dispatcher, std::vector<SpeedwirePacketSender*>& senders);
+    ~InterfaceMonitor(void);
+
+    bool open(void);
+    void close(void);
+    int  getSocketFd(void) const { return netlink_fd; }
+    virtual void handleEvent(int fd, uint32_t events);
+    void addChangeListener(const ChangeListener& listener) { listeners.push_back(listener); }
+
+    void addInterface(const std::string& ip, uint32_t prefix_length);
+    void removeInterface(const std::string& ip, uint32_t prefix_length);
+};
+
+#endif
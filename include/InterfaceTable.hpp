@@ -0,0 +1,49 @@
+#ifndef __INTERFACETABLE_HPP__
+#define __INTERFACETABLE_HPP__
+
+#ifdef _WIN32
+#include <Winsock2.h>
+#else
+#include <netinet/in.h>
+#endif
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <LocalHost.hpp>
+
+
+/**
+ *  Local ipv4 interface table
+ *  LocalHost caches the local interfaces found at startup. This table starts with the same interfaces and is
+ *  kept up to date by the interface monitor, such that routing decisions like finding the local interface
+ *  to reach a requester also consider hot-plugged interfaces and prefix changes.
+ */
+class InterfaceTable {
+public:
+    class Interface {
+    public:
+        std::string ip;
+        uint32_t prefix_length;
+        Interface(const std::string& interface_ip, uint32_t interface_prefix_length) : ip(interface_ip), prefix_length(interface_prefix_length) {}
+    };
+
+protected:
+    std::vector<Interface> interfaces;
+    std::vector<std::string> ipv4_addresses;
+
+    InterfaceTable(const libspeedwire::LocalHost& localhost);
+    void updateAddresses(void);
+
+public:
+    static InterfaceTable& getInstance(void);
+
+    bool add(const std::string& ip, uint32_t prefix_length);
+    bool remove(const std::string& ip);
+    bool isKnown(const std::string& ip) const;
+    uint32_t getPrefixLength(const std::string& ip) const;
+    const std::vector<std::string>& getIPv4Addresses(void) const { return ipv4_addresses; }
+    const std::vector<Interface>& getInterfaces(void) const { return interfaces; }
+    std::string findInterface(const struct in_addr& addr) const;
+};
+
+#endif
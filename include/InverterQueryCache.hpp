@@ -0,0 +1,93 @@
+#ifndef __INVERTERQUERYCACHE_HPP__
+#define __INVERTERQUERYCACHE_HPP__
+
+#ifdef _WIN32
+#include <Winsock2.h>
+#include <ws2def.h>
+#else
+#include <netinet/in.h>
+#endif
+#include <cstdint>
+#include <vector>
+#include <SpeedwireHeader.hpp>
+#include <SpeedwireInverterProtocol.hpp>
+#include <TimerWheel.hpp>
+
+
+/**
+ *  Speedwire inverter query cache
+ *  Several clients often poll the same inverters with identical queries. This class caches inverter
+ *  responses keyed by destination device, command and register range, such that repeated queries can
+ *  be answered locally. Identical queries that are still awaiting their response are coalesced. Cached
+ *  responses and in-flight queries expire through timers.
+ */
+class InverterQueryCache {
+public:
+    enum class Result : uint8_t {
+        FORWARD   = 0,      //!< the query must be forwarded to the inverter
+        CACHED    = 1,      //!< the query can be answered from the cache
+        COALESCED = 2       //!< an identical query is in flight; the response will be delivered to this requester as well
+    };
+
+    class Key {
+    public:
+        uint16_t dst_susyid;        //!< destination susy id of the query
+        uint32_t dst_serial;        //!< destination serial number of the query
+        uint32_t command_id;        //!< command id without the request / response byte
+        uint32_t first_register;    //!< first register id of the queried register range
+        uint32_t last_register;     //!< last register id of the queried register range
+
+        Key(void) : dst_susyid(0), dst_serial(0), command_id(0), first_register(0), last_register(0) {}
+        bool operator==(const Key& rhs) const {
+            return dst_susyid == rhs.dst_susyid && dst_serial == rhs.dst_serial && command_id == rhs.command_id &&
+                   first_register == rhs.first_register && last_register == rhs.last_register;
+        }
+    };
+
+    class Requester {
+    public:
+        struct sockaddr src;        //!< source ip address of the requester
+        uint16_t src_susyid;        //!< source susy id of the requester
+        uint32_t src_serial;        //!< source serial number of the requester
+        uint16_t packet_id;         //!< packet id of the query
+    };
+
+    class Entry {
+    public:
+        bool     in_use;            //!< the entry holds a cached response or an in-flight query
+        Key      key;               //!< cache key
+        uint32_t request_time;      //!< time the query was forwarded to the inverter
+        uint32_t response_time;     //!< time the response was received; only valid if response is not empty
+        bool     in_flight;         //!< the query has been forwarded and is awaiting its response
+        uint16_t packet_id;         //!< packet id of the forwarded query without the response bit; responses are matched by it
+        std::vector<uint8_t>   response;    //!< cached response packet
+        std::vector<Requester> waiters;     //!< requesters waiting for the response of the in-flight query
+        TimerWheel::Timer ttl_timer;        //!< expires the cached response
+        TimerWheel::Timer inflight_timer;   //!< expires the in-flight query
+
+        Entry(void) : in_use(false), key(), request_time(0), response_time(0), in_flight(false), packet_id(0), response(), waiters(), ttl_timer(), inflight_timer() {}
+    };
+
+protected:
+    TimerWheel& timer_wheel;
+    std::vector<Entry> entries;
+    uint32_t ttl_in_ms;
+    uint32_t inflight_timeout_in_ms;
+
+    static Key getKey(const libspeedwire::SpeedwireInverterProtocol& packet);
+    Entry* find(const Key& key);
+    Entry* findInFlight(const libspeedwire::SpeedwireInverterProtocol& response);
+    Entry& insert(const Key& key, uint32_t now);
+
+public:
+    InverterQueryCache(TimerWheel& timer_wheel, uint32_t ttl_in_ms = 5000, uint32_t inflight_timeout_in_ms = 3000, size_t max_entries = 64);
+    void setTimeToLive(uint32_t ttl) { ttl_in_ms = ttl; }
+    uint32_t getTimeToLive(void) const { return ttl_in_ms; }
+
+    static bool isCacheableRequest(const libspeedwire::SpeedwireInverterProtocol& packet);
+    Result request(const libspeedwire::SpeedwireInverterProtocol& packet, const struct sockaddr& src, uint32_t now, std::vector<uint8_t>& response);
+    bool response(const libspeedwire::SpeedwireInverterProtocol& packet, const libspeedwire::SpeedwireHeader& speedwire_packet, uint32_t now, std::vector<Requester>& waiters);
+    static void rewrite(std::vector<uint8_t>& response, const Requester& requester);
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef __IOURINGBACKEND_HPP__
+#define __IOURINGBACKEND_HPP__
+
+#ifdef SPEEDWIRE_IO_URING
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <liburing.h>
+#include <SpeedwireSocket.hpp>
+#include <EventLoop.hpp>
+#include <PacketDispatcher.hpp>
+#include <PeerSendQueue.hpp>
+
+
+/**
+ *  io_uring I/O backend
+ *  Each receive socket has a single multishot recvmsg operation receiving into a ring of kernel provided buffers.
+ *  The fan-out of a received packet is submitted as sendmsg operations referencing the same provided buffer,
+ *  such that the packet is not copied and all of them are submitted with a single system call. A buffer returns to
+ *  the ring once the packet has been dispatched and all sends referencing it have completed. Completions are
+ *  signalled through an eventfd registered with the event loop, such that timers keep working unchanged.
+ */
+class IoUringBackend : public PacketDispatcher::IReceiveBackend, public PeerSendQueue::ISendBackend, public EventLoop::IEventHandler {
+protected:
+    static const unsigned ring_entries = 512;
+    static const unsigned num_buffers  = 256;           //!< number of provided buffers, a power of 2
+    static const unsigned buffer_size  = 2048 + 256;    //!< packet plus source address and control messages
+    static const unsigned num_send_ops = 256;
+    static const int      buffer_group = 1;
+
+    enum class OpType : uint8_t {
+        RECV   = 1,
+        SEND   = 2,
+        CANCEL = 3
+    };
+
+    class SendOp {
+    public:
+        struct msghdr msg;
+        struct iovec iov;
+        struct sockaddr_in6 dest;           //!< destination, large enough for ipv4 and ipv6 addresses
+        int buffer_id;                      //!< provided buffer holding the packet, -1 if it is copied into data
+        PeerSendQueue* queue;               //!< queue the result is reported to, NULL if the queue is gone
+        std::array<uint8_t, 1500> data;     //!< copy of a packet not residing in a provided buffer
+    };
+
+    PacketDispatcher& dispatcher;
+    EventLoop& event_loop;
+    struct io_uring ring;
+    struct io_uring_buf_ring* buf_ring;
+    std::vector<uint8_t>  buffers;
+    std::vector<uint16_t> buffer_refs;
+    unsigned              free_buffers;     //!< provided buffers currently in the buffer ring
+    std::vector<int>      starved_fds;      //!< sockets whose multishot recvmsg ran out of provided buffers
+    std::vector<SendOp>   send_ops;
+    std::vector<uint16_t> free_send_ops;
+    std::vector<libspeedwire::SpeedwireSocket> sockets;
+    struct msghdr recv_msg;                 //!< layout of name and control messages in the provided buffers
+    int  event_fd;
+    bool is_open;
+    bool is_multishot_supported;
+    bool in_batch;
+    int  current_buffer_id;                 //!< provided buffer of the packet currently dispatched, -1 if none
+    unsigned pending_submissions;
+
+    struct io_uring_sqe* getSqe(void);
+    void submit(void);
+    bool armReceive(int fd);
+    void releaseBuffer(int buffer_id);
+    void handleReceive(const struct io_uring_cqe* cqe);
+    void handleSend(const struct io_uring_cqe* cqe);
+    static uint64_t toUserData(OpType type, uint32_t index) { return ((uint64_t)type << 32) | index; }
+
+public:
+    IoUringBackend(PacketDispatcher& dispatcher, EventLoop& event_loop);
+    ~IoUringBackend(void);
+
+    bool open(void);
+    bool isOpen(void) const { return is_open; }
+
+    virtual bool addSocket(const libspeedwire::SpeedwireSocket& socket);
+    virtual void removeSocket(const libspeedwire::SpeedwireSocket& socket);
+    virtual bool send(int fd, const uint8_t* const packet, const unsigned long size, const struct sockaddr* const dest, PeerSendQueue& queue);
+    virtual void cancel(PeerSendQueue& queue);
+    virtual void handleEvent(int fd, uint32_t events);
+};
+
+#endif
+
+#endif
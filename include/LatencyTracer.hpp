@@ -0,0 +1,145 @@
+#ifndef __LATENCYTRACER_HPP__
+#define __LATENCYTRACER_HPP__
+
+#ifdef _WIN32
+#include <Winsock2.h>
+#include <ws2def.h>
+#else
+#include <netinet/in.h>
+#endif
+#include <cstdint>
+#include <atomic>
+#include <array>
+#include <deque>
+#include <string>
+#include <vector>
+
+
+/**
+ *  Lock-free latency histogram
+ *  Values are recorded into log-linear buckets in the style of an hdr histogram: each power of two is
+ *  split into 16 linear sub-buckets, giving a relative precision of about 6%. Recording is wait-free;
+ *  percentiles can be read concurrently.
+ */
+class LatencyHistogram {
+public:
+    static const unsigned sub_bucket_bits  = 4;
+    static const unsigned sub_bucket_count = 1u << sub_bucket_bits;
+    static const unsigned magnitude_count  = 41;        //!< values up to 2^40 ns, i.e. about 18 minutes
+    static const unsigned bucket_count     = (magnitude_count - sub_bucket_bits + 1) * sub_bucket_count;
+
+protected:
+    std::array<std::atomic<uint64_t>, bucket_count> buckets;
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> max_value;
+
+    static unsigned getBucketIndex(uint64_t value);
+    static uint64_t getBucketValue(unsigned index);
+
+public:
+    LatencyHistogram(void);
+    void record(uint64_t value);
+    void reset(void);
+    uint64_t getCount(void) const { return count.load(std::memory_order_relaxed); }
+    uint64_t getMax(void) const { return max_value.load(std::memory_order_relaxed); }
+    uint64_t getPercentile(double percentile) const;
+};
+
+
+/**
+ *  Forwarding latency tracer
+ *  The kernel receive timestamp of each packet travels with the packet through bounce check, patch and
+ *  send. Per-stage and total residency times are recorded per protocol and per destination; packets
+ *  exceeding a configurable threshold are sampled into a slow packet trace. As kernel receive timestamps
+ *  are wall clock times, a clock step can turn a residency time negative or huge; such times are clamped.
+ */
+class LatencyTracer {
+public:
+    enum class Protocol : uint8_t {
+        EMETER     = 0,
+        INVERTER   = 1,
+        ENCRYPTION = 2,
+        DISCOVERY  = 3,
+        UNKNOWN    = 4
+    };
+    static const unsigned protocol_count = 5;
+
+    enum class Stage : uint8_t {
+        RECEIVE      = 0,   //!< kernel receive timestamp until start of dispatch
+        BOUNCE_CHECK = 1,   //!< bounce detection
+        PATCH        = 2,   //!< packet patching
+        SEND         = 3,   //!< end of the last processing stage until the last send has completed; with the
+                            //!< io_uring backend, until the last send has been submitted
+        TOTAL        = 4    //!< kernel receive timestamp until the last send has completed
+    };
+    static const unsigned stage_count = 5;
+    static const uint64_t max_residency_ns = 10000000000ull;    //!< longer residency times are taken as clock steps
+
+    class SlowPacket {
+    public:
+        uint64_t        rx_time_ns;     //!< kernel receive timestamp
+        struct sockaddr src;            //!< source ip address
+        Protocol        protocol;       //!< protocol of the packet
+        uint32_t        num_sends;      //!< number of completed sends
+        std::array<uint64_t, stage_count> stage_ns;     //!< per-stage residency times
+    };
+
+protected:
+    class Destination {
+    public:
+        std::string name;
+        std::array<LatencyHistogram, protocol_count> send_latency;
+        Destination(const std::string& destination_name) : name(destination_name) {}
+    };
+
+    // histograms
+    std::array<std::array<LatencyHistogram, stage_count>, protocol_count> stage_latency;
+    std::deque<Destination> destinations;   //!< a deque, as histograms cannot be moved
+
+    // state of the packet currently in flight through the router
+    bool     active;
+    Protocol protocol;
+    struct sockaddr src;
+    uint64_t rx_time_ns;
+    uint64_t last_mark_ns;
+    uint64_t last_send_ns;
+    uint32_t num_sends;
+    std::array<uint64_t, stage_count> stage_ns;
+
+    // slow packet trace
+    uint64_t slow_threshold_ns;
+    uint32_t slow_sample_rate;
+    uint32_t slow_counter;
+    std::vector<SlowPacket> slow_packets;
+    size_t   slow_index;
+
+    std::atomic<bool> report_requested;
+    uint64_t num_clamped;           //!< residency times clamped due to a clock step
+
+    LatencyTracer(void);
+    uint64_t getElapsed(uint64_t now, uint64_t since);
+
+public:
+    static LatencyTracer& getInstance(void);
+    static uint64_t getTimeInNs(void);
+
+    size_t registerDestination(const std::string& name);
+    void setSlowPacketThreshold(uint64_t threshold_in_ns, uint32_t sample_rate);
+
+    void begin(uint64_t kernel_rx_time_ns, const struct sockaddr& src, Protocol protocol);
+    void mark(Stage stage);
+    void sent(size_t destination);
+    void end(void);
+    uint64_t getRxTimeNs(void) const { return rx_time_ns; }
+    uint64_t getLastTimeNs(void) const { return (last_send_ns > last_mark_ns ? last_send_ns : last_mark_ns); }
+
+    void requestReport(void) { report_requested.store(true); }
+    bool isReportRequested(void) { return report_requested.exchange(false); }
+    std::string getPercentiles(void) const;
+    std::string getSlowPacketTrace(void) const;
+
+    static const char* toString(Protocol protocol);
+    static const char* toString(Stage stage);
+};
+
+#endif
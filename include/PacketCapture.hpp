@@ -0,0 +1,128 @@
+#ifndef __PACKETCAPTURE_HPP__
+#define __PACKETCAPTURE_HPP__
+
+#ifdef _WIN32
+#include <Winsock2.h>
+#include <ws2def.h>
+#else
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <array>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+
+
+/**
+ *  Asynchronous packet capture tap
+ *  Mirrors received, forwarded and dropped packets into a lock-free single-producer single-consumer ring.
+ *  The forwarding thread only copies the packet into a free ring slot; if the ring is full, the packet is not
+ *  captured and counted as lost. A background writer thread drains the ring into rotating pcapng files. Each
+ *  packet is written with synthesized ip and udp headers, on a pcapng interface named after the local interface
+ *  address, and annotated with its direction and drop reason.
+ */
+class PacketCapture {
+public:
+    enum class Direction : uint8_t {
+        RX   = 0,       //!< received on a socket
+        TX   = 1,       //!< forwarded by a sender, including patched or trimmed bytes
+        DROP = 2        //!< dropped by the router
+    };
+
+    enum class DropReason : uint8_t {
+        NONE         = 0,
+        BOUNCED      = 1,   //!< dropped by the bounce detector
+        BACKLOG_FULL = 2,   //!< dropped by a full send backlog
+        CIRCUIT_OPEN = 3,   //!< dropped by an open circuit breaker
+        SEND_FAILED  = 4,   //!< the send failed
+        QUARANTINED  = 5    //!< dropped by a bounce storm quarantine
+    };
+
+    static const unsigned num_records = 1024;   //!< number of ring slots, a power of 2
+    static const unsigned snap_length = 2048;   //!< maximum number of captured bytes per packet
+
+protected:
+    class Record {
+    public:
+        uint64_t        time_ns;
+        uint32_t        length;             //!< packet length
+        uint32_t        captured_length;    //!< number of bytes in data
+        Direction       direction;
+        DropReason      reason;
+        std::array<char, 48> interface_ip;  //!< local interface address, zero terminated
+        struct sockaddr src;                //!< source address, or the local interface if unspecified
+        struct sockaddr dst;                //!< destination address, or the local interface if unspecified
+        std::array<uint8_t, snap_length> data;
+    };
+
+    // ring shared by the forwarding thread and the writer thread; indexes are kept on separate cache lines
+    std::unique_ptr<Record[]> records;
+    alignas(64) std::atomic<uint64_t> head;     //!< next slot written by the forwarding thread
+    alignas(64) std::atomic<uint64_t> tail;     //!< next slot read by the writer thread
+    alignas(64) std::atomic<uint64_t> lost;     //!< packets not captured because the ring was full
+    std::atomic<bool> enabled;
+    std::atomic<bool> running;
+    std::array<char, 48> rx_interface_ip;       //!< local interface of the last received packet
+
+    // writer thread state
+    std::thread writer;
+    std::string path;
+    uint64_t    max_file_size;
+    unsigned    max_files;
+    unsigned    file_index;
+    FILE*       file;
+    uint64_t    file_size;
+    uint64_t    lost_reported;
+    std::map<std::string, uint32_t> interface_ids;  //!< pcapng interface ids of the current file
+
+    PacketCapture(void);
+    ~PacketCapture(void);
+
+    void capture(Direction direction, DropReason reason, const char* const interface_ip, const struct sockaddr* const src, const struct sockaddr* const dst, const uint8_t* const packet, const unsigned long size, uint64_t time_ns);
+    void run(void);
+    bool openFile(void);
+    void closeFile(void);
+    void write(const Record& record);
+    uint32_t getInterfaceId(const std::string& interface_ip);
+    void writeBlock(uint32_t type, const std::string& body);
+
+public:
+    static PacketCapture& getInstance(void);
+
+    bool start(const std::string& path, uint64_t max_file_size, unsigned max_files);
+    void stop(void);
+    bool isEnabled(void) const { return enabled.load(std::memory_order_relaxed); }
+    const std::string& getPath(void) const { return path; }
+    uint64_t getLostCount(void) const { return lost.load(std::memory_order_relaxed); }
+
+    /**
+     *  Capture a packet received on the given local interface
+     */
+    void received(const std::string& interface_ip, const struct sockaddr& src, const uint8_t* const packet, const unsigned long size, uint64_t time_ns) {
+        if (isEnabled()) capture(Direction::RX, DropReason::NONE, interface_ip.c_str(), &src, NULL, packet, size, time_ns);
+    }
+
+    /**
+     *  Capture a packet forwarded from the given local interface, or dropped by its sender for the given reason;
+     *  if dst is NULL, the packet is sent to the speedwire multicast address
+     */
+    void forwarded(const std::string& interface_ip, const struct sockaddr* const dst, const uint8_t* const packet, const unsigned long size, uint64_t time_ns, DropReason reason = DropReason::NONE) {
+        if (isEnabled()) capture((reason == DropReason::NONE ? Direction::TX : Direction::DROP), reason, interface_ip.c_str(), NULL, dst, packet, size, time_ns);
+    }
+
+    /**
+     *  Capture a received packet dropped for the given reason; it is annotated with the interface of the last received packet
+     */
+    void dropped(DropReason reason, const struct sockaddr& src, const uint8_t* const packet, const unsigned long size, uint64_t time_ns) {
+        if (isEnabled()) capture(Direction::DROP, reason, rx_interface_ip.data(), &src, NULL, packet, size, time_ns);
+    }
+
+    static const char* toString(DropReason reason);
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef __PACKETDISPATCHER_HPP__
+#define __PACKETDISPATCHER_HPP__
+
+#include <cstdint>
+#include <array>
+#include <functional>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
+#include <LocalHost.hpp>
+#include <SpeedwireHeader.hpp>
+#include <SpeedwireSocket.hpp>
+#include <SpeedwireReceiveDispatcher.hpp>
+#include <LatencyTracer.hpp>
+#include <EventLoop.hpp>
+
+
+/**
+ *  Speedwire packet dispatcher
+ *  Receives speedwire packets from a set of sockets and dispatches them to the registered receivers.
+ *  In contrast to the libspeedwire receive dispatcher, the kernel receive timestamp of each packet is
+ *  obtained and handed to the latency tracer, such that it travels with the packet through the router.
+ *  The arrival interface index of each packet is obtained as well and handed to the storm detector.
+ *  Receive sockets are registered with the event loop, unless a receive backend like io_uring takes them over.
+ *  Connected peer sockets of unicast senders are always registered with the event loop; packets arriving on them
+ *  are dispatched as if they arrived on the given interface socket, and receive errors are reported to the sender.
+ */
+class PacketDispatcher : public EventLoop::IEventHandler {
+public:
+    /**
+     *  Interface for receive backends; a backend receiving packets on its own calls dispatch() for each packet
+     */
+    class IReceiveBackend {
+    public:
+        virtual ~IReceiveBackend(void) {}
+        virtual bool addSocket(const libspeedwire::SpeedwireSocket& socket) = 0;
+        virtual void removeSocket(const libspeedwire::SpeedwireSocket& socket) = 0;
+    };
+
+protected:
+    libspeedwire::LocalHost& localhost;
+    EventLoop& event_loop;
+    IReceiveBackend* backend;
+    std::vector<libspeedwire::SpeedwireSocket> sockets;
+
+    class PeerSocket {
+    public:
+        int fd;
+        libspeedwire::SpeedwireSocket interface_socket;
+        std::function<void(void)> on_error;
+        PeerSocket(int peer_fd, const libspeedwire::SpeedwireSocket& socket, const std::function<void(void)>& error_callback) :
+            fd(peer_fd), interface_socket(socket), on_error(error_callback) {}
+    };
+    std::vector<PeerSocket> peer_sockets;
+    std::vector<libspeedwire::EmeterPacketReceiverBase*>    emeter_receivers;
+    std::vector<libspeedwire::InverterPacketReceiverBase*>  inverter_receivers;
+    std::vector<libspeedwire::DiscoveryPacketReceiverBase*> discovery_receivers;
+    std::array<uint8_t, 2048> recv_buffer;
+
+    bool enableControlMessages(int fd);
+    int  recv(int fd, struct sockaddr& src, uint64_t& rx_time_ns, int& ifindex);
+
+public:
+    PacketDispatcher(libspeedwire::LocalHost& host, EventLoop& event_loop);
+    void registerReceiver(libspeedwire::EmeterPacketReceiverBase&    receiver) { emeter_receivers.push_back(&receiver); }
+    void registerReceiver(libspeedwire::InverterPacketReceiverBase&  receiver) { inverter_receivers.push_back(&receiver); }
+    void registerReceiver(libspeedwire::DiscoveryPacketReceiverBase& receiver) { discovery_receivers.push_back(&receiver); }
+    void setReceiveBackend(IReceiveBackend* receive_backend) { backend = receive_backend; }
+
+    void addSocket(const libspeedwire::SpeedwireSocket& socket);
+    void addSockets(const std::vector<libspeedwire::SpeedwireSocket>& sockets);
+    void removeSocket(const libspeedwire::SpeedwireSocket& socket);
+    const std::vector<libspeedwire::SpeedwireSocket>& getSockets(void) const { return sockets; }
+    void addPeerSocket(int fd, const libspeedwire::SpeedwireSocket& interface_socket, const std::function<void(void)>& on_error);
+    void removePeerSocket(int fd);
+
+    virtual void handleEvent(int fd, uint32_t events);
+    int  receive(const libspeedwire::SpeedwireSocket& socket);
+    void dispatch(const libspeedwire::SpeedwireSocket& socket, uint8_t* const buffer, const unsigned long size, struct sockaddr& src, uint64_t rx_time_ns, int ifindex);
+#ifndef _WIN32
+    static int getArrivalInterface(const struct cmsghdr* cmsg);
+#endif
+    void dispatch(libspeedwire::SpeedwireHeader& packet, struct sockaddr& src, uint64_t rx_time_ns);
+};
+
+#endif
@@ -7,20 +7,18 @@
 #include <SpeedwireInverterProtocol.hpp>
 #include <SpeedwirePacketSender.hpp>
 #include <ObisData.hpp>
+#include <RouterConfig.hpp>
 
 
 /**
  *  Speedwire packet patcher class
  *  In some cases it is useful to change the content of a speedwire packet before forwarding it to another network or host 
- * 
+ *  The patch rules are taken from the configuration snapshot.
  */
 class PacketPatcher {
-protected:
-    std::array<uint8_t, 12> maxNegativeActivePowerTotalBytes;
-
 public:
     PacketPatcher(void);
-    virtual void patch(libspeedwire::SpeedwireHeader& packet, struct sockaddr& src);
+    virtual void patch(libspeedwire::SpeedwireHeader& packet, struct sockaddr& src, const RouterConfig& config);
 };
 
 #endif
@@ -0,0 +1,80 @@
+#ifndef __PACKETRINGBACKEND_HPP__
+#define __PACKETRINGBACKEND_HPP__
+
+#ifdef __linux__
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <SpeedwireSocket.hpp>
+#include <EventLoop.hpp>
+#include <PacketDispatcher.hpp>
+
+struct tpacket_block_desc;
+
+
+/**
+ *  AF_PACKET TPACKET_V3 receive backend
+ *  Each local interface with receive sockets has an AF_PACKET socket with a memory-mapped ring of blocks, shared
+ *  with the kernel. An in-kernel filter passes only unfragmented ipv4 udp packets to port 9522. The kernel fills a
+ *  block with packets and hands it over once it is full or its timeout expires; all packets of a block are then
+ *  dispatched directly from the ring, without a system call or copy per packet, and the block is returned.
+ *  The udp receive sockets stay with the event loop and keep their multicast group memberships, but a socket
+ *  filter discards their packets arriving on an interface with a ring before they are queued. Thus each packet
+ *  is received either through a ring or through a udp socket, also for sockets shared by several interfaces.
+ *  If a socket filter cannot be attached, all rings are closed. Requires CAP_NET_RAW.
+ */
+class PacketRingBackend : public PacketDispatcher::IReceiveBackend, public EventLoop::IEventHandler {
+protected:
+    static const unsigned block_size     = 1 << 16;     //!< size of a ring block, a multiple of the page size
+    static const unsigned num_blocks     = 8;
+    static const unsigned frame_size     = 2048;        //!< nominal frame size; TPACKET_V3 packs variable length frames
+    static const unsigned block_timeout  = 1;           //!< ms until a partially filled block is handed over
+
+    class Ring {
+    public:
+        int fd;
+        int ifindex;
+        std::string ifname;
+        uint8_t* map;
+        unsigned next_block;
+        std::vector<libspeedwire::SpeedwireSocket> sockets;     //!< receive sockets of the interface; the first one is used for dispatching
+        Ring(void) : fd(-1), ifindex(0), map(NULL), next_block(0) {}
+    };
+
+    PacketDispatcher& dispatcher;
+    EventLoop& event_loop;
+    std::vector<Ring> rings;
+    std::vector<libspeedwire::SpeedwireSocket> sockets;     //!< all udp receive sockets, filtered by interface
+    bool is_open;
+    uint64_t num_packets;
+    uint64_t num_blocks_processed;
+    uint64_t num_kernel_drops;
+
+    Ring* openRing(int ifindex, const std::string& ifname);
+    void  closeRing(Ring& ring);
+    void  closeRings(void);
+    bool  updateFilters(int new_ifindex = 0);
+    void  processBlock(Ring& ring, struct tpacket_block_desc& block);
+    static bool findInterface(const std::string& ip, int& ifindex, std::string& ifname);
+    static bool setFilter(const libspeedwire::SpeedwireSocket& socket, const std::vector<int>& ifindexes);
+
+public:
+    PacketRingBackend(PacketDispatcher& dispatcher, EventLoop& event_loop);
+    ~PacketRingBackend(void);
+
+    bool open(void);
+    bool isOpen(void) const { return is_open; }
+
+    virtual bool addSocket(const libspeedwire::SpeedwireSocket& socket);
+    virtual void removeSocket(const libspeedwire::SpeedwireSocket& socket);
+    virtual void handleEvent(int fd, uint32_t events);
+
+    std::string getReport(void);
+};
+
+#endif
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef __PEERSENDQUEUE_HPP__
+#define __PEERSENDQUEUE_HPP__
+
+#ifdef _WIN32
+#include <Winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+#include <cstdint>
+#include <array>
+#include <deque>
+#include <string>
+#include <vector>
+#include <SpeedwireHeader.hpp>
+#include <SpeedwireSocket.hpp>
+#include <LatencyTracer.hpp>
+#include <TimerWheel.hpp>
+
+
+/**
+ *  Per-peer send queue
+ *  Packets are sent on non-blocking sockets; a unicast peer can be given its own connected socket, such that a full
+ *  socket buffer or an icmp error of one peer does not affect other peers on the same interface. If a socket buffer is full, packets are kept in a small bounded
+ *  backlog that is flushed by a retry timer; when the backlog is full, either the oldest or the newest packet is dropped,
+ *  depending on the protocol. A circuit breaker stops sending to a peer that keeps failing and probes it
+ *  again with exponential backoff, such that a bad peer cannot slow down healthy destinations. Backlog size,
+ *  drop policies and circuit breaker settings are taken from the configuration snapshot.
+ */
+class PeerSendQueue {
+public:
+    enum class Result : uint8_t {
+        SENT    = 0,    //!< the packet has been sent
+        QUEUED  = 1,    //!< the packet has been added to the backlog
+        DROPPED = 2,    //!< the packet has been dropped, because the backlog is full
+        FAILED  = 3,    //!< the send failed
+        BLOCKED = 4     //!< the circuit breaker is open
+    };
+
+    enum class DropPolicy : uint8_t {
+        DROP_OLDEST = 0,
+        DROP_NEWEST = 1
+    };
+
+    enum class BreakerState : uint8_t {
+        CLOSED    = 0,  //!< sending normally
+        OPEN      = 1,  //!< sending suspended until the backoff time has elapsed
+        HALF_OPEN = 2   //!< a single probe packet is allowed; further packets wait in the backlog for its result
+    };
+
+    /**
+     *  Interface for asynchronous send backends; the backend reports the result of each accepted send
+     *  by calling onSendComplete() of the queue. If dest is NULL, the socket is connected to its destination.
+     */
+    class ISendBackend {
+    public:
+        virtual ~ISendBackend(void) {}
+        virtual bool send(int fd, const uint8_t* const packet, const unsigned long size, const struct sockaddr* const dest, PeerSendQueue& queue) = 0;
+        virtual void cancel(PeerSendQueue& queue) = 0;
+    };
+
+protected:
+    class Entry {
+    public:
+        int fd;
+        std::vector<uint8_t> packet;
+        struct sockaddr_in6 dest;       //!< destination, large enough for ipv4 and ipv6 addresses
+        bool has_dest;                  //!< false for packets sent on the connected peer socket
+        Entry(int socket_fd) : fd(socket_fd), has_dest(false) {}
+    };
+
+    static ISendBackend* send_backend;
+
+    std::string name;
+    std::deque<Entry> backlog;
+    int peer_fd;                    //!< connected socket of the peer, -1 if packets are sent on the given sockets
+    int backend_fd;                 //!< socket of the sends handed to the send backend, -1 if there were none
+
+    // backlog retry timer
+    TimerWheel::Timer retry_timer;
+    uint32_t retry_interval_in_ms;
+
+    // circuit breaker
+    BreakerState state;
+    bool probe_in_flight;
+    uint32_t consecutive_failures;
+    TimerWheel::Timer probe_timer;
+    uint32_t backoff_in_ms;
+
+    // statistics
+    uint64_t num_sent;
+    uint64_t num_dropped;
+    uint64_t num_failed;
+
+    enum class Status : uint8_t { OK, WOULD_BLOCK, ERROR };
+    static Status transmit(Entry& entry, const uint8_t* const packet, const unsigned long size);
+    bool isSendAllowed(void) const;
+    void onSendStarted(void);
+    void onSuccess(void);
+    void onFailure(void);
+    void enqueue(const Entry& entry, const uint8_t* const packet, const unsigned long size, LatencyTracer::Protocol protocol);
+
+public:
+    PeerSendQueue(const std::string& name);
+    ~PeerSendQueue(void);
+    static void setSendBackend(ISendBackend* backend) { send_backend = backend; }
+    static bool setNonBlocking(int fd);
+    void setPeerSocket(int fd) { peer_fd = fd; }
+
+    Result send(libspeedwire::SpeedwireSocket& socket, const uint8_t* const packet, const unsigned long size, const struct sockaddr* const dest, LatencyTracer::Protocol protocol);
+    void flush(void);
+    void onSendComplete(int result, const uint8_t* const packet, const unsigned long size, const struct sockaddr* const dest);
+    void onPeerError(void) { onFailure(); }     //!< an icmp error of an earlier send arrived on the peer socket
+    bool hasBacklog(void) const { return backlog.size() > 0; }
+    BreakerState getBreakerState(void) const { return state; }
+
+    static LatencyTracer::Protocol getProtocol(const libspeedwire::SpeedwireHeader& packet);
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef __READINGSPUBLISHER_HPP__
+#define __READINGSPUBLISHER_HPP__
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <SpeedwireHeader.hpp>
+#include <SpeedwireEmeterProtocol.hpp>
+#include <SpeedwireInverterProtocol.hpp>
+#include <SharedReadings.hpp>
+
+
+/**
+ *  Readings publisher
+ *  Publishes the latest decoded obis values of each emeter and the latest register values of each inverter
+ *  into a shared memory region, see SharedReadings.hpp for its layout. Each device slot is updated under its
+ *  seqlock; the router is the only writer.
+ */
+class ReadingsPublisher {
+protected:
+    SharedReadings::Region* region;
+    int fd;
+    std::string name;
+    std::map<uint64_t, uint32_t> device_index;      //!< slot index by device type, susy id and serial number
+
+    ReadingsPublisher(void);
+    ~ReadingsPublisher(void);
+
+    SharedReadings::Device* getDevice(SharedReadings::DeviceType type, uint16_t susyid, uint32_t serial);
+    static void beginUpdate(SharedReadings::Device& device);
+    static void endUpdate(SharedReadings::Device& device);
+    static void setValue(SharedReadings::Device& device, uint32_t key, uint32_t flags, uint64_t value);
+
+public:
+    static ReadingsPublisher& getInstance(void);
+
+    bool open(const std::string& name);
+    void close(void);
+    bool isOpen(void) const { return region != NULL; }
+
+    void publish(const libspeedwire::SpeedwireEmeterProtocol& emeter_packet);
+    void publish(const libspeedwire::SpeedwireInverterProtocol& inverter_packet, const libspeedwire::SpeedwireHeader& speedwire_packet);
+};
+
+#endif
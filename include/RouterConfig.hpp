@@ -0,0 +1,77 @@
+#ifndef __ROUTERCONFIG_HPP__
+#define __ROUTERCONFIG_HPP__
+
+#include <cstdint>
+#include <array>
+#include <string>
+#include <vector>
+#include <Logger.hpp>
+#include <LatencyTracer.hpp>
+#include <PeerSendQueue.hpp>
+
+
+/**
+ *  Router configuration
+ *  An immutable snapshot of the configuration, covering peers, interfaces, patch rules, send queue policies and
+ *  buffer sizes. Snapshots are parsed from a simple line-based configuration file of key = value pairs; lines
+ *  starting with # are comments. Once published by the ConfigManager, a snapshot is never modified.
+ */
+class RouterConfig {
+public:
+    /**
+     *  Patch rule limiting the value of an obis element in emeter packets to the given maximum value
+     */
+    class PatchRule {
+    public:
+        uint8_t  channel;
+        uint8_t  index;
+        uint8_t  type;
+        uint8_t  tariff;
+        uint32_t max_value;                 //!< maximum value, encoded as in the packet, e.g. in 0.1 W for power
+        std::array<uint8_t, 12> bytes;      //!< obis element holding the maximum value
+
+        PatchRule(uint8_t channel, uint8_t index, uint8_t type, uint8_t tariff, uint32_t max_value);
+        bool matches(uint8_t c, uint8_t i, uint8_t ty, uint8_t ta) const { return c == channel && i == index && ty == type && ta == tariff; }
+    };
+
+    /**
+     *  Trim rule restricting emeter packets forwarded to the given peer to the given obis elements
+     */
+    class TrimRule {
+    public:
+        std::string peer;
+        std::vector<std::array<uint8_t, 4> > obis;     //!< allowed obis elements as channel, index, type, tariff
+
+        TrimRule(const std::string& peer_ip) : peer(peer_ip), obis() {}
+    };
+
+    libspeedwire::LogLevel log_level;
+    std::vector<std::string> peers;         //!< unicast peers, pre-registered for discovery
+    std::vector<std::string> interfaces;    //!< local interfaces to forward to; all interfaces if empty
+    std::vector<PatchRule> patch_rules;     //!< emeter patch rules
+    std::vector<TrimRule> trim_rules;       //!< emeter trim rules, at most one per peer
+    uint32_t proxy_ttl_in_ms;               //!< time-to-live of cached inverter responses; proxy mode is disabled if 0
+    size_t   history_size;                  //!< number of bounce detector history entries
+    size_t   max_backlog;                   //!< number of packets in each send backlog
+    std::array<PeerSendQueue::DropPolicy, LatencyTracer::protocol_count> drop_policy;
+    uint32_t failure_threshold;             //!< consecutive send failures opening the circuit breaker
+    uint32_t min_backoff_in_ms;             //!< initial circuit breaker backoff time
+    uint32_t max_backoff_in_ms;             //!< maximum circuit breaker backoff time
+    std::string io_backend;                 //!< io_uring, packet_ring or poll; applied at startup only
+    std::string capture_path;               //!< path prefix of pcapng capture files; capturing is disabled if empty
+    uint64_t capture_file_size;             //!< size of a capture file before rotating to the next one
+    unsigned capture_file_count;            //!< number of rotated capture files
+    uint32_t storm_source_rate;             //!< bounce drops per second quarantining a source, 0 to disable
+    uint32_t storm_interface_rate;          //!< bounce drops per second quarantining an arrival interface, 0 to disable
+    uint32_t storm_release_windows;         //!< seconds below a quarter of the rate releasing a quarantine
+    std::string shared_memory;              //!< name of the shared memory readings region, disabled if empty; applied at startup only
+
+    RouterConfig(void);
+    bool parse(const std::string& path);
+
+    bool isPeer(const std::string& ip) const;
+    const TrimRule* findTrimRule(const std::string& peer_ip) const;
+    bool isInterfaceEnabled(const std::string& ip) const;
+};
+
+#endif
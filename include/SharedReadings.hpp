@@ -0,0 +1,279 @@
+#ifndef __SHAREDREADINGS_HPP__
+#define __SHAREDREADINGS_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+/**
+ *  Shared memory snapshot of the latest emeter and inverter readings
+ *  The router publishes the latest decoded values of each emeter and inverter into a shared memory region
+ *  created by shm_open, such that local consumers can read current values without opening speedwire sockets
+ *  or parsing packets. This header is self-contained and does not depend on libspeedwire; consumers include
+ *  it and use SharedReadings::Reader. Linking with -lrt may be required on older glibc versions.
+ *
+ *  The region has a fixed layout in host byte order with natural alignment:
+ *
+ *      offset  size  region header
+ *           0     4  magic, 0x52445753 ("SWDR" in little endian byte order)
+ *           4     2  layout version, 1
+ *           6     2  size of the region header in bytes, 64
+ *           8     4  size of a device slot in bytes
+ *          12     4  number of device slots
+ *          16     4  number of values per device slot
+ *          20     4  number of used device slots; slots are assigned in order and never released
+ *          24     8  router start time in ms since the unix epoch
+ *          32    32  reserved
+ *          64        device slots
+ *
+ *      offset  size  device slot
+ *           0     4  sequence number of the seqlock; odd while the slot is being written
+ *           4     2  device type, 1 emeter or 2 inverter
+ *           6     2  susy id
+ *           8     4  serial number
+ *          12     4  number of valid values
+ *          16     8  time of the last update in ms since the unix epoch
+ *          24     4  device timestamp of the last update; emeter ticks in ms or inverter record time in s
+ *          28     4  reserved
+ *          32        values, 16 bytes each
+ *
+ *      offset  size  value
+ *           0     4  key; emeter: obis channel << 24 | index << 16 | type << 8 | tariff
+ *                         inverter: register id of the record (the first 4 record bytes, little endian) & 0x00ffffff
+ *           4     4  flags; emeter: 0, inverter: data type byte of the register id, e.g. 0x00 unsigned, 0x40 signed
+ *           8     8  raw value as sent by the device; emeter: unscaled obis value, inverter: 32 bit values are
+ *                    zero extended, 64 bit counters are stored as is; sma not-a-number markers are passed through
+ *
+ *  Writers increment the sequence number to an odd value, update the slot and increment it to an even value.
+ *  Readers retry if the sequence number is odd or has changed while they were reading. When the router
+ *  restarts, it re-initializes the same region; readers can detect this by a changed start time.
+ */
+namespace SharedReadings {
+
+    static const uint32_t magic         = 0x52445753;
+    static const uint16_t version       = 1;
+    static const uint32_t max_devices   = 64;
+    static const uint32_t max_values    = 96;
+    static const char* const default_name = "/speedwire-router";
+    static const unsigned max_retries   = 100000;   //!< retries of a read, e.g. if the writer died while updating a slot
+
+    enum DeviceType : uint16_t {
+        EMETER   = 1,
+        INVERTER = 2
+    };
+
+    struct Value {
+        uint32_t key;
+        uint32_t flags;
+        uint64_t value;
+    };
+
+    struct Device {
+        std::atomic<uint32_t> sequence;
+        uint16_t type;
+        uint16_t susyid;
+        uint32_t serial;
+        uint32_t num_values;
+        uint64_t update_time_ms;
+        uint32_t device_time;
+        uint32_t reserved;
+        Value    values[max_values];
+    };
+
+    struct Region {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t header_size;
+        uint32_t device_size;
+        uint32_t max_devices;
+        uint32_t max_values;
+        std::atomic<uint32_t> num_devices;
+        uint64_t start_time_ms;
+        uint8_t  reserved[32];
+        Device   devices[SharedReadings::max_devices];
+    };
+
+    static_assert(sizeof(Value) == 16, "unexpected value layout");
+    static_assert(sizeof(Device) == 32 + 16 * max_values, "unexpected device slot layout");
+    static_assert(offsetof(Region, devices) == 64, "unexpected region header layout");
+
+    /**
+     *  Encode an obis element given by its channel, index, type and tariff into a value key
+     */
+    inline uint32_t getObisKey(uint8_t channel, uint8_t index, uint8_t type, uint8_t tariff) {
+        return ((uint32_t)channel << 24) | ((uint32_t)index << 16) | ((uint32_t)type << 8) | (uint32_t)tariff;
+    }
+
+
+    /**
+     *  Copy of a device slot taken by Reader::read()
+     */
+    struct Snapshot {
+        uint16_t type;
+        uint16_t susyid;
+        uint32_t serial;
+        uint32_t num_values;
+        uint64_t update_time_ms;
+        uint32_t device_time;
+        Value    values[max_values];
+    };
+
+
+    /**
+     *  Reader of the shared memory region
+     *  The region is mapped read-only; all reads are lock-free and never block the router.
+     */
+    class Reader {
+    protected:
+        int fd;
+        const Region* region;
+
+    public:
+        Reader(void) : fd(-1), region(NULL) {}
+        ~Reader(void) { close(); }
+
+        /**
+         *  Open and map the region with the given name; returns false if it does not exist or has another layout
+         */
+        bool open(const char* name = default_name) {
+#ifndef _WIN32
+            close();
+            fd = shm_open(name, O_RDONLY, 0);
+            if (fd < 0) {
+                return false;
+            }
+            struct stat st;
+            if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Region)) {
+                close();
+                return false;
+            }
+            void* addr = mmap(NULL, sizeof(Region), PROT_READ, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED) {
+                close();
+                return false;
+            }
+            region = (const Region*)addr;
+            if (region->magic != magic || region->version != version || region->device_size != sizeof(Device) ||
+                region->max_devices != max_devices || region->max_values != max_values) {
+                close();
+                return false;
+            }
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        /**
+         *  Unmap and close the region
+         */
+        void close(void) {
+#ifndef _WIN32
+            if (region != NULL) {
+                munmap((void*)region, sizeof(Region));
+                region = NULL;
+            }
+            if (fd >= 0) {
+                ::close(fd);
+                fd = -1;
+            }
+#endif
+        }
+
+        bool isOpen(void) const { return region != NULL; }
+        const Region* getRegion(void) const { return region; }
+
+        /**
+         *  Get the number of used device slots
+         */
+        uint32_t getNumDevices(void) const {
+            return (region != NULL ? region->num_devices.load(std::memory_order_acquire) : 0);
+        }
+
+        /**
+         *  Get the device slot with the given index, or NULL
+         */
+        const Device* getDevice(uint32_t index) const {
+            return (index < getNumDevices() ? &region->devices[index] : NULL);
+        }
+
+        /**
+         *  Find the device slot of the given device type and serial number, or NULL; slots keep their device until the router restarts
+         */
+        const Device* findDevice(DeviceType type, uint32_t serial) const {
+            const uint32_t n = getNumDevices();
+            for (uint32_t i = 0; i < n; ++i) {
+                if (region->devices[i].type == type && region->devices[i].serial == serial) {
+                    return &region->devices[i];
+                }
+            }
+            return NULL;
+        }
+
+        /**
+         *  Read a single value of the given device in place, without copying the slot; returns false if the
+         *  device has no value with the given key or no consistent value could be read
+         */
+        static bool readValue(const Device& device, uint32_t key, uint64_t& value, uint64_t* update_time_ms = NULL) {
+            for (unsigned retry = 0; retry < max_retries; ++retry) {
+                const uint32_t seq = device.sequence.load(std::memory_order_acquire);
+                if ((seq & 1) != 0) {
+                    continue;
+                }
+                bool found = false;
+                uint32_t n = device.num_values;
+                n = (n < max_values ? n : max_values);
+                for (uint32_t i = 0; i < n; ++i) {
+                    if (device.values[i].key == key) {
+                        value = device.values[i].value;
+                        found = true;
+                        break;
+                    }
+                }
+                const uint64_t time = device.update_time_ms;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (device.sequence.load(std::memory_order_relaxed) == seq) {
+                    if (update_time_ms != NULL) *update_time_ms = time;
+                    return found;
+                }
+            }
+            return false;
+        }
+
+        /**
+         *  Read a consistent copy of the given device slot; returns false if no consistent copy could be read
+         */
+        static bool read(const Device& device, Snapshot& snapshot) {
+            for (unsigned retry = 0; retry < max_retries; ++retry) {
+                const uint32_t seq = device.sequence.load(std::memory_order_acquire);
+                if ((seq & 1) != 0) {
+                    continue;
+                }
+                snapshot.type           = device.type;
+                snapshot.susyid         = device.susyid;
+                snapshot.serial         = device.serial;
+                snapshot.num_values     = device.num_values;
+                snapshot.update_time_ms = device.update_time_ms;
+                snapshot.device_time    = device.device_time;
+                snapshot.num_values     = (snapshot.num_values < max_values ? snapshot.num_values : max_values);
+                memcpy(snapshot.values, device.values, snapshot.num_values * sizeof(Value));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (device.sequence.load(std::memory_order_relaxed) == seq) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+}   // namespace SharedReadings
+
+#endif
@@ -7,6 +7,8 @@
 #include <SpeedwirePacketSender.hpp>
 #include <BounceDetector.hpp>
 #include <PacketPatcher.hpp>
+#include <InverterQueryCache.hpp>
+#include <LatencyTracer.hpp>
 
 
 /**
@@ -23,6 +25,7 @@ protected:
     std::vector<SpeedwirePacketSender*>& senders;
     BounceDetector bounceDetector;
     PacketPatcher  packetPatcher;
+    LatencyTracer& tracer;
 
 public:
     EmeterPacketReceiver(libspeedwire::LocalHost& host, std::vector<SpeedwirePacketSender*>& senders);
@@ -39,10 +42,17 @@ protected:
     std::vector<SpeedwirePacketSender*>& senders;
     BounceDetector bounceDetector;
     PacketPatcher  packetPatcher;
+    InverterQueryCache queryCache;
+    bool proxyMode;
+    LatencyTracer& tracer;
+
+    void sendToRequester(const std::vector<uint8_t>& packet, const struct sockaddr& dst);
 
 public:
     InverterPacketReceiver(libspeedwire::LocalHost& host, std::vector<SpeedwirePacketSender*>& senders);
     virtual void receive(libspeedwire::SpeedwireHeader& packet, struct sockaddr& src);
+    void enableProxyMode(uint32_t ttl_in_ms);
+    void disableProxyMode(void) { proxyMode = false; }
 };
 
 
@@ -55,6 +65,7 @@ protected:
     std::vector<SpeedwirePacketSender*>& senders;
     BounceDetector bounceDetector;
     PacketPatcher  packetPatcher;
+    LatencyTracer& tracer;
 
 public:
     DiscoveryPacketReceiver(libspeedwire::LocalHost& host, std::vector<SpeedwirePacketSender*>& senders);
@@ -10,17 +10,37 @@
 #include <netinet/in.h>
 #include <net/if.h>
 #endif
+#include <array>
+#include <map>
 #include <LocalHost.hpp>
 #include <SpeedwireHeader.hpp>
 #include <SpeedwireEmeterProtocol.hpp>
 #include <SpeedwireInverterProtocol.hpp>
+#include <EmeterPacketTrimmer.hpp>
+#include <LatencyTracer.hpp>
+#include <PeerSendQueue.hpp>
+#include <SpeedwireSocket.hpp>
+
+class PacketDispatcher;
 
 
 /**
  *  Speedwire packet sender base class
  */
 class SpeedwirePacketSender {
+public:
+    /**
+     *  Interface for transports replacing the speedwire sockets, e.g. by a simulated network
+     */
+    class ITransport {
+    public:
+        virtual ~ITransport(void) {}
+        virtual void send(const SpeedwirePacketSender& sender, const uint8_t* const packet, const unsigned long size, const struct sockaddr* const dest) = 0;
+    };
+
 protected:
+    static ITransport* transport;
+
     const libspeedwire::LocalHost& local_host;
     std::string peer_ip;
     std::string local_interface_ip;
@@ -29,10 +49,25 @@ protected:
     struct in_addr  local_interface_in_addr;
     struct in6_addr local_interface_in6_addr;
     uint32_t local_interface_prefix_length;
+    EmeterPacketTrimmer emeter_trimmer;
+    std::array<uint8_t, 1500> trim_buffer;
+    LatencyTracer& tracer;
+    size_t trace_id;
+    PeerSendQueue send_queue;
+
+    const uint8_t* getSendBuffer(const libspeedwire::SpeedwireHeader& packet, unsigned long& size);
+    void transmit(const libspeedwire::SpeedwireHeader& packet, const struct sockaddr* const dest);
 
 public:
     SpeedwirePacketSender(const libspeedwire::LocalHost& localhost, const std::string& local_interface_ip, const std::string& peer_ip);
+    virtual ~SpeedwirePacketSender(void) {}
     virtual void send(libspeedwire::SpeedwireHeader& packet, const struct sockaddr& src) {};
+    EmeterPacketTrimmer& getEmeterPacketTrimmer(void) { return emeter_trimmer; }
+    const std::string& getLocalInterfaceIP(void) const { return local_interface_ip; }
+    const std::string& getPeerIP(void) const { return peer_ip; }
+    void setInterfacePrefixLength(uint32_t prefix_length) { local_interface_prefix_length = prefix_length; }
+    PeerSendQueue& getSendQueue(void) { return send_queue; }
+    static void setTransport(ITransport* replacement) { transport = replacement; }
 };
 
 
@@ -48,11 +83,45 @@ public:
 
 /**
  *  Speedwire packet sender class for unicast packets
+ *  Each peer is given its own non-blocking socket connected to the peer, such that a full socket buffer or an icmp
+ *  error of one peer does not affect other peers on the same interface. Answers and icmp errors arriving on this
+ *  socket are received through the packet dispatcher, as if they arrived on the local interface.
  */
 class UnicastPacketSender : public SpeedwirePacketSender {
+protected:
+    static PacketDispatcher* dispatcher;
+    int peer_fd;        //!< connected socket of the peer, -1 if packets are sent on the shared socket of the interface
+
+    int openPeerSocket(void);
+
 public:
     UnicastPacketSender(const libspeedwire::LocalHost& local_host, const std::string& local_interface, const std::string& peer_ip);
+    virtual ~UnicastPacketSender(void);
     virtual void send(libspeedwire::SpeedwireHeader& packet, const struct sockaddr& src);
+    static void setDispatcher(PacketDispatcher* receive_dispatcher) { dispatcher = receive_dispatcher; }
+};
+
+
+/**
+ *  Speedwire packet sender class for unicast answers to a requester, e.g. discovery responses and inverter
+ *  responses generated by the proxy; answers are sent to the source address and port of the request.
+ *  Senders of requesters that have not been answered for idle_timeout_in_ms are removed by a timer.
+ */
+class ReplyPacketSender : public SpeedwirePacketSender {
+public:
+    static const uint32_t idle_timeout_in_ms = 300000;
+
+protected:
+    static std::map<std::string, ReplyPacketSender*> instances;
+    uint64_t last_used_in_ms;       //!< time of the last answer, from the cached clock
+
+    static void expireIdleSenders(void);
+
+public:
+    ReplyPacketSender(const libspeedwire::LocalHost& local_host, const std::string& local_interface, const std::string& requester_ip);
+    void reply(const libspeedwire::SpeedwireHeader& packet, const struct sockaddr& requester);
+    static ReplyPacketSender& getSender(const libspeedwire::LocalHost& local_host, const std::string& local_interface, const std::string& requester_ip);
+    static void removeSenders(const std::string& local_interface);
 };
 
 #endif
@@ -0,0 +1,99 @@
+#ifndef __STORMDETECTOR_HPP__
+#define __STORMDETECTOR_HPP__
+
+#ifdef _WIN32
+#include <Winsock2.h>
+#include <ws2def.h>
+#else
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <TimerWheel.hpp>
+
+
+/**
+ *  Bounce storm detector
+ *  Counts bounce drops, i.e. packets whose fingerprint is already in the bounce detector history, per source
+ *  address and per arrival interface, identified by the interface index the kernel reports for each packet, such
+ *  that a storm on one lan does not quarantine other lans received through the same wildcard socket. If the count within a one second window exceeds the configured rate,
+ *  the source or interface is quarantined: its packets are dropped by a cheap check in the packet dispatcher,
+ *  before any protocol parsing, fingerprinting or logging. One in sample_interval packets is still passed on to
+ *  the bounce detector, and a quarantine is released once the bounce rate estimated from these samples stays
+ *  below a quarter of the configured rate for the configured number of windows, such that a busy, but no longer
+ *  looping source is released. Windows are rolled by a timer.
+ */
+class StormDetector {
+public:
+    static const uint32_t window_in_ms = 1000;
+    static const size_t   max_sources  = 1024;     //!< limit of tracked sources, e.g. if source addresses are spoofed
+    static const uint32_t sample_interval = 16;    //!< one in sample_interval quarantined packets is checked for bounces
+
+protected:
+    class Counters {
+    public:
+        uint32_t bounces;           //!< bounce drops in the current window; while quarantined, only sampled packets are checked
+        uint32_t arrivals;          //!< arrivals in the current window, counted while quarantined
+        uint32_t quiet_windows;     //!< consecutive windows below the release rate
+        bool     quarantined;
+        uint64_t dropped;           //!< packets dropped by the current quarantine
+        Counters(void) : bounces(0), arrivals(0), quiet_windows(0), quarantined(false), dropped(0) {}
+    };
+
+    class Interface : public Counters {
+    public:
+        int ifindex;                //!< arrival interface index, 0 if the kernel did not report it
+        std::string name;
+        Interface(int index, const std::string& interface_name) : ifindex(index), name(interface_name) {}
+    };
+
+    class Source : public Counters {
+    public:
+        struct sockaddr addr;
+    };
+
+    std::vector<Interface> interfaces;
+    std::unordered_map<uint64_t, Source> sources;
+    Interface* current_interface;   //!< interface of the packet currently being processed
+    size_t   num_quarantined;       //!< number of quarantined sources and interfaces
+    uint64_t num_storms;            //!< number of quarantines since start
+    uint64_t num_dropped;           //!< packets dropped by quarantines since start
+    TimerWheel& timer_wheel;
+    TimerWheel::Timer window_timer;
+
+    StormDetector(TimerWheel& timer_wheel);
+    static uint64_t getKey(const struct sockaddr& src);
+    bool sample(Counters& counters);
+    void quarantine(Counters& counters, const char* kind, const std::string& name, uint32_t rate);
+    bool release(Counters& counters, uint32_t release_rate, uint32_t release_windows, const char* kind, const std::string& name);
+    void rollWindow(void);
+
+public:
+    static StormDetector& getInstance(void);
+
+    /**
+     *  Early drop check for a packet that arrived on the given interface index from the given source; returns false
+     *  if the packet must be dropped. Without an active quarantine, this only finds the arrival interface.
+     */
+    bool admit(int ifindex, const struct sockaddr& src) {
+        if (current_interface == NULL || current_interface->ifindex != ifindex) {
+            current_interface = findInterface(ifindex);
+        }
+        return (num_quarantined == 0 ? true : admitQuarantined(src));
+    }
+    void bounced(const struct sockaddr& src);
+
+    bool isQuarantined(void) const { return num_quarantined > 0; }
+    uint64_t getNumStorms(void) const { return num_storms; }
+    uint64_t getNumDropped(void) const { return num_dropped; }
+    std::string getReport(void) const;
+
+protected:
+    Interface* findInterface(int ifindex);
+    bool admitQuarantined(const struct sockaddr& src);
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __TIMERWHEEL_HPP__
+#define __TIMERWHEEL_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <functional>
+
+
+/**
+ *  Hierarchical timer wheel
+ *  Timers are kept in intrusive lists hanging off four wheel levels; scheduling, cancelling and expiring a
+ *  timer takes O(1). Level 0 has 256 slots of one tick each, levels 1 to 3 have 64 slots each covering 64
+ *  times the range of the level below. Timers on higher levels are cascaded down as time advances. Time is
+ *  taken from the monotonic cached clock.
+ */
+class TimerWheel {
+public:
+    class Timer {
+        friend class TimerWheel;
+    protected:
+        Timer*      prev;
+        Timer*      next;
+        Timer**     slot;           //!< list head of the slot holding this timer, NULL if not scheduled
+        TimerWheel* wheel;          //!< wheel holding this timer, NULL if not scheduled
+        uint64_t    expiry_tick;
+        std::function<void(void)> callback;
+
+    public:
+        Timer(void) : prev(NULL), next(NULL), slot(NULL), wheel(NULL), expiry_tick(0), callback() {}
+        Timer(const std::function<void(void)>& cb) : prev(NULL), next(NULL), slot(NULL), wheel(NULL), expiry_tick(0), callback(cb) {}
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+        ~Timer(void);
+
+        void setCallback(const std::function<void(void)>& cb) { callback = cb; }
+        bool isScheduled(void) const { return slot != NULL; }
+    };
+
+    static const unsigned level0_bits  = 8;
+    static const unsigned level0_slots = 1u << level0_bits;
+    static const unsigned levelN_bits  = 6;
+    static const unsigned levelN_slots = 1u << levelN_bits;
+
+protected:
+    std::array<Timer*, level0_slots> level0;
+    std::array<std::array<Timer*, levelN_slots>, 3> levelN;
+    uint32_t tick_in_ms;
+    uint64_t current_tick;
+    size_t   num_timers;
+
+    void insert(Timer& timer);
+    static void unlink(Timer& timer);
+    void cascade(unsigned level, unsigned index);
+    bool isLevel0Empty(void) const;
+
+public:
+    TimerWheel(uint32_t tick_in_ms = 4);
+    static TimerWheel& getInstance(void);
+
+    void schedule(Timer& timer, uint32_t delay_in_ms);
+    void cancel(Timer& timer);
+    void advance(uint64_t now_in_ms);
+    int64_t getTimeUntilNextExpiry(uint64_t now_in_ms) const;
+    size_t size(void) const { return num_timers; }
+};
+
+#endif
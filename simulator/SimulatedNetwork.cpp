@@ -0,0 +1,305 @@
+#include <ctime>
+#include <cstring>
+#include <AddressConversion.hpp>
+#include <SpeedwireByteEncoding.hpp>
+#include <CachedClock.hpp>
+#include <TimerWheel.hpp>
+#include <PeerSendQueue.hpp>
+#include <SimulatedNetwork.hpp>
+using namespace libspeedwire;
+
+
+/**
+ *  Simulated network
+ *  An in-process network of subnets (segments) connected by router instances, replacing the speedwire sockets of
+ *  the senders. Packets are delivered through an event queue under a virtual clock that drives the cached clock
+ *  and the timer wheel, such that simulation runs are deterministic.
+ */
+
+/**
+ *  Router instance constructor - the senders are added by the simulated network
+ */
+SimulatedNetwork::Router::Router(LocalHost& localhost, EventLoop& event_loop) :
+    senders(),
+    emeter_receiver(localhost, senders),
+    inverter_receiver(localhost, senders),
+    discovery_receiver(localhost, senders),
+    dispatcher(localhost, event_loop) {
+    dispatcher.registerReceiver(emeter_receiver);
+    dispatcher.registerReceiver(inverter_receiver);
+    dispatcher.registerReceiver(discovery_receiver);
+}
+
+/**
+ *  Router instance destructor
+ */
+SimulatedNetwork::Router::~Router(void) {
+    for (auto& sender : senders) {
+        delete sender;
+    }
+}
+
+/**
+ *  Constructor
+ */
+SimulatedNetwork::SimulatedNetwork(LocalHost& host, EventLoop& loop, size_t segments, uint32_t link_delay) :
+    localhost(host),
+    event_loop(loop),
+    num_segments(segments),
+    link_delay_in_ms(link_delay),
+    current_key(0),
+    sequence(0),
+    now(CachedClock::getTimeInMs()) {
+}
+
+/**
+ *  Add a router instance with an interface on each of the given segments; the interface ip address is derived
+ *  from the segment and the router number
+ */
+void SimulatedNetwork::addRouter(const std::vector<size_t>& segments) {
+    routers.push_back(std::unique_ptr<Router>(new Router(localhost, event_loop)));
+    Router* router = routers.back().get();
+    for (const auto& segment : segments) {
+        Interface iface;
+        iface.ip      = getInterfaceIP(segment, routers.size());
+        iface.segment = segment;
+        iface.router  = router;
+        interfaces.push_back(iface);
+        MulticastPacketSender* sender = new MulticastPacketSender(localhost, iface.ip, "239.12.255.254");
+        sender->setInterfacePrefixLength(24);
+        router->senders.push_back(sender);
+    }
+}
+
+/**
+ *  Inject an emeter packet with the given serial number and timestamp from a device on the given segment
+ */
+void SimulatedNetwork::injectEmeter(size_t segment, uint32_t serial, uint32_t time) {
+    std::vector<uint8_t> packet = { 'S', 'M', 'A', 0x00, 0x00, 0x04, 0x02, 0xa0, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x10, 0x60, 0x69 };
+    packet.resize(packet.size() + 10 + 3 * 8 + 4);
+    uint8_t* payload = &packet[18];
+    SpeedwireByteEncoding::setUint16BigEndian(payload + 0, 349);
+    SpeedwireByteEncoding::setUint32BigEndian(payload + 2, serial);
+    SpeedwireByteEncoding::setUint32BigEndian(payload + 6, time);
+    const uint8_t obis[3][4] = { { 0, 1, 4, 0 }, { 0, 2, 4, 0 }, { 144, 0, 0, 0 } };
+    for (int i = 0; i < 3; ++i) {
+        memcpy(payload + 10 + 8 * i, obis[i], 4);
+        SpeedwireByteEncoding::setUint32BigEndian(payload + 14 + 8 * i, (i < 2 ? (serial + time) % 50000 : 0x02001252));
+    }
+    // the data2 tag length covers the protocol id and the payload, but not the end-of-data tag
+    SpeedwireByteEncoding::setUint16BigEndian(&packet[12], (uint16_t)(packet.size() - 16 - 4));
+    inject(segment, packet);
+}
+
+/**
+ *  Inject an inverter broadcast query with the given source serial number and packet id from a device on the
+ *  given segment
+ */
+void SimulatedNetwork::injectInverter(size_t segment, uint32_t serial, uint16_t packet_id) {
+    std::vector<uint8_t> packet = { 'S', 'M', 'A', 0x00, 0x00, 0x04, 0x02, 0xa0, 0x00, 0x00, 0x00, 0x01, 0x00, 0x26, 0x00, 0x10, 0x60, 0x65 };
+    packet.resize(packet.size() + 36 + 4);
+    uint8_t* payload = &packet[18];
+    payload[0] = 9;
+    payload[1] = 0xa0;
+    SpeedwireByteEncoding::setUint16LittleEndian(payload + 2,  0xffff);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 4,  0xffffffff);
+    SpeedwireByteEncoding::setUint16LittleEndian(payload + 10, 0x007d);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 12, serial);
+    SpeedwireByteEncoding::setUint16LittleEndian(payload + 22, (uint16_t)(packet_id | 0x8000));
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 24, 0x53800200);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 28, 0x00251e00);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 32, 0x00251eff);
+    inject(segment, packet);
+}
+
+/**
+ *  Inject a discovery request from a device on the given segment
+ */
+void SimulatedNetwork::injectDiscovery(size_t segment) {
+    std::vector<uint8_t> packet = { 'S', 'M', 'A', 0x00, 0x00, 0x04, 0x02, 0xa0, 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00 };
+    inject(segment, packet);
+}
+
+/**
+ *  Record the injection of the given packet and transmit it onto the given segment; the key is salted with the
+ *  segment, such that identical packets injected on different segments, like discovery requests, are tracked separately
+ */
+void SimulatedNetwork::inject(size_t segment, const std::vector<uint8_t>& packet) {
+    Injection injection;
+    uint64_t key = (getPacketKey(packet.data(), (unsigned long)packet.size(), injection.type) ^ (uint64_t)segment) * 1099511628211ull;
+    if (key == 0) {
+        key = 1;
+    }
+    injection.uid = sequence;
+    injection.deliveries.assign(num_segments, 0);
+    injection.deliveries[segment] = 1;
+    injections[key] = injection;
+    ++metrics.injected[(size_t)injection.type];
+    transmitToSegment(segment, getInterfaceIP(segment, 200), std::string(), key, std::make_shared<std::vector<uint8_t> >(packet));
+}
+
+/**
+ *  Transport callback - a router sends a packet; multicast packets are transmitted onto the segment of the sending
+ *  interface, unicast packets to the interface with the destination address. The packet belongs to the injection
+ *  of the packet the router is receiving, if it is of the same type; other packets, like inverter responses
+ *  generated by a proxy, are counted as forwarded only.
+ */
+void SimulatedNetwork::send(const SpeedwirePacketSender& sender, const uint8_t* const packet, const unsigned long size, const struct sockaddr* const dest) {
+    const Interface* src = findInterface(sender.getLocalInterfaceIP());
+    const Interface* dst = (dest != NULL && dest->sa_family == AF_INET ? findInterface(AddressConversion::toString(*dest)) : src);
+    if (src == NULL || dst == NULL) {
+        return;
+    }
+    PacketType type;
+    getPacketKey(packet, size, type);
+    ++metrics.forwarded[(size_t)type];
+
+    uint64_t key = 0;
+    auto it = injections.find(current_key);
+    if (it != injections.end() && it->second.type == type) {
+        ++it->second.deliveries[dst->segment];
+        key = current_key;
+    }
+    auto copy = std::make_shared<std::vector<uint8_t> >(packet, packet + size);
+    if (dest == NULL) {
+        transmitToSegment(dst->segment, src->ip, src->ip, key, copy);
+    }
+    else if (dst->router != NULL) {
+        Event event;
+        event.time            = now + link_delay_in_ms;
+        event.sequence        = sequence++;
+        event.interface_index = (size_t)(dst - interfaces.data());
+        event.src             = getSockAddr(src->ip);
+        event.key             = key;
+        event.packet          = copy;
+        events.push(event);
+    }
+}
+
+/**
+ *  Schedule the reception of the given packet by all router interfaces on the given segment, except the
+ *  interface with the given ip address
+ */
+void SimulatedNetwork::transmitToSegment(size_t segment, const std::string& src_ip, const std::string& exclude_ip, uint64_t key, const std::shared_ptr<std::vector<uint8_t> >& packet) {
+    for (size_t i = 0; i < interfaces.size(); ++i) {
+        const Interface& iface = interfaces[i];
+        if (iface.segment == segment && iface.router != NULL && iface.ip != exclude_ip) {
+            Event event;
+            event.time            = now + link_delay_in_ms;
+            event.sequence        = sequence++;
+            event.interface_index = i;
+            event.src             = getSockAddr(src_ip);
+            event.key             = key;
+            event.packet          = packet;
+            events.push(event);
+        }
+    }
+}
+
+/**
+ *  Process receive events up to the given virtual time; the cached clock and the timer wheel follow the
+ *  virtual time. Processing stops early if the given number of events is exceeded, e.g. in a packet storm.
+ */
+void SimulatedNetwork::runUntil(uint64_t time_in_ms, uint64_t max_events) {
+    std::clock_t start = std::clock();
+    while (events.size() > 0 && events.top().time <= time_in_ms) {
+        if (metrics.events >= max_events) {
+            metrics.event_limit_reached = true;
+            break;
+        }
+        Event event = events.top();
+        events.pop();
+        if (event.time > now) {
+            now = event.time;
+            CachedClock::setTimeInMs(now);
+            TimerWheel::getInstance().advance(now);
+        }
+
+        // each router gets its own copy, since packets may be patched in place
+        std::vector<uint8_t> buffer(*event.packet);
+        SpeedwireHeader packet(buffer.data(), (unsigned long)buffer.size());
+        struct sockaddr src = event.src;
+        PacketType type;
+        getPacketKey(event.packet->data(), (unsigned long)event.packet->size(), type);
+        std::clock_t dispatch_start = std::clock();
+        current_key = event.key;
+        interfaces[event.interface_index].router->dispatcher.dispatch(packet, src, 0);
+        current_key = 0;
+        metrics.type_cpu_seconds[(size_t)type] += (double)(std::clock() - dispatch_start) / CLOCKS_PER_SEC;
+        ++metrics.events;
+    }
+    if (time_in_ms > now) {
+        now = time_in_ms;
+        CachedClock::setTimeInMs(now);
+        TimerWheel::getInstance().advance(now);
+    }
+    metrics.cpu_seconds += (double)(std::clock() - start) / CLOCKS_PER_SEC;
+}
+
+/**
+ *  Get the simulation results; duplicate and missed deliveries are derived from the recorded injections
+ */
+const SimulatedNetwork::Metrics& SimulatedNetwork::getMetrics(void) {
+    metrics.duplicates.fill(0);
+    metrics.missed.fill(0);
+    for (const auto& entry : injections) {
+        const Injection& injection = entry.second;
+        for (const auto& count : injection.deliveries) {
+            if (count == 0) {
+                ++metrics.missed[(size_t)injection.type];
+            }
+            else {
+                metrics.duplicates[(size_t)injection.type] += count - 1;
+            }
+        }
+    }
+    return metrics;
+}
+
+/**
+ *  Get the ip address of the given host on the given segment; segment n is the subnet 10.x.y.0/24 with n = 256 * x + y
+ */
+std::string SimulatedNetwork::getInterfaceIP(size_t segment, size_t host) {
+    return "10." + std::to_string((segment >> 8) & 0xff) + "." + std::to_string(segment & 0xff) + "." + std::to_string(host);
+}
+
+/**
+ *  Get the socket address of the given ipv4 address and the speedwire port
+ */
+struct sockaddr SimulatedNetwork::getSockAddr(const std::string& ip) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr = AddressConversion::toInAddress(ip);
+    addr.sin_port = htons(9522);
+    return AddressConversion::toSockAddr(addr);
+}
+
+/**
+ *  Find the interface with the given ip address
+ */
+const SimulatedNetwork::Interface* SimulatedNetwork::findInterface(const std::string& ip) const {
+    for (const auto& iface : interfaces) {
+        if (iface.ip == ip) {
+            return &iface;
+        }
+    }
+    return NULL;
+}
+
+/**
+ *  Get a key identifying the given packet and its type; the key is a FNV-1a hash of the packet bytes
+ */
+uint64_t SimulatedNetwork::getPacketKey(const uint8_t* const packet, const unsigned long size, PacketType& type) {
+    SpeedwireHeader header(packet, size);
+    switch (PeerSendQueue::getProtocol(header)) {
+    case LatencyTracer::Protocol::EMETER:    type = PacketType::EMETER;    break;
+    case LatencyTracer::Protocol::DISCOVERY: type = PacketType::DISCOVERY; break;
+    default:                                 type = PacketType::INVERTER;  break;
+    }
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned long i = 0; i < size; ++i) {
+        hash = (hash ^ packet[i]) * 1099511628211ull;
+    }
+    return hash;
+}
@@ -0,0 +1,142 @@
+#ifndef __SIMULATEDNETWORK_HPP__
+#define __SIMULATEDNETWORK_HPP__
+
+#ifdef _WIN32
+#include <Winsock2.h>
+#include <ws2ipdef.h>
+#else
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+#include <cstdint>
+#include <array>
+#include <functional>
+#include <map>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+#include <LocalHost.hpp>
+#include <EventLoop.hpp>
+#include <PacketDispatcher.hpp>
+#include <SpeedwirePacketReceiver.hpp>
+#include <SpeedwirePacketSender.hpp>
+
+
+/**
+ *  Simulated network
+ *  An in-process network of subnets (segments) connected by router instances, replacing the speedwire sockets of
+ *  the senders. Packets are delivered through an event queue under a virtual clock that drives the cached clock
+ *  and the timer wheel, such that simulation runs are deterministic. For each injected packet, the segments it
+ *  reaches are recorded to derive amplification, duplicate and missed deliveries; packets forwarded by a router
+ *  are attributed to the injection of the packet it received, since identical packets may be injected on
+ *  several segments.
+ */
+class SimulatedNetwork : public SpeedwirePacketSender::ITransport {
+public:
+    enum class PacketType : uint8_t {
+        EMETER    = 0,
+        INVERTER  = 1,
+        DISCOVERY = 2
+    };
+    static const size_t packet_type_count = 3;
+
+    /**
+     *  Router instance with one interface on each of its segments
+     */
+    class Router {
+    public:
+        std::vector<SpeedwirePacketSender*> senders;
+        EmeterPacketReceiver    emeter_receiver;
+        InverterPacketReceiver  inverter_receiver;
+        DiscoveryPacketReceiver discovery_receiver;
+        PacketDispatcher        dispatcher;
+
+        Router(libspeedwire::LocalHost& localhost, EventLoop& event_loop);
+        ~Router(void);
+    };
+
+    /**
+     *  Simulation results
+     */
+    class Metrics {
+    public:
+        std::array<uint64_t, packet_type_count> injected;       //!< packets injected by devices
+        std::array<uint64_t, packet_type_count> forwarded;      //!< packets sent by routers
+        std::array<uint64_t, packet_type_count> duplicates;     //!< deliveries to segments that already had the packet
+        std::array<uint64_t, packet_type_count> missed;         //!< segments never reached by an injected packet
+        uint64_t events;                                        //!< processed receive events
+        double   cpu_seconds;                                   //!< cpu time spent in the routers
+        std::array<double, packet_type_count> type_cpu_seconds; //!< cpu time spent in the routers receiving packets of each type
+        bool     event_limit_reached;
+
+        Metrics(void) : events(0), cpu_seconds(0.0), event_limit_reached(false) {
+            injected.fill(0); forwarded.fill(0); duplicates.fill(0); missed.fill(0); type_cpu_seconds.fill(0.0);
+        }
+    };
+
+protected:
+    class Interface {
+    public:
+        std::string ip;
+        size_t segment;
+        Router* router;                     //!< NULL for devices
+    };
+
+    class Event {
+    public:
+        uint64_t time;
+        uint64_t sequence;
+        size_t   interface_index;           //!< receiving router interface
+        struct sockaddr src;
+        uint64_t key;                       //!< key of the injection the packet belongs to
+        std::shared_ptr<std::vector<uint8_t> > packet;
+        bool operator>(const Event& other) const { return (time != other.time ? time > other.time : sequence > other.sequence); }
+    };
+
+    class Injection {
+    public:
+        PacketType type;
+        uint64_t   uid;
+        std::vector<uint32_t> deliveries;   //!< number of deliveries per segment
+    };
+
+    libspeedwire::LocalHost& localhost;
+    EventLoop& event_loop;
+    size_t num_segments;
+    uint32_t link_delay_in_ms;
+    std::vector<std::unique_ptr<Router> > routers;
+    std::vector<Interface> interfaces;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event> > events;
+    std::map<uint64_t, Injection> injections;   //!< injections by packet key, salted with the injecting segment
+    uint64_t current_key;                       //!< key of the injection currently received by a router, 0 if none
+    uint64_t sequence;
+    uint64_t now;
+    Metrics metrics;
+
+    static std::string getInterfaceIP(size_t segment, size_t host);
+    static struct sockaddr getSockAddr(const std::string& ip);
+    static uint64_t getPacketKey(const uint8_t* const packet, const unsigned long size, PacketType& type);
+    const Interface* findInterface(const std::string& ip) const;
+    void transmitToSegment(size_t segment, const std::string& src_ip, const std::string& exclude_ip, uint64_t key, const std::shared_ptr<std::vector<uint8_t> >& packet);
+    void inject(size_t segment, const std::vector<uint8_t>& packet);
+
+public:
+    SimulatedNetwork(libspeedwire::LocalHost& localhost, EventLoop& event_loop, size_t num_segments, uint32_t link_delay_in_ms = 1);
+
+    void addRouter(const std::vector<size_t>& segments);
+    size_t getNumRouters(void) const { return routers.size(); }
+    size_t getNumSegments(void) const { return num_segments; }
+
+    void injectEmeter(size_t segment, uint32_t serial, uint32_t time);
+    void injectInverter(size_t segment, uint32_t serial, uint16_t packet_id);
+    void injectDiscovery(size_t segment);
+
+    void runUntil(uint64_t time_in_ms, uint64_t max_events);
+    uint64_t getTimeInMs(void) const { return now; }
+    const Metrics& getMetrics(void);
+
+    virtual void send(const SpeedwirePacketSender& sender, const uint8_t* const packet, const unsigned long size, const struct sockaddr* const dest);
+};
+
+#endif
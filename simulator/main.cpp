@@ -0,0 +1,181 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <LocalHost.hpp>
+#include <Logger.hpp>
+#include <CachedClock.hpp>
+#include <TimerWheel.hpp>
+#include <EventLoop.hpp>
+#include <ConfigManager.hpp>
+#include <SpeedwirePacketSender.hpp>
+#include <SimulatedNetwork.hpp>
+using namespace libspeedwire;
+
+static Logger logger("simulator");
+
+class LogListener : public ILogListener {
+public:
+    virtual void log_msg(const std::string& msg, const LogLevel &level) {
+        fprintf(stderr, "%s", msg.c_str());
+    }
+    virtual void log_msg_w(const std::wstring& msg, const LogLevel &level) {
+        fprintf(stderr, "%ls", msg.c_str());
+    }
+};
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: speedwire-router-simulator [options]\n"
+        "  --topology line|ring|mesh|redundant   router topology (default line)\n"
+        "  --segments n                          number of subnets (default 3)\n"
+        "  --routers n                           number of parallel routers for the redundant topology (default 2)\n"
+        "  --history n                           bounce detector history size (default from configuration)\n"
+        "  --devices n                           number of emeter and inverter devices per subnet (default 1)\n"
+        "  --duration ms                         simulated time (default 10000)\n"
+        "  --interval ms                         emeter packet interval (default 1000)\n"
+        "  --delay ms                            link delay (default 1)\n"
+        "  --max-events n                        stop after n receive events (default 10000000)\n");
+}
+
+
+int main(int argc, char **argv) {
+
+    // start the virtual clock before any timer is scheduled; all timers are driven by the simulated network
+    CachedClock::setTimeInMs(1000000);
+
+    // log errors and warnings only; the routers are noisy at higher levels
+    ILogListener *log_listener = new LogListener();
+    Logger::setLogListener(log_listener, LogLevel::LOG_ERROR | LogLevel::LOG_WARNING);
+
+    // parse command line
+    std::string topology = "line";
+    size_t   num_segments = 3;
+    size_t   num_routers  = 2;
+    size_t   history_size = 0;
+    size_t   num_devices  = 1;
+    uint64_t duration     = 10000;
+    uint64_t interval     = 1000;
+    uint32_t delay        = 1;
+    uint64_t max_events   = 10000000;
+    for (int i = 1; i < argc; ++i) {
+        const std::string option = argv[i];
+        if (i + 1 >= argc) {
+            usage();
+            return 1;
+        }
+        const char* value = argv[++i];
+        if      (option == "--topology")   { topology     = value; }
+        else if (option == "--segments")   { num_segments = strtoul(value, NULL, 10); }
+        else if (option == "--routers")    { num_routers  = strtoul(value, NULL, 10); }
+        else if (option == "--history")    { history_size = strtoul(value, NULL, 10); }
+        else if (option == "--devices")    { num_devices  = strtoul(value, NULL, 10); }
+        else if (option == "--duration")   { duration     = strtoull(value, NULL, 10); }
+        else if (option == "--interval")   { interval     = strtoull(value, NULL, 10); }
+        else if (option == "--delay")      { delay        = (uint32_t)strtoul(value, NULL, 10); }
+        else if (option == "--max-events") { max_events   = strtoull(value, NULL, 10); }
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (num_segments < 2 || num_segments > 65536 || num_routers < 1 || num_routers > 199 || interval == 0) {
+        usage();
+        return 1;
+    }
+
+    // optionally override the bounce detector history size; the receivers pick it up from the configuration snapshot
+    if (history_size > 0) {
+        std::shared_ptr<RouterConfig> config = std::make_shared<RouterConfig>();
+        config->history_size = history_size;
+        ConfigManager::getInstance().publish(config);
+    }
+
+    // build the topology
+    LocalHost& localhost = LocalHost::getInstance();
+    EventLoop event_loop(TimerWheel::getInstance());
+    SimulatedNetwork network(localhost, event_loop, num_segments, delay);
+    SpeedwirePacketSender::setTransport(&network);
+
+    if (topology == "line" || topology == "ring") {
+        // a router between each pair of adjacent subnets; the ring closes the loop between the last and the first subnet
+        for (size_t s = 0; s + 1 < num_segments; ++s) {
+            network.addRouter({ s, s + 1 });
+        }
+        if (topology == "ring" && num_segments > 2) {
+            network.addRouter({ num_segments - 1, 0 });
+        }
+    }
+    else if (topology == "mesh") {
+        // a router between each pair of subnets
+        for (size_t s = 0; s < num_segments; ++s) {
+            for (size_t t = s + 1; t < num_segments; ++t) {
+                network.addRouter({ s, t });
+            }
+        }
+    }
+    else if (topology == "redundant") {
+        // parallel routers, each connected to all subnets
+        std::vector<size_t> segments;
+        for (size_t s = 0; s < num_segments; ++s) {
+            segments.push_back(s);
+        }
+        for (size_t r = 0; r < num_routers; ++r) {
+            network.addRouter(segments);
+        }
+    }
+    else {
+        usage();
+        return 1;
+    }
+    if (network.getNumRouters() > 199) {
+        fprintf(stderr, "too many routers: %lu\n", (unsigned long)network.getNumRouters());
+        return 1;
+    }
+
+    // inject emeter packets and inverter queries from each device every interval, and a discovery request from
+    // each subnet at the start
+    const uint64_t start = network.getTimeInMs();
+    for (size_t s = 0; s < num_segments; ++s) {
+        network.injectDiscovery(s);
+    }
+    uint16_t packet_id = 0;
+    for (uint64_t t = 0; t < duration; t += interval) {
+        for (size_t s = 0; s < num_segments; ++s) {
+            for (size_t d = 0; d < num_devices; ++d) {
+                uint32_t serial = (uint32_t)(1000000000 + s * 1000 + d);
+                network.injectEmeter(s, serial, (uint32_t)(start + t));
+                network.injectInverter(s, serial, (uint16_t)(++packet_id & 0x7fff));
+            }
+        }
+        network.runUntil(start + t + interval, max_events);
+        if (network.getMetrics().event_limit_reached == true) {
+            break;
+        }
+    }
+    // let in-flight packets settle
+    network.runUntil(network.getTimeInMs() + 1000 + 100 * (uint64_t)delay, max_events);
+    SpeedwirePacketSender::setTransport(NULL);
+
+    // report
+    const SimulatedNetwork::Metrics& metrics = network.getMetrics();
+    const char* names[SimulatedNetwork::packet_type_count] = { "emeter", "inverter", "discovery" };
+    printf("topology %s: %lu segments, %lu routers, %lu ms simulated\n", topology.c_str(), (unsigned long)num_segments, (unsigned long)network.getNumRouters(), (unsigned long)(network.getTimeInMs() - start));
+    printf("%-10s %10s %10s %14s %10s %10s %12s\n", "type", "injected", "forwarded", "amplification", "duplicates", "missed", "us/forward");
+    for (size_t i = 0; i < SimulatedNetwork::packet_type_count; ++i) {
+        double amplification = (metrics.injected[i] > 0 ? (double)metrics.forwarded[i] / metrics.injected[i] : 0.0);
+        double cpu_per_forward = (metrics.forwarded[i] > 0 ? 1e6 * metrics.type_cpu_seconds[i] / metrics.forwarded[i] : 0.0);
+        printf("%-10s %10lu %10lu %8.2f (%3lu) %10lu %10lu %12.2f\n", names[i], (unsigned long)metrics.injected[i], (unsigned long)metrics.forwarded[i],
+               amplification, (unsigned long)(num_segments - 1), (unsigned long)metrics.duplicates[i], (unsigned long)metrics.missed[i], cpu_per_forward);
+    }
+    printf("receive events %lu, cpu time %.3f s%s\n", (unsigned long)metrics.events, metrics.cpu_seconds,
+           (metrics.event_limit_reached ? ", event limit reached - packet storm" : ""));
+
+    // a packet storm or a missed subnet is a failure
+    bool failed = metrics.event_limit_reached;
+    for (size_t i = 0; i < SimulatedNetwork::packet_type_count; ++i) {
+        failed |= (metrics.missed[i] > 0);
+    }
+    return (failed ? 2 : 0);
+}
@@ -1,4 +1,5 @@
 #include <SpeedwireDiscoveryProtocol.hpp>
+#include <CachedClock.hpp>
 #include <BounceDetector.hpp>
 using namespace libspeedwire;
 
@@ -6,14 +7,31 @@ using namespace libspeedwire;
  *  Speedwire packet bounce detector
  *  Multicast packets may bounce indefinetely back and forth between subnets, if they are
  *  routed. This class holds a limited history of previously received packets and checks
- *  if they were received shortly before.
+ *  if they were received shortly before. Discovery fingerprints expire through timers.
  */
 
 /**
  *  Constructor
  */
-BounceDetector::BounceDetector(void) : history() {
+BounceDetector::BounceDetector(size_t history_size, TimerWheel& wheel) : history(), expiry_timers(), timer_wheel(wheel) {
     replace_index = 0;
+    setHistorySize(history_size);
+}
+
+/**
+ *  Set the number of entries in the history table; changing the size clears the history
+ */
+void BounceDetector::setHistorySize(size_t history_size) {
+    if (history_size == 0 || history_size == history.size()) {
+        return;
+    }
+    expiry_timers.reset(new TimerWheel::Timer[history_size]);
+    history.assign(history_size, Fingerprint());
+    replace_index = 0;
+    for (size_t i = 0; i < history_size; ++i) {
+        Fingerprint* entry = &history[i];
+        expiry_timers[i].setCallback([entry](void) { entry->packet_type = PacketType::UNKNOWN; });
+    }
 }
 
 /**
@@ -22,6 +40,14 @@ BounceDetector::BounceDetector(void) : history() {
 template<class T> void BounceDetector::receive(const T& speedwire_packet, const struct sockaddr& src) {
     // insert the fingerprint of the given speedwire packet at the replace_index position in the history
     if (setFingerprint(history[replace_index], speedwire_packet, src) == true) {
+        // discovery fingerprints are only valid for 1000ms
+        PacketType type = history[replace_index].packet_type;
+        if (type == PacketType::DISCOVERY_REQUEST || type == PacketType::DISCOVERY_RESPONSE) {
+            timer_wheel.schedule(expiry_timers[replace_index], 1000);
+        }
+        else {
+            timer_wheel.cancel(expiry_timers[replace_index]);
+        }
         if (++replace_index >= history.size()) {
             replace_index = 0;
         }
@@ -48,13 +74,9 @@ template<class T> bool BounceDetector::isBouncedPacket(const T& speedwire_packet
                     }
                     break;
                 case PacketType::DISCOVERY_REQUEST:
-                    if (SpeedwireTime::calculateAbsTimeDifference(entry.create_time, (uint32_t)LocalHost::getUnixEpochTimeInMs()) <= 1000) {
-                        return true;
-                    }
-                    break;
+                    return true;
                 case PacketType::DISCOVERY_RESPONSE:
-                    if (entry.src_ip_addr.s_addr == packet.src_ip_addr.s_addr &&
-                        SpeedwireTime::calculateAbsTimeDifference(entry.create_time, (uint32_t)LocalHost::getUnixEpochTimeInMs()) <= 1000) {
+                    if (entry.src_ip_addr.s_addr == packet.src_ip_addr.s_addr) {
                         return true;
                     }
                     break;
@@ -78,7 +100,7 @@ template<class T> bool BounceDetector::isBouncedPacket(const T& speedwire_packet
  */
 bool BounceDetector::setFingerprint(Fingerprint& fingerprint, const SpeedwireEmeterProtocol& emeter_packet, const struct sockaddr& src) const {
     // the fingerprint for emeter packets is defined by susyid, serialnumber and packet time
-    fingerprint = Fingerprint(src, PacketType::EMETER, (uint32_t)LocalHost::getUnixEpochTimeInMs());
+    fingerprint = Fingerprint(src, PacketType::EMETER, (uint32_t)CachedClock::getTimeInMs());
     fingerprint.src_susyid  = emeter_packet.getSusyID();
     fingerprint.src_serial  = emeter_packet.getSerialNumber();
     fingerprint.src_timer   = emeter_packet.getTime();
@@ -91,7 +113,7 @@ bool BounceDetector::setFingerprint(Fingerprint& fingerprint, const SpeedwireEme
  */
 bool BounceDetector::setFingerprint(Fingerprint& fingerprint, const SpeedwireInverterProtocol& inverter_packet, const struct sockaddr& src) const {
     // the fingerprint for inverter packets is defined by susyid, serialnumber and packet id
-    fingerprint = Fingerprint(src, PacketType::INVERTER, (uint32_t)LocalHost::getUnixEpochTimeInMs());
+    fingerprint = Fingerprint(src, PacketType::INVERTER, (uint32_t)CachedClock::getTimeInMs());
     fingerprint.src_susyid    = inverter_packet.getSrcSusyID();
     fingerprint.src_serial    = inverter_packet.getSrcSerialNumber();
     fingerprint.src_packet_id = inverter_packet.getPacketID();
@@ -104,7 +126,7 @@ bool BounceDetector::setFingerprint(Fingerprint& fingerprint, const SpeedwireInv
  */
 bool BounceDetector::setFingerprint(Fingerprint& fingerprint, const SpeedwireEncryptionProtocol& inverter_packet, const struct sockaddr& src) const {
     // the fingerprint for encryption packets is defined by susyid, serialnumber and the first 4 payload bytes
-    fingerprint = Fingerprint(src, PacketType::ENCRYPTION, (uint32_t)LocalHost::getUnixEpochTimeInMs());
+    fingerprint = Fingerprint(src, PacketType::ENCRYPTION, (uint32_t)CachedClock::getTimeInMs());
     fingerprint.src_susyid = inverter_packet.getSrcSusyID();
     fingerprint.src_serial = inverter_packet.getSrcSerialNumber();
     fingerprint.src_bytes  = inverter_packet.getDataUint32(0);
@@ -117,7 +139,7 @@ bool BounceDetector::setFingerprint(Fingerprint& fingerprint, const SpeedwireEnc
  */
 bool BounceDetector::setFingerprint(Fingerprint& fingerprint, const SpeedwireHeader& speedwire_packet, const struct sockaddr& src) const {
     // the fingerprint for discovery packets is defined by src ip, src packet type and src ip address
-    fingerprint = Fingerprint(src, PacketType::UNKNOWN, (uint32_t)LocalHost::getUnixEpochTimeInMs());
+    fingerprint = Fingerprint(src, PacketType::UNKNOWN, (uint32_t)CachedClock::getTimeInMs());
 
     // check if it is a discovery packet (either request or response)
     if (speedwire_packet.isValidDiscoveryPacket()) {
@@ -0,0 +1,162 @@
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <Logger.hpp>
+#include <ConfigManager.hpp>
+using namespace libspeedwire;
+
+static Logger logger = Logger("ConfigManager");
+
+
+/**
+ *  Configuration manager
+ *  Holds the current configuration snapshot. On reload, a new snapshot is parsed from the configuration file
+ *  and published with a single atomic pointer swap. Reloads are triggered by SIGHUP or by a change of the
+ *  configuration file; on Linux, file changes are notified by inotify, on other platforms the modification
+ *  time of the file is checked periodically.
+ */
+
+/**
+ *  Constructor - start with the default configuration
+ */
+ConfigManager::ConfigManager(void) :
+    snapshot(std::make_shared<const RouterConfig>()),
+    path(),
+    reload_requested(false),
+    listeners(),
+    watch_fd(-1),
+    watch_timer(),
+    modification_time(-1) {
+    // make sure the timer wheel outlives the watch timer
+    TimerWheel::getInstance();
+    watch_timer.setCallback([this](void) {
+        int64_t time = getModificationTime(path);
+        if (time != modification_time) {
+            reload();
+        }
+        TimerWheel::getInstance().schedule(watch_timer, 2000);
+    });
+}
+
+/**
+ *  Destructor
+ */
+ConfigManager::~ConfigManager(void) {
+#if defined(__linux__)
+    if (watch_fd >= 0) close(watch_fd);
+#endif
+}
+
+/**
+ *  Get the singleton instance
+ */
+ConfigManager& ConfigManager::getInstance(void) {
+    static ConfigManager instance;
+    return instance;
+}
+
+/**
+ *  Load the given configuration file and publish it as the current snapshot
+ */
+bool ConfigManager::load(const std::string& config_path) {
+    path = config_path;
+    return reload();
+}
+
+/**
+ *  Parse the configuration file into a new snapshot and swap it in; if the file contains errors, the current
+ *  snapshot is kept
+ */
+bool ConfigManager::reload(void) {
+    modification_time = getModificationTime(path);
+    std::shared_ptr<RouterConfig> config = std::make_shared<RouterConfig>();
+    if (config->parse(path) == false) {
+        logger.print(LogLevel::LOG_WARNING, "keeping current configuration\n");
+        return false;
+    }
+    logger.print(LogLevel::LOG_INFO_0, "loaded configuration file %s\n", path.c_str());
+    publish(config);
+    return true;
+}
+
+/**
+ *  Swap in the given configuration snapshot and notify the reload listeners
+ */
+void ConfigManager::publish(const std::shared_ptr<const RouterConfig>& config) {
+    std::atomic_store(&snapshot, config);
+    for (auto& listener : listeners) {
+        listener(*config);
+    }
+}
+
+/**
+ *  Reload the configuration if requested by a signal handler
+ */
+bool ConfigManager::reloadIfRequested(void) {
+    if (reload_requested.exchange(false) == true) {
+        return reload();
+    }
+    return false;
+}
+
+/**
+ *  Watch the configuration file for changes and reload it from the given event loop
+ */
+void ConfigManager::watch(EventLoop& loop) {
+#if defined(__linux__)
+    // watch the directory, such that files replaced by editors and configuration management tools are seen
+    size_t separator = path.find_last_of('/');
+    std::string directory = (separator != std::string::npos ? path.substr(0, separator + 1) : std::string("."));
+    watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch_fd >= 0 && inotify_add_watch(watch_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0) {
+        loop.add(watch_fd, EventLoop::READABLE, *this);
+        return;
+    }
+    logger.print(LogLevel::LOG_WARNING, "cannot watch directory %s, checking configuration file periodically\n", directory.c_str());
+    if (watch_fd >= 0) {
+        close(watch_fd);
+        watch_fd = -1;
+    }
+#endif
+    TimerWheel::getInstance().schedule(watch_timer, 2000);
+}
+
+/**
+ *  Handle inotify events for the configuration file
+ */
+void ConfigManager::handleEvent(int fd, uint32_t events) {
+#if defined(__linux__)
+    size_t separator = path.find_last_of('/');
+    std::string filename = (separator != std::string::npos ? path.substr(separator + 1) : path);
+    bool changed = false;
+
+    alignas(struct inotify_event) char buffer[4096];
+    ssize_t nbytes;
+    while ((nbytes = read(fd, buffer, sizeof(buffer))) > 0) {
+        for (char* ptr = buffer; ptr < buffer + nbytes; ) {
+            const struct inotify_event* event = (const struct inotify_event*)ptr;
+            if (event->len > 0 && filename == event->name) {
+                changed = true;
+            }
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    if (changed == true) {
+        reload();
+    }
+#endif
+}
+
+/**
+ *  Get the modification time of the given file, or -1 if the file does not exist
+ */
+int64_t ConfigManager::getModificationTime(const std::string& path) {
+    struct stat status;
+    if (stat(path.c_str(), &status) != 0) {
+        return -1;
+    }
+    return (int64_t)status.st_mtime;
+}
@@ -0,0 +1,136 @@
+#include <cstring>
+#include <SpeedwireByteEncoding.hpp>
+#include <EmeterPacketTrimmer.hpp>
+using namespace libspeedwire;
+
+
+/**
+ *  Speedwire emeter packet trimmer class
+ *  Remote consumers often read just a few obis elements out of each emeter packet. This class copies
+ *  an emeter packet into a given buffer, keeping only the obis elements found in its allow-list.
+ */
+
+/**
+ *  Constructor
+ */
+EmeterPacketTrimmer::EmeterPacketTrimmer(void) : allow_list() {}
+
+/**
+ *  Add the given obis element to the allow-list
+ */
+void EmeterPacketTrimmer::addObisElement(const ObisData& obis) {
+    addObisElement(obis.channel, obis.index, obis.type, obis.tariff);
+}
+
+/**
+ *  Add the obis element given by its channel, index, type and tariff to the allow-list
+ */
+void EmeterPacketTrimmer::addObisElement(uint8_t channel, uint8_t index, uint8_t type, uint8_t tariff) {
+    uint32_t key = getObisKey(channel, index, type, tariff);
+    for (const auto& entry : allow_list) {
+        if (entry == key) {
+            return;
+        }
+    }
+    allow_list.push_back(key);
+}
+
+/**
+ *  Check if the given obis element is part of the allow-list; the software version element is always retained
+ */
+bool EmeterPacketTrimmer::isAllowed(const void* const obis) const {
+    const uint8_t channel = SpeedwireEmeterProtocol::getObisChannel(obis);
+    if (channel == 144) {
+        return true;
+    }
+    uint32_t key = getObisKey(channel, SpeedwireEmeterProtocol::getObisIndex(obis), SpeedwireEmeterProtocol::getObisType(obis), SpeedwireEmeterProtocol::getObisTariff(obis));
+    for (const auto& entry : allow_list) {
+        if (entry == key) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ *  Copy the given emeter packet into the given buffer, skipping all obis elements not found in the allow-list.
+ *  The data2 tag length of the copy is reduced by the number of skipped bytes.
+ *  Returns the size of the trimmed packet, or 0 if the packet is not an emeter packet or cannot be trimmed.
+ */
+unsigned long EmeterPacketTrimmer::trim(const SpeedwireHeader& speedwire_packet, uint8_t* const buffer, const unsigned long buffer_size) const {
+    if (allow_list.size() == 0 || speedwire_packet.isValidData2Packet() == false) {
+        return 0;
+    }
+
+    // check if it is an emeter packet
+    const SpeedwireData2Packet data2_packet(speedwire_packet);
+    uint16_t protocolID = data2_packet.getProtocolID();
+    if (SpeedwireData2Packet::isEmeterProtocolID(protocolID) == false && SpeedwireData2Packet::isExtendedEmeterProtocolID(protocolID) == false) {
+        return 0;
+    }
+    const SpeedwireEmeterProtocol emeter_packet(data2_packet);
+
+    const uint8_t* const packet_start = speedwire_packet.getPacketPointer();
+    const uint8_t* const packet_end   = packet_start + speedwire_packet.getPacketSize();
+    if (speedwire_packet.getPacketSize() > buffer_size) {
+        return 0;
+    }
+
+    // the data2 tag header precedes the protocol id; make sure the tag length is where it is expected
+    const unsigned long tag_length_offset = data2_packet.getPayloadOffset() - 6;
+    uint16_t tag_length = data2_packet.getTagLength();
+    if (SpeedwireByteEncoding::getUint16BigEndian(packet_start + tag_length_offset) != tag_length) {
+        return 0;
+    }
+
+    // copy the packet header up to the first obis element
+    const uint8_t* obis = (const uint8_t*)emeter_packet.getFirstObisElement();
+    if (obis == NULL) {
+        return 0;
+    }
+    unsigned long length = (unsigned long)(obis - packet_start);
+    memcpy(buffer, packet_start, length);
+
+    // copy allowed obis elements in a single pass across the obis element chain
+    const uint8_t* obis_end = obis;
+    while (obis != NULL) {
+        unsigned long obis_length = getObisElementLength(obis);
+        if (obis + obis_length > packet_end) {
+            return 0;
+        }
+        if (isAllowed(obis) == true) {
+            memcpy(buffer + length, obis, obis_length);
+            length += obis_length;
+        }
+        obis_end = obis + obis_length;
+        obis = (const uint8_t*)emeter_packet.getNextObisElement(obis);
+    }
+
+    // copy the trailing end-of-data marker and end tag
+    unsigned long trailer_length = (unsigned long)(packet_end - obis_end);
+    memcpy(buffer + length, obis_end, trailer_length);
+    length += trailer_length;
+
+    // fix up the data2 tag length
+    unsigned long removed = speedwire_packet.getPacketSize() - length;
+    SpeedwireByteEncoding::setUint16BigEndian(buffer + tag_length_offset, (uint16_t)(tag_length - removed));
+    return length;
+}
+
+/**
+ *  Encode the obis element given by its channel, index, type and tariff into a single key
+ */
+uint32_t EmeterPacketTrimmer::getObisKey(uint8_t channel, uint8_t index, uint8_t type, uint8_t tariff) {
+    return ((uint32_t)channel << 24) | ((uint32_t)index << 16) | ((uint32_t)type << 8) | (uint32_t)tariff;
+}
+
+/**
+ *  Get the length of the given obis element in bytes, including its 4 byte header
+ */
+unsigned long EmeterPacketTrimmer::getObisElementLength(const void* const obis) {
+    // the software version element carries a 4 byte value, although its type is 0
+    if (SpeedwireEmeterProtocol::getObisChannel(obis) == 144) {
+        return 8;
+    }
+    return 4 + SpeedwireEmeterProtocol::getObisType(obis);
+}
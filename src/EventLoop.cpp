@@ -0,0 +1,240 @@
+#if defined(__linux__)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#elif defined(_WIN32)
+#include <Winsock2.h>
+#else
+#include <errno.h>
+#include <poll.h>
+#endif
+#include <Logger.hpp>
+#include <CachedClock.hpp>
+#include <EventLoop.hpp>
+using namespace libspeedwire;
+
+static Logger logger = Logger("EventLoop");
+
+
+/**
+ *  Event loop
+ *  A reactor multiplexing file descriptor readiness and timer expiry. On Linux, it is based on epoll with a
+ *  timerfd armed for the next expiry of the timer wheel; on other platforms it falls back to poll.
+ */
+
+/**
+ *  Constructor
+ */
+EventLoop::EventLoop(TimerWheel& wheel) :
+    timer_wheel(wheel),
+    epoll_fd(-1),
+    timer_fd(-1),
+    armed_expiry(0) {
+#if defined(__linux__)
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd < 0 || timer_fd < 0) {
+        logger.print(LogLevel::LOG_ERROR, "cannot create epoll or timerfd file descriptor\n");
+        return;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = timer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+#endif
+}
+
+/**
+ *  Destructor
+ */
+EventLoop::~EventLoop(void) {
+#if defined(__linux__)
+    if (timer_fd >= 0) close(timer_fd);
+    if (epoll_fd >= 0) close(epoll_fd);
+#endif
+}
+
+/**
+ *  Register the given handler for the given events on the given file descriptor
+ */
+bool EventLoop::add(int fd, uint32_t events, IEventHandler& handler) {
+    if (findHandler(fd) != NULL) {
+        return modify(fd, events);
+    }
+#if defined(__linux__)
+    struct epoll_event event;
+    event.events = ((events & READABLE) != 0 ? EPOLLIN : 0) | ((events & WRITABLE) != 0 ? EPOLLOUT : 0);
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        logger.print(LogLevel::LOG_ERROR, "cannot add file descriptor %d to epoll set\n", fd);
+        return false;
+    }
+#endif
+    handlers.push_back(std::make_pair(fd, &handler));
+    interests.push_back(std::make_pair(fd, events));
+    return true;
+}
+
+/**
+ *  Change the events of interest for the given file descriptor
+ */
+bool EventLoop::modify(int fd, uint32_t events) {
+    for (auto& interest : interests) {
+        if (interest.first == fd) {
+            if (interest.second == events) {
+                return true;
+            }
+            interest.second = events;
+#if defined(__linux__)
+            struct epoll_event event;
+            event.events = ((events & READABLE) != 0 ? EPOLLIN : 0) | ((events & WRITABLE) != 0 ? EPOLLOUT : 0);
+            event.data.fd = fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0) {
+                logger.print(LogLevel::LOG_ERROR, "cannot modify file descriptor %d in epoll set\n", fd);
+                return false;
+            }
+#endif
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ *  Unregister the given file descriptor
+ */
+void EventLoop::remove(int fd) {
+    for (auto it = handlers.begin(); it != handlers.end(); ++it) {
+        if (it->first == fd) {
+            handlers.erase(it);
+            break;
+        }
+    }
+    for (auto it = interests.begin(); it != interests.end(); ++it) {
+        if (it->first == fd) {
+            interests.erase(it);
+#if defined(__linux__)
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+            break;
+        }
+    }
+}
+
+/**
+ *  Wait for file descriptor events or timer expiry for up to the given timeout, then take a single timestamp
+ *  into the cached clock, expire timers and dispatch the file descriptor events.
+ *  Returns the number of file descriptor events, or -1 on failure.
+ */
+int EventLoop::runOnce(int max_timeout_in_ms) {
+    int64_t timer_timeout = timer_wheel.getTimeUntilNextExpiry(CachedClock::getTimeInMs());
+    std::vector<std::pair<int, uint32_t> > ready;
+
+#if defined(__linux__)
+    armTimer(timer_timeout);
+    struct epoll_event events[32];
+    int nevents = epoll_wait(epoll_fd, events, 32, max_timeout_in_ms);
+    int error = errno;
+    CachedClock::update();
+    if (nevents < 0) {
+        if (error == EINTR) {
+            return 0;
+        }
+        logger.print(LogLevel::LOG_ERROR, "epoll failure\n");
+        return -1;
+    }
+    for (int i = 0; i < nevents; ++i) {
+        if (events[i].data.fd == timer_fd) {
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) < 0) {}
+            armed_expiry = 0;
+            continue;
+        }
+        uint32_t flags = ((events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0 ? READABLE : 0) | ((events[i].events & EPOLLOUT) != 0 ? WRITABLE : 0);
+        ready.push_back(std::make_pair((int)events[i].data.fd, flags));
+    }
+#else
+    int timeout = max_timeout_in_ms;
+    if (timer_timeout >= 0 && (timeout < 0 || timer_timeout < timeout)) {
+        timeout = (int)timer_timeout;
+    }
+#if defined(_WIN32)
+    std::vector<WSAPOLLFD> fds(interests.size());
+#else
+    std::vector<struct pollfd> fds(interests.size());
+#endif
+    for (size_t i = 0; i < interests.size(); ++i) {
+        fds[i].fd = interests[i].first;
+        fds[i].events = ((interests[i].second & READABLE) != 0 ? POLLIN : 0) | ((interests[i].second & WRITABLE) != 0 ? POLLOUT : 0);
+        fds[i].revents = 0;
+    }
+#if defined(_WIN32)
+    int nevents = (fds.size() > 0 ? WSAPoll(fds.data(), (ULONG)fds.size(), timeout) : (Sleep(timeout), 0));
+#else
+    int nevents = poll(fds.data(), fds.size(), timeout);
+#endif
+    CachedClock::update();
+    if (nevents < 0) {
+#if !defined(_WIN32)
+        if (errno == EINTR) {
+            return 0;
+        }
+#endif
+        logger.print(LogLevel::LOG_ERROR, "poll failure\n");
+        return -1;
+    }
+    for (size_t i = 0; i < fds.size(); ++i) {
+        if (fds[i].revents != 0) {
+            uint32_t flags = ((fds[i].revents & (POLLIN | POLLERR | POLLHUP)) != 0 ? READABLE : 0) | ((fds[i].revents & POLLOUT) != 0 ? WRITABLE : 0);
+            ready.push_back(std::make_pair((int)fds[i].fd, flags));
+        }
+    }
+#endif
+
+    // expire timers first, such that stale state is gone before new packets are processed
+    timer_wheel.advance(CachedClock::getTimeInMs());
+
+    // dispatch file descriptor events; handlers may add or remove file descriptors
+    for (const auto& entry : ready) {
+        IEventHandler* handler = findHandler(entry.first);
+        if (handler != NULL) {
+            handler->handleEvent(entry.first, entry.second);
+        }
+    }
+    return (int)ready.size();
+}
+
+/**
+ *  Find the handler registered for the given file descriptor
+ */
+EventLoop::IEventHandler* EventLoop::findHandler(int fd) const {
+    for (const auto& handler : handlers) {
+        if (handler.first == fd) {
+            return handler.second;
+        }
+    }
+    return NULL;
+}
+
+/**
+ *  Arm the timerfd to expire after the given timeout; it is disarmed for a timeout of -1. The timerfd is
+ *  armed with an absolute monotonic expiry time and only re-armed if the expiry time changes.
+ */
+void EventLoop::armTimer(int64_t timeout_in_ms) {
+#if defined(__linux__)
+    uint64_t expiry = (timeout_in_ms >= 0 ? CachedClock::getTimeInMs() + (uint64_t)timeout_in_ms : 0);
+    if (expiry == armed_expiry) {
+        return;
+    }
+    struct itimerspec spec;
+    spec.it_interval.tv_sec  = 0;
+    spec.it_interval.tv_nsec = 0;
+    spec.it_value.tv_sec     = (time_t)(expiry / 1000);
+    spec.it_value.tv_nsec    = (long)(expiry % 1000) * 1000000L;
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0) {
+        logger.print(LogLevel::LOG_ERROR, "cannot arm timerfd\n");
+    }
+    armed_expiry = expiry;
+#endif
+}
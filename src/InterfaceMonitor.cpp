@@ -0,0 +1,254 @@
+#ifdef __linux__
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <arpa/inet.h>
+#endif
+#include <cstring>
+#include <AddressConversion.hpp>
+#include <Logger.hpp>
+#include <InterfaceMonitor.hpp>
+using namespace libspeedwire;
+
+static Logger logger = Logger("InterfaceMonitor");
+
+
+/**
+ *  Local interface monitor
+ *  Listens for netlink address notifications (RTM_NEWADDR / RTM_DELADDR) and incrementally attaches or
+ *  detaches the receive sockets and packet senders of the affected interface.
+ */
+
+/**
+ *  Constructor
+ */
+InterfaceMonitor::InterfaceMonitor(LocalHost& host, EventLoop& loop, PacketDispatcher& packet_dispatcher, std::vector<SpeedwirePacketSender*>& packet_senders) :
+    localhost(host),
+    event_loop(loop),
+    dispatcher(packet_dispatcher),
+    senders(packet_senders),
+    netlink_fd(-1) {
+}
+
+/**
+ *  Destructor
+ */
+InterfaceMonitor::~InterfaceMonitor(void) {
+    close();
+}
+
+/**
+ *  Open a netlink socket subscribed to ipv4 address notifications and register it with the event loop
+ */
+bool InterfaceMonitor::open(void) {
+#ifdef __linux__
+    netlink_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (netlink_fd < 0) {
+        logger.print(LogLevel::LOG_ERROR, "cannot open netlink socket\n");
+        return false;
+    }
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = RTMGRP_IPV4_IFADDR;
+    if (bind(netlink_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        logger.print(LogLevel::LOG_ERROR, "cannot bind netlink socket\n");
+        ::close(netlink_fd);
+        netlink_fd = -1;
+        return false;
+    }
+    event_loop.add(netlink_fd, EventLoop::READABLE, *this);
+    return true;
+#else
+    logger.print(LogLevel::LOG_WARNING, "interface monitoring is not supported on this platform\n");
+    return false;
+#endif
+}
+
+/**
+ *  Close the netlink socket
+ */
+void InterfaceMonitor::close(void) {
+#ifdef __linux__
+    if (netlink_fd >= 0) {
+        event_loop.remove(netlink_fd);
+        ::close(netlink_fd);
+        netlink_fd = -1;
+    }
+#endif
+}
+
+/**
+ *  Event loop callback - read and handle all pending netlink address notifications
+ */
+void InterfaceMonitor::handleEvent(int fd, uint32_t events) {
+#ifdef __linux__
+    uint8_t buffer[8192];
+    int len = (int)recv(netlink_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (len <= 0) {
+        return;
+    }
+    for (struct nlmsghdr* nh = (struct nlmsghdr*)buffer; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+        if (nh->nlmsg_type == NLMSG_DONE) {
+            break;
+        }
+        if (nh->nlmsg_type != RTM_NEWADDR && nh->nlmsg_type != RTM_DELADDR) {
+            continue;
+        }
+        const struct ifaddrmsg* ifa = (const struct ifaddrmsg*)NLMSG_DATA(nh);
+        if (ifa->ifa_family != AF_INET) {
+            continue;
+        }
+
+        // find the local address; IFA_LOCAL takes precedence over IFA_ADDRESS on point-to-point interfaces
+        struct in_addr addr;
+        bool has_local = false, has_address = false;
+        int rta_len = (int)IFA_PAYLOAD(nh);
+        for (struct rtattr* rta = IFA_RTA(ifa); RTA_OK(rta, rta_len); rta = RTA_NEXT(rta, rta_len)) {
+            if (rta->rta_type == IFA_LOCAL) {
+                memcpy(&addr, RTA_DATA(rta), sizeof(addr));
+                has_local = true;
+            }
+            else if (rta->rta_type == IFA_ADDRESS && has_local == false) {
+                memcpy(&addr, RTA_DATA(rta), sizeof(addr));
+                has_address = true;
+            }
+        }
+        if ((has_local == false && has_address == false) || (ntohl(addr.s_addr) >> 24) == 127) {
+            continue;
+        }
+        std::string ip = AddressConversion::toString(addr);
+        if (nh->nlmsg_type == RTM_NEWADDR) {
+            addInterface(ip, ifa->ifa_prefixlen);
+        }
+        else {
+            removeInterface(ip, ifa->ifa_prefixlen);
+        }
+    }
+#endif
+}
+
+/**
+ *  Attach receive sockets and a multicast packet sender for the given local interface; for a known interface,
+ *  a changed prefix length is applied to the interface table and to all senders on the interface
+ */
+void InterfaceMonitor::addInterface(const std::string& ip, uint32_t prefix_length) {
+    InterfaceTable& table = InterfaceTable::getInstance();
+    if (table.isKnown(ip) == true) {
+        if (table.add(ip, prefix_length) == true) {
+            logger.print(LogLevel::LOG_INFO_0, "interface %s changed to prefix length %u\n", ip.c_str(), prefix_length);
+            for (auto& sender : senders) {
+                if (sender->getLocalInterfaceIP() == ip) {
+                    sender->setInterfacePrefixLength(prefix_length);
+                }
+            }
+        }
+        return;
+    }
+    logger.print(LogLevel::LOG_INFO_0, "interface %s/%u added\n", ip.c_str(), prefix_length);
+    table.add(ip, prefix_length);
+    SpeedwireSocketFactory* socket_factory = SpeedwireSocketFactory::getInstance(localhost);
+
+    // attach receive sockets; a socket shared by several interfaces is registered only once. The socket factory
+    // caches its sockets, so an interface coming back gets the sockets detached on its removal; they join the
+    // multicast group again
+    std::vector<SpeedwireSocket> sockets = socket_factory->getRecvSockets(SpeedwireSocketFactory::SocketType::ANYCAST, std::vector<std::string>(1, ip));
+    for (const auto& socket : sockets) {
+        joinGroup(socket, ip);
+    }
+    dispatcher.addSockets(sockets);
+
+    // configure a speedwire packet sender for multicast to the new interface
+    SpeedwireSocket& send_socket = socket_factory->getSendSocket(SpeedwireSocketFactory::SocketType::MULTICAST, ip);
+    MulticastPacketSender* sender = new MulticastPacketSender(localhost, ip, AddressConversion::toString(send_socket.getSpeedwireMulticastIn4Address()));
+    sender->setInterfacePrefixLength(prefix_length);
+    senders.push_back(sender);
+
+    for (auto& listener : listeners) {
+        listener(ip, true);
+    }
+}
+
+/**
+ *  Detach the receive sockets and remove all packet senders bound to the given local interface, including reply
+ *  senders; change listeners may then set up unicast senders for peers reachable through another interface. An address
+ *  is only removed with its current prefix length, as a prefix change adds the new address before deleting the old one.
+ */
+void InterfaceMonitor::removeInterface(const std::string& ip, uint32_t prefix_length) {
+    InterfaceTable& table = InterfaceTable::getInstance();
+    if (table.isKnown(ip) == false || table.getPrefixLength(ip) != prefix_length) {
+        return;
+    }
+    logger.print(LogLevel::LOG_INFO_0, "interface %s removed\n", ip.c_str());
+    table.remove(ip);
+
+    std::vector<SpeedwireSocket> sockets;
+    for (const auto& socket : dispatcher.getSockets()) {
+        if (socket.getLocalInterfaceAddress() == ip) {
+            sockets.push_back(socket);
+        }
+    }
+    for (auto& socket : sockets) {
+        detachSocket(socket, ip);
+    }
+    for (auto it = senders.begin(); it != senders.end(); ) {
+        if ((*it)->getLocalInterfaceIP() == ip) {
+            if (dynamic_cast<UnicastPacketSender*>(*it) != NULL) {
+                logger.print(LogLevel::LOG_INFO_0, "removed peer %s\n", (*it)->getPeerIP().c_str());
+            }
+            delete *it;
+            it = senders.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    ReplyPacketSender::removeSenders(ip);
+
+    for (auto& listener : listeners) {
+        listener(ip, false);
+    }
+}
+
+/**
+ *  Join the speedwire multicast group on the given local interface with the given receive socket; a socket
+ *  that already is a member is left alone
+ */
+void InterfaceMonitor::joinGroup(const SpeedwireSocket& socket, const std::string& ip) {
+#ifdef __linux__
+    struct ip_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_multiaddr  = socket.getSpeedwireMulticastIn4Address();
+    mreq.imr_interface  = AddressConversion::toInAddress(ip);
+    if (setsockopt(socket.getSocketFd(), IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 && errno != EADDRINUSE) {
+        logger.print(LogLevel::LOG_WARNING, "cannot join multicast group on interface %s (%s)\n", ip.c_str(), strerror(errno));
+    }
+#endif
+}
+
+/**
+ *  Leave the speedwire multicast group of the given receive socket on the removed interface and detach the
+ *  socket from the dispatcher if it is bound to the interface address. The socket is not closed, as it is
+ *  owned and cached by the socket factory. A socket bound to the wildcard address keeps receiving for the
+ *  other interfaces and stays registered.
+ */
+void InterfaceMonitor::detachSocket(const SpeedwireSocket& socket, const std::string& ip) {
+#ifdef __linux__
+    // the kernel may already have dropped the membership together with the address
+    struct ip_mreq mreq;
+    memset(&mreq, 0, sizeof(mreq));
+    mreq.imr_multiaddr  = socket.getSpeedwireMulticastIn4Address();
+    mreq.imr_interface  = AddressConversion::toInAddress(ip);
+    setsockopt(socket.getSocketFd(), IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq));
+
+    struct sockaddr_in bound;
+    socklen_t bound_len = sizeof(bound);
+    memset(&bound, 0, sizeof(bound));
+    if (getsockname(socket.getSocketFd(), (struct sockaddr*)&bound, &bound_len) == 0 && bound.sin_addr.s_addr == INADDR_ANY) {
+        return;
+    }
+    dispatcher.removeSocket(socket);
+#endif
+}
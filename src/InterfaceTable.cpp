@@ -0,0 +1,105 @@
+#include <AddressConversion.hpp>
+#include <InterfaceTable.hpp>
+using namespace libspeedwire;
+
+
+/**
+ *  Local ipv4 interface table
+ *  Starts with the local interfaces cached by LocalHost and is kept up to date by the interface monitor.
+ */
+
+/**
+ *  Constructor - the table starts with the ipv4 interfaces of the given local host
+ */
+InterfaceTable::InterfaceTable(const LocalHost& localhost) {
+    for (const auto& ip : localhost.getLocalIPv4Addresses()) {
+        interfaces.push_back(Interface(ip, localhost.getInterfacePrefixLength(ip)));
+    }
+    updateAddresses();
+}
+
+/**
+ *  Get the singleton instance
+ */
+InterfaceTable& InterfaceTable::getInstance(void) {
+    static InterfaceTable instance(LocalHost::getInstance());
+    return instance;
+}
+
+/**
+ *  Add the given interface or update its prefix length; returns false if it is known with the same prefix length
+ */
+bool InterfaceTable::add(const std::string& ip, uint32_t prefix_length) {
+    for (auto& entry : interfaces) {
+        if (entry.ip == ip) {
+            if (entry.prefix_length == prefix_length) {
+                return false;
+            }
+            entry.prefix_length = prefix_length;
+            return true;
+        }
+    }
+    interfaces.push_back(Interface(ip, prefix_length));
+    updateAddresses();
+    return true;
+}
+
+/**
+ *  Remove the given interface; returns false if it is not known
+ */
+bool InterfaceTable::remove(const std::string& ip) {
+    for (auto it = interfaces.begin(); it != interfaces.end(); ++it) {
+        if (it->ip == ip) {
+            interfaces.erase(it);
+            updateAddresses();
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ *  Check if the given interface is known
+ */
+bool InterfaceTable::isKnown(const std::string& ip) const {
+    for (const auto& entry : interfaces) {
+        if (entry.ip == ip) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ *  Get the prefix length of the given interface, or 0 if it is not known
+ */
+uint32_t InterfaceTable::getPrefixLength(const std::string& ip) const {
+    for (const auto& entry : interfaces) {
+        if (entry.ip == ip) {
+            return entry.prefix_length;
+        }
+    }
+    return 0;
+}
+
+/**
+ *  Find the local interface on the same subnet as the given address; returns an empty string if there is none
+ */
+std::string InterfaceTable::findInterface(const struct in_addr& addr) const {
+    for (const auto& entry : interfaces) {
+        if (AddressConversion::resideOnSameSubnet(addr, AddressConversion::toInAddress(entry.ip), entry.prefix_length) == true) {
+            return entry.ip;
+        }
+    }
+    return std::string();
+}
+
+/**
+ *  Update the list of interface addresses
+ */
+void InterfaceTable::updateAddresses(void) {
+    ipv4_addresses.clear();
+    for (const auto& entry : interfaces) {
+        ipv4_addresses.push_back(entry.ip);
+    }
+}
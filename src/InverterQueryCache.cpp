@@ -0,0 +1,206 @@
+#include <SpeedwireTime.hpp>
+#include <InverterQueryCache.hpp>
+using namespace libspeedwire;
+
+
+/**
+ *  Speedwire inverter query cache
+ *  Several clients often poll the same inverters with identical queries. This class caches inverter
+ *  responses keyed by destination device, command and register range, such that repeated queries can
+ *  be answered locally. Identical queries that are still awaiting their response are coalesced. Cached
+ *  responses and in-flight queries expire through timers.
+ */
+
+/**
+ *  Constructor
+ */
+InverterQueryCache::InverterQueryCache(TimerWheel& wheel, uint32_t ttl, uint32_t inflight_timeout, size_t max_size) :
+    timer_wheel(wheel),
+    entries(max_size > 0 ? max_size : 1),
+    ttl_in_ms(ttl),
+    inflight_timeout_in_ms(inflight_timeout) {
+    for (auto& entry : entries) {
+        Entry* e = &entry;
+        e->ttl_timer.setCallback([e](void) {
+            e->response.clear();
+            e->in_use = e->in_flight;
+        });
+        e->inflight_timer.setCallback([e](void) {
+            e->in_flight = false;
+            e->waiters.clear();
+            e->in_use = (e->response.size() > 0);
+        });
+    }
+}
+
+/**
+ *  Check if the given inverter packet is a query that can be answered from the cache; broadcast queries
+ *  and login / logoff commands are never cached
+ */
+bool InverterQueryCache::isCacheableRequest(const SpeedwireInverterProtocol& packet) {
+    uint32_t command_id = packet.getCommandID();
+    if ((command_id & 0xff) != 0x00 || (command_id & 0xffff0000) == 0xfffd0000) {
+        return false;
+    }
+    if (packet.getDstSusyID() == 0xffff || packet.getDstSerialNumber() == 0xffffffff) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ *  Handle an inverter query.
+ *  If a fresh response is cached, it is copied to the given response vector, rewritten for the requester
+ *  and CACHED is returned. If an identical query is in flight, the requester is added to its waiters and
+ *  COALESCED is returned. Otherwise the query is recorded as in flight and FORWARD is returned.
+ */
+InverterQueryCache::Result InverterQueryCache::request(const SpeedwireInverterProtocol& packet, const struct sockaddr& src, uint32_t now, std::vector<uint8_t>& response) {
+    if (isCacheableRequest(packet) == false) {
+        return Result::FORWARD;
+    }
+    Requester requester;
+    requester.src        = src;
+    requester.src_susyid = packet.getSrcSusyID();
+    requester.src_serial = packet.getSrcSerialNumber();
+    requester.packet_id  = packet.getPacketID();
+
+    Key key = getKey(packet);
+    Entry* entry = find(key);
+    if (entry != NULL) {
+        // answer from the cache; expired responses have already been removed by the ttl timer
+        if (entry->response.size() > 0) {
+            response = entry->response;
+            rewrite(response, requester);
+            return Result::CACHED;
+        }
+        // coalesce with an identical query that is still in flight
+        if (entry->in_flight == true) {
+            entry->waiters.push_back(requester);
+            return Result::COALESCED;
+        }
+    }
+    else {
+        entry = &insert(key, now);
+    }
+    entry->request_time = now;
+    entry->in_flight = true;
+    entry->packet_id = packet.getPacketID() & 0x7fff;
+    entry->waiters.clear();
+    timer_wheel.schedule(entry->inflight_timer, inflight_timeout_in_ms);
+    return Result::FORWARD;
+}
+
+/**
+ *  Handle an inverter response.
+ *  If the response answers an in-flight query, it is cached and all coalesced requesters are moved to the
+ *  given waiters vector. Returns true if the response has been cached. The register id fields of a response
+ *  hold record indices rather than the queried register range, hence responses are matched to the forwarded
+ *  query by device, command and packet id instead of the cache key.
+ */
+bool InverterQueryCache::response(const SpeedwireInverterProtocol& packet, const SpeedwireHeader& speedwire_packet, uint32_t now, std::vector<Requester>& waiters) {
+    waiters.clear();
+    if ((packet.getCommandID() & 0xff) == 0x00) {
+        return false;
+    }
+    Entry* entry = findInFlight(packet);
+    if (entry == NULL || entry->in_flight == false) {
+        return false;
+    }
+    const uint8_t* const buffer = speedwire_packet.getPacketPointer();
+    entry->response.assign(buffer, buffer + speedwire_packet.getPacketSize());
+    entry->response_time = now;
+    entry->in_flight = false;
+    waiters.swap(entry->waiters);
+    timer_wheel.cancel(entry->inflight_timer);
+    timer_wheel.schedule(entry->ttl_timer, ttl_in_ms);
+    return true;
+}
+
+/**
+ *  Rewrite the destination and packet id fields of the given cached response for the given requester; the
+ *  response bit of the packet id is kept
+ */
+void InverterQueryCache::rewrite(std::vector<uint8_t>& response, const Requester& requester) {
+    SpeedwireHeader speedwire_packet(response.data(), (unsigned long)response.size());
+    SpeedwireData2Packet data2_packet(speedwire_packet);
+    SpeedwireInverterProtocol inverter_packet(data2_packet);
+    inverter_packet.setDstSusyID(requester.src_susyid);
+    inverter_packet.setDstSerialNumber(requester.src_serial);
+    inverter_packet.setPacketID((inverter_packet.getPacketID() & 0x8000) | (requester.packet_id & 0x7fff));
+}
+
+/**
+ *  Derive the cache key from the given query
+ */
+InverterQueryCache::Key InverterQueryCache::getKey(const SpeedwireInverterProtocol& packet) {
+    Key key;
+    key.dst_susyid     = packet.getDstSusyID();
+    key.dst_serial     = packet.getDstSerialNumber();
+    key.command_id     = packet.getCommandID() & 0xffffff00;
+    key.first_register = packet.getFirstRegisterID();
+    key.last_register  = packet.getLastRegisterID();
+    return key;
+}
+
+/**
+ *  Find the cache entry for the given key
+ */
+InverterQueryCache::Entry* InverterQueryCache::find(const Key& key) {
+    for (auto& entry : entries) {
+        if (entry.in_use == true && entry.key == key) {
+            return &entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ *  Find the in-flight query answered by the given response; the responding device is the queried device, as
+ *  broadcast queries are never cached
+ */
+InverterQueryCache::Entry* InverterQueryCache::findInFlight(const SpeedwireInverterProtocol& response) {
+    const uint16_t susyid     = response.getSrcSusyID();
+    const uint32_t serial     = response.getSrcSerialNumber();
+    const uint32_t command_id = response.getCommandID() & 0xffffff00;
+    const uint16_t packet_id  = response.getPacketID() & 0x7fff;
+    for (auto& entry : entries) {
+        if (entry.in_use == false || entry.in_flight == false || entry.key.command_id != command_id || entry.packet_id != packet_id) {
+            continue;
+        }
+        if (entry.key.dst_susyid == susyid && entry.key.dst_serial == serial) {
+            return &entry;
+        }
+    }
+    return NULL;
+}
+
+/**
+ *  Insert a new cache entry for the given key; if the cache is full, the least recently used entry is replaced
+ */
+InverterQueryCache::Entry& InverterQueryCache::insert(const Key& key, uint32_t now) {
+    Entry* oldest = NULL;
+    uint32_t oldest_age = 0;
+    for (auto& entry : entries) {
+        if (entry.in_use == false) {
+            oldest = &entry;
+            break;
+        }
+        uint32_t last_use = (entry.response.size() > 0 && entry.in_flight == false ? entry.response_time : entry.request_time);
+        uint32_t age = SpeedwireTime::calculateAbsTimeDifference(last_use, now);
+        if (oldest == NULL || age >= oldest_age) {
+            oldest_age = age;
+            oldest = &entry;
+        }
+    }
+    timer_wheel.cancel(oldest->ttl_timer);
+    timer_wheel.cancel(oldest->inflight_timer);
+    oldest->in_use = true;
+    oldest->key = key;
+    oldest->request_time = now;
+    oldest->response_time = now;
+    oldest->in_flight = false;
+    oldest->packet_id = 0;
+    oldest->response.clear();
+    oldest->waiters.clear();
+    return *oldest;
+}
@@ -0,0 +1,387 @@
+#ifdef SPEEDWIRE_IO_URING
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <algorithm>
+#include <cstring>
+#include <Logger.hpp>
+#include <IoUringBackend.hpp>
+using namespace libspeedwire;
+
+static Logger logger = Logger("IoUringBackend");
+
+
+/**
+ *  io_uring I/O backend
+ *  Each receive socket has a single multishot recvmsg operation receiving into a ring of kernel provided buffers.
+ *  The fan-out of a received packet is submitted as sendmsg operations referencing the same provided buffer.
+ *  Fan-out sends are deliberately not linked, such that a failing peer does not cancel the sends to others.
+ */
+
+/**
+ *  Constructor
+ */
+IoUringBackend::IoUringBackend(PacketDispatcher& packet_dispatcher, EventLoop& loop) :
+    dispatcher(packet_dispatcher),
+    event_loop(loop),
+    buf_ring(NULL),
+    buffers(),
+    buffer_refs(),
+    free_buffers(0),
+    starved_fds(),
+    send_ops(num_send_ops),
+    free_send_ops(),
+    sockets(),
+    event_fd(-1),
+    is_open(false),
+    is_multishot_supported(true),
+    in_batch(false),
+    current_buffer_id(-1),
+    pending_submissions(0) {
+    memset(&ring, 0, sizeof(ring));
+    for (unsigned i = 0; i < num_send_ops; ++i) {
+        free_send_ops.push_back((uint16_t)(num_send_ops - 1 - i));
+    }
+    // provided buffers start with the source address, followed by control messages and the packet; the control
+    // messages hold the receive timestamp and the packet info of ipv4 or ipv6 packets
+    memset(&recv_msg, 0, sizeof(recv_msg));
+    recv_msg.msg_namelen    = sizeof(struct sockaddr_storage);
+    recv_msg.msg_controllen = 96;
+}
+
+/**
+ *  Destructor
+ */
+IoUringBackend::~IoUringBackend(void) {
+    if (is_open == true) {
+        event_loop.remove(event_fd);
+        close(event_fd);
+        io_uring_free_buf_ring(&ring, buf_ring, num_buffers, buffer_group);
+        io_uring_queue_exit(&ring);
+    }
+}
+
+/**
+ *  Set up the io_uring instance and its provided buffer ring; returns false if io_uring is not supported by the
+ *  kernel, in which case the event loop backend is used
+ */
+bool IoUringBackend::open(void) {
+    int result = io_uring_queue_init(ring_entries, &ring, 0);
+    if (result < 0) {
+        logger.print(LogLevel::LOG_WARNING, "io_uring not available (%s), using event loop backend\n", strerror(-result));
+        return false;
+    }
+    buf_ring = io_uring_setup_buf_ring(&ring, num_buffers, buffer_group, 0, &result);
+    if (buf_ring == NULL) {
+        logger.print(LogLevel::LOG_WARNING, "io_uring provided buffers not available (%s), using event loop backend\n", strerror(-result));
+        io_uring_queue_exit(&ring);
+        return false;
+    }
+    buffers.resize(num_buffers * buffer_size);
+    buffer_refs.assign(num_buffers, 0);
+    for (unsigned i = 0; i < num_buffers; ++i) {
+        io_uring_buf_ring_add(buf_ring, &buffers[i * buffer_size], buffer_size, (unsigned short)i, io_uring_buf_ring_mask(num_buffers), (int)i);
+    }
+    io_uring_buf_ring_advance(buf_ring, (int)num_buffers);
+    free_buffers = num_buffers;
+
+    // completions are signalled through an eventfd polled by the event loop
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0 || io_uring_register_eventfd(&ring, event_fd) < 0) {
+        logger.print(LogLevel::LOG_WARNING, "cannot register io_uring eventfd, using event loop backend\n");
+        if (event_fd >= 0) close(event_fd);
+        io_uring_free_buf_ring(&ring, buf_ring, num_buffers, buffer_group);
+        io_uring_queue_exit(&ring);
+        return false;
+    }
+    event_loop.add(event_fd, EventLoop::READABLE, *this);
+    is_open = true;
+    logger.print(LogLevel::LOG_INFO_0, "using io_uring backend\n");
+    return true;
+}
+
+/**
+ *  Receive packets from the given socket through a multishot recvmsg operation
+ */
+bool IoUringBackend::addSocket(const SpeedwireSocket& socket) {
+    if (is_open == false || is_multishot_supported == false) {
+        return false;
+    }
+    sockets.push_back(socket);
+    return armReceive((int)socket.getSocketFd());
+}
+
+/**
+ *  Stop receiving packets from the given socket
+ */
+void IoUringBackend::removeSocket(const SpeedwireSocket& socket) {
+    for (auto it = sockets.begin(); it != sockets.end(); ++it) {
+        if (it->getSocketFd() == socket.getSocketFd()) {
+            sockets.erase(it);
+            starved_fds.erase(std::remove(starved_fds.begin(), starved_fds.end(), (int)socket.getSocketFd()), starved_fds.end());
+            struct io_uring_sqe* sqe = getSqe();
+            if (sqe != NULL) {
+                io_uring_prep_cancel_fd(sqe, (int)socket.getSocketFd(), 0);
+                io_uring_sqe_set_data64(sqe, toUserData(OpType::CANCEL, (uint32_t)socket.getSocketFd()));
+                submit();
+            }
+            return;
+        }
+    }
+}
+
+/**
+ *  Submit a sendmsg operation for the given packet; a packet residing in the provided buffer currently dispatched
+ *  is referenced, any other packet is copied. Returns false if the operation cannot be submitted, in which case
+ *  the caller sends the packet itself.
+ */
+bool IoUringBackend::send(int fd, const uint8_t* const packet, const unsigned long size, const struct sockaddr* const dest, PeerSendQueue& queue) {
+    if (is_open == false || free_send_ops.size() == 0) {
+        return false;
+    }
+    const uint8_t* buffer = (current_buffer_id >= 0 ? &buffers[current_buffer_id * buffer_size] : NULL);
+    bool is_in_buffer = (buffer != NULL && packet >= buffer && packet + size <= buffer + buffer_size);
+    if (is_in_buffer == false && size > send_ops[0].data.size()) {
+        return false;
+    }
+    struct io_uring_sqe* sqe = getSqe();
+    if (sqe == NULL) {
+        return false;
+    }
+
+    uint16_t index = free_send_ops.back();
+    free_send_ops.pop_back();
+    SendOp& op = send_ops[index];
+    if (is_in_buffer == true) {
+        op.iov.iov_base = (void*)packet;
+        op.buffer_id = current_buffer_id;
+        ++buffer_refs[current_buffer_id];
+    }
+    else {
+        memcpy(op.data.data(), packet, size);
+        op.iov.iov_base = op.data.data();
+        op.buffer_id = -1;
+    }
+    op.iov.iov_len = size;
+
+    // without a destination, the socket is connected to its peer
+    memset(&op.dest, 0, sizeof(op.dest));
+    memset(&op.msg, 0, sizeof(op.msg));
+    if (dest != NULL) {
+        memcpy(&op.dest, dest, (dest->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)));
+        op.msg.msg_name    = &op.dest;
+        op.msg.msg_namelen = (op.dest.sin6_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+    }
+    op.msg.msg_iov     = &op.iov;
+    op.msg.msg_iovlen  = 1;
+    op.queue = &queue;
+
+    io_uring_prep_sendmsg(sqe, fd, &op.msg, 0);
+    io_uring_sqe_set_data64(sqe, toUserData(OpType::SEND, index));
+    submit();
+    return true;
+}
+
+/**
+ *  Do not report results of pending sends to the given queue any more
+ */
+void IoUringBackend::cancel(PeerSendQueue& queue) {
+    for (auto& op : send_ops) {
+        if (op.queue == &queue) {
+            op.queue = NULL;
+        }
+    }
+}
+
+/**
+ *  Event loop callback - process all completions; operations queued while processing them, like the fan-out of
+ *  the received packets, are submitted together at the end
+ */
+void IoUringBackend::handleEvent(int fd, uint32_t events) {
+    uint64_t count;
+    if (read(event_fd, &count, sizeof(count)) < 0) {}
+
+    in_batch = true;
+    struct io_uring_cqe* cqe = NULL;
+    while (io_uring_peek_cqe(&ring, &cqe) == 0 && cqe != NULL) {
+        switch ((OpType)(io_uring_cqe_get_data64(cqe) >> 32)) {
+        case OpType::RECV:
+            handleReceive(cqe);
+            break;
+        case OpType::SEND:
+            handleSend(cqe);
+            break;
+        default:
+            break;
+        }
+        io_uring_cqe_seen(&ring, cqe);
+    }
+    in_batch = false;
+    submit();
+}
+
+/**
+ *  Process a recvmsg completion: dispatch the received packet, return its buffer to the ring unless it is
+ *  referenced by sends, and re-arm the multishot operation if it has terminated
+ */
+void IoUringBackend::handleReceive(const struct io_uring_cqe* cqe) {
+    int fd = (int)(io_uring_cqe_get_data64(cqe) & 0xffffffff);
+
+    if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER) != 0) {
+        int buffer_id = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        uint8_t* buffer = &buffers[buffer_id * buffer_size];
+        buffer_refs[buffer_id] = 1;
+        --free_buffers;
+
+        struct io_uring_recvmsg_out* out = io_uring_recvmsg_validate(buffer, cqe->res, &recv_msg);
+        if (out != NULL && (out->flags & MSG_TRUNC) == 0) {
+            struct sockaddr src;
+            memset(&src, 0, sizeof(src));
+            memcpy(&src, io_uring_recvmsg_name(out), (out->namelen < sizeof(src) ? out->namelen : sizeof(src)));
+
+            uint64_t rx_time_ns = 0;
+            int ifindex = 0;
+            for (struct cmsghdr* cmsg = io_uring_recvmsg_cmsg_firsthdr(out, &recv_msg); cmsg != NULL; cmsg = io_uring_recvmsg_cmsg_nexthdr(out, &recv_msg, cmsg)) {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                    struct timespec ts;
+                    memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                    rx_time_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+                }
+                else if (ifindex == 0) {
+                    ifindex = PacketDispatcher::getArrivalInterface(cmsg);
+                }
+            }
+
+            uint8_t* payload = (uint8_t*)io_uring_recvmsg_payload(out, &recv_msg);
+            unsigned int length = io_uring_recvmsg_payload_length(out, cqe->res, &recv_msg);
+            current_buffer_id = buffer_id;
+            for (const auto& socket : sockets) {
+                if ((int)socket.getSocketFd() == fd) {
+                    dispatcher.dispatch(socket, payload, length, src, rx_time_ns, ifindex);
+                    break;
+                }
+            }
+            current_buffer_id = -1;
+        }
+        releaseBuffer(buffer_id);
+    }
+    else if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP) {
+        // multishot recvmsg is not supported by this kernel; hand the socket back to the event loop
+        logger.print(LogLevel::LOG_WARNING, "io_uring multishot recvmsg not supported, using event loop for receiving\n");
+        is_multishot_supported = false;
+        for (auto it = sockets.begin(); it != sockets.end(); ++it) {
+            if ((int)it->getSocketFd() == fd) {
+                sockets.erase(it);
+                event_loop.add(fd, EventLoop::READABLE, dispatcher);
+                break;
+            }
+        }
+        return;
+    }
+    else if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+        logger.print(LogLevel::LOG_ERROR, "io_uring recvmsg error %s\n", strerror(-cqe->res));
+    }
+
+    // the kernel terminates multishot operations, e.g. if it runs out of provided buffers; re-arming while the buffer
+    // ring is still empty would terminate again right away, so a starved socket waits until a buffer is recycled
+    if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+        for (const auto& socket : sockets) {
+            if ((int)socket.getSocketFd() == fd) {
+                if (cqe->res == -ENOBUFS && free_buffers == 0) {
+                    starved_fds.push_back(fd);
+                }
+                else {
+                    armReceive(fd);
+                }
+                break;
+            }
+        }
+    }
+}
+
+/**
+ *  Process a sendmsg completion: report the result and release the referenced buffer; the queue copies the packet
+ *  if it has to be retried
+ */
+void IoUringBackend::handleSend(const struct io_uring_cqe* cqe) {
+    uint16_t index = (uint16_t)(io_uring_cqe_get_data64(cqe) & 0xffffffff);
+    SendOp& op = send_ops[index];
+    if (op.queue != NULL) {
+        op.queue->onSendComplete(cqe->res, (const uint8_t*)op.iov.iov_base, (unsigned long)op.iov.iov_len, (op.msg.msg_name != NULL ? (const struct sockaddr*)&op.dest : NULL));
+        op.queue = NULL;
+    }
+    if (op.buffer_id >= 0) {
+        releaseBuffer(op.buffer_id);
+        op.buffer_id = -1;
+    }
+    free_send_ops.push_back(index);
+}
+
+/**
+ *  Queue a multishot recvmsg operation for the given socket
+ */
+bool IoUringBackend::armReceive(int fd) {
+    struct io_uring_sqe* sqe = getSqe();
+    if (sqe == NULL) {
+        logger.print(LogLevel::LOG_ERROR, "cannot queue io_uring recvmsg\n");
+        return false;
+    }
+    io_uring_prep_recvmsg_multishot(sqe, fd, &recv_msg, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buffer_group;
+    io_uring_sqe_set_data64(sqe, toUserData(OpType::RECV, (uint32_t)fd));
+    submit();
+    return true;
+}
+
+/**
+ *  Drop a reference to the given provided buffer; the last reference returns it to the buffer ring
+ */
+void IoUringBackend::releaseBuffer(int buffer_id) {
+    if (--buffer_refs[buffer_id] == 0) {
+        io_uring_buf_ring_add(buf_ring, &buffers[buffer_id * buffer_size], buffer_size, (unsigned short)buffer_id, io_uring_buf_ring_mask(num_buffers), 0);
+        io_uring_buf_ring_advance(buf_ring, 1);
+        ++free_buffers;
+
+        // re-arm the receive operations that ran out of provided buffers, unless their socket has been removed
+        for (int fd : starved_fds) {
+            for (const auto& socket : sockets) {
+                if ((int)socket.getSocketFd() == fd) {
+                    armReceive(fd);
+                    break;
+                }
+            }
+        }
+        starved_fds.clear();
+    }
+}
+
+/**
+ *  Get a submission queue entry; if the submission queue is full, it is submitted first
+ */
+struct io_uring_sqe* IoUringBackend::getSqe(void) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+    if (sqe == NULL) {
+        io_uring_submit(&ring);
+        pending_submissions = 0;
+        sqe = io_uring_get_sqe(&ring);
+    }
+    if (sqe != NULL) {
+        ++pending_submissions;
+    }
+    return sqe;
+}
+
+/**
+ *  Submit the queued operations; while processing completions, submission is deferred to the end of the batch
+ */
+void IoUringBackend::submit(void) {
+    if (in_batch == false && pending_submissions > 0) {
+        io_uring_submit(&ring);
+        pending_submissions = 0;
+    }
+}
+
+#endif
@@ -0,0 +1,347 @@
+#ifdef _WIN32
+#include <chrono>
+#else
+#include <time.h>
+#endif
+#include <cstdio>
+#include <cstring>
+#include <AddressConversion.hpp>
+#include <LatencyTracer.hpp>
+using namespace libspeedwire;
+
+
+/**
+ *  Lock-free latency histogram
+ *  Values are recorded into log-linear buckets in the style of an hdr histogram: each power of two is
+ *  split into 16 linear sub-buckets, giving a relative precision of about 6%.
+ */
+
+/**
+ *  Constructor
+ */
+LatencyHistogram::LatencyHistogram(void) {
+    reset();
+}
+
+/**
+ *  Record the given value; this is wait-free and can be called concurrently with percentile queries
+ */
+void LatencyHistogram::record(uint64_t value) {
+    buckets[getBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    uint64_t current_max = max_value.load(std::memory_order_relaxed);
+    while (value > current_max && max_value.compare_exchange_weak(current_max, value, std::memory_order_relaxed) == false);
+}
+
+/**
+ *  Reset all buckets
+ */
+void LatencyHistogram::reset(void) {
+    for (auto& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    count.store(0, std::memory_order_relaxed);
+    max_value.store(0, std::memory_order_relaxed);
+}
+
+/**
+ *  Get the value below which the given percentage [0..100] of the recorded values fall
+ */
+uint64_t LatencyHistogram::getPercentile(double percentile) const {
+    uint64_t total = getCount();
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t threshold = (uint64_t)(percentile / 100.0 * (double)total + 0.5);
+    if (threshold == 0) threshold = 1;
+    uint64_t sum = 0;
+    for (unsigned i = 0; i < bucket_count; ++i) {
+        sum += buckets[i].load(std::memory_order_relaxed);
+        if (sum >= threshold) {
+            uint64_t value = getBucketValue(i);
+            uint64_t max = getMax();
+            return (value < max ? value : max);
+        }
+    }
+    return getMax();
+}
+
+/**
+ *  Get the bucket index for the given value
+ */
+unsigned LatencyHistogram::getBucketIndex(uint64_t value) {
+    if (value < sub_bucket_count) {
+        return (unsigned)value;
+    }
+    // determine the position of the most significant bit
+    unsigned msb = 0;
+    for (uint64_t v = value; v > 1; v >>= 1) {
+        ++msb;
+    }
+    unsigned magnitude = msb - sub_bucket_bits + 1;
+    if (magnitude >= magnitude_count - sub_bucket_bits + 1) {
+        return bucket_count - 1;
+    }
+    unsigned sub_bucket = (unsigned)(value >> (msb - sub_bucket_bits)) - sub_bucket_count;
+    return magnitude * sub_bucket_count + sub_bucket;
+}
+
+/**
+ *  Get the highest value that is recorded into the bucket with the given index
+ */
+uint64_t LatencyHistogram::getBucketValue(unsigned index) {
+    if (index < sub_bucket_count) {
+        return index;
+    }
+    unsigned magnitude  = index / sub_bucket_count;
+    unsigned sub_bucket = index % sub_bucket_count;
+    return (((uint64_t)(sub_bucket_count + sub_bucket + 1)) << (magnitude - 1)) - 1;
+}
+
+
+// ====================================================================================================
+
+/**
+ *  Forwarding latency tracer
+ *  The kernel receive timestamp of each packet travels with the packet through bounce check, patch and
+ *  send. Per-stage and total residency times are recorded per protocol and per destination. Residency times
+ *  spanning a wall clock step are clamped to 0.
+ */
+
+/**
+ *  Constructor
+ */
+LatencyTracer::LatencyTracer(void) :
+    active(false),
+    protocol(Protocol::UNKNOWN),
+    rx_time_ns(0),
+    last_mark_ns(0),
+    last_send_ns(0),
+    num_sends(0),
+    slow_threshold_ns(10000000),
+    slow_sample_rate(1),
+    slow_counter(0),
+    slow_index(0),
+    report_requested(false),
+    num_clamped(0) {
+    memset(&src, 0, sizeof(src));
+    stage_ns.fill(0);
+}
+
+/**
+ *  Get the singleton instance
+ */
+LatencyTracer& LatencyTracer::getInstance(void) {
+    static LatencyTracer instance;
+    return instance;
+}
+
+/**
+ *  Get the current wall clock time in ns; this is the time base of kernel receive timestamps
+ */
+uint64_t LatencyTracer::getTimeInNs(void) {
+#ifdef _WIN32
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/**
+ *  Register a destination and return its id, which is later passed to sent(). A destination registered again,
+ *  e.g. by a sender re-created on an interface hot-plug or a configuration reload, keeps its id and histograms.
+ */
+size_t LatencyTracer::registerDestination(const std::string& name) {
+    for (size_t i = 0; i < destinations.size(); ++i) {
+        if (destinations[i].name == name) {
+            return i;
+        }
+    }
+    destinations.emplace_back(name);
+    return destinations.size() - 1;
+}
+
+/**
+ *  Get the time elapsed between the given wall clock times; a negative time or a time above max_residency_ns
+ *  comes from a clock step in between and is clamped to 0
+ */
+uint64_t LatencyTracer::getElapsed(uint64_t now, uint64_t since) {
+    if (now < since || now - since > max_residency_ns) {
+        ++num_clamped;
+        return 0;
+    }
+    return now - since;
+}
+
+/**
+ *  Configure the slow packet trace; each sample_rate-th packet with a total residency above the threshold is traced
+ */
+void LatencyTracer::setSlowPacketThreshold(uint64_t threshold_in_ns, uint32_t sample_rate) {
+    slow_threshold_ns = threshold_in_ns;
+    slow_sample_rate = (sample_rate > 0 ? sample_rate : 1);
+}
+
+/**
+ *  Start tracing a packet with the given kernel receive timestamp; a timestamp of 0 is replaced by the current time
+ */
+void LatencyTracer::begin(uint64_t kernel_rx_time_ns, const struct sockaddr& packet_src, Protocol packet_protocol) {
+    uint64_t now = getTimeInNs();
+    active       = true;
+    protocol     = packet_protocol;
+    src          = packet_src;
+    rx_time_ns   = (kernel_rx_time_ns != 0 ? kernel_rx_time_ns : now);
+    last_mark_ns = now;
+    last_send_ns = now;
+    num_sends    = 0;
+    stage_ns.fill(0);
+    stage_ns[(size_t)Stage::RECEIVE] = getElapsed(now, rx_time_ns);
+    stage_latency[(size_t)protocol][(size_t)Stage::RECEIVE].record(stage_ns[(size_t)Stage::RECEIVE]);
+
+    // after a clock step, the total residency is measured from now
+    if (stage_ns[(size_t)Stage::RECEIVE] == 0) {
+        rx_time_ns = now;
+    }
+}
+
+/**
+ *  Mark the end of the given processing stage of the current packet
+ */
+void LatencyTracer::mark(Stage stage) {
+    if (active == false) {
+        return;
+    }
+    uint64_t now = getTimeInNs();
+    stage_ns[(size_t)stage] = getElapsed(now, last_mark_ns);
+    stage_latency[(size_t)protocol][(size_t)stage].record(stage_ns[(size_t)stage]);
+    last_mark_ns = now;
+}
+
+/**
+ *  Mark the completion of a send of the current packet to the given destination; the io_uring backend calls
+ *  this once the send has been submitted
+ */
+void LatencyTracer::sent(size_t destination) {
+    if (active == false) {
+        return;
+    }
+    uint64_t now = getTimeInNs();
+    if (destination < destinations.size()) {
+        destinations[destination].send_latency[(size_t)protocol].record(getElapsed(now, rx_time_ns));
+    }
+    last_send_ns = now;
+    ++num_sends;
+}
+
+/**
+ *  Finish tracing the current packet; send and total residency times are only recorded for forwarded packets
+ */
+void LatencyTracer::end(void) {
+    if (active == false) {
+        return;
+    }
+    active = false;
+    if (num_sends == 0) {
+        return;
+    }
+    uint64_t send_ns  = (last_send_ns > last_mark_ns ? getElapsed(last_send_ns, last_mark_ns) : 0);
+    uint64_t total_ns = getElapsed(last_send_ns, rx_time_ns);
+    stage_ns[(size_t)Stage::SEND]  = send_ns;
+    stage_ns[(size_t)Stage::TOTAL] = total_ns;
+    stage_latency[(size_t)protocol][(size_t)Stage::SEND].record(send_ns);
+    stage_latency[(size_t)protocol][(size_t)Stage::TOTAL].record(total_ns);
+
+    // sample slow packets into the slow packet trace ring
+    if (total_ns >= slow_threshold_ns && (++slow_counter % slow_sample_rate) == 0) {
+        SlowPacket slow;
+        slow.rx_time_ns = rx_time_ns;
+        slow.src        = src;
+        slow.protocol   = protocol;
+        slow.num_sends  = num_sends;
+        slow.stage_ns   = stage_ns;
+        if (slow_packets.size() < 64) {
+            slow_packets.push_back(slow);
+        }
+        else {
+            slow_packets[slow_index] = slow;
+        }
+        slow_index = (slow_index + 1) % 64;
+    }
+}
+
+/**
+ *  Get a printable table of latency percentiles in microseconds for each protocol, stage and destination
+ */
+std::string LatencyTracer::getPercentiles(void) const {
+    std::string result = "latency [us]                               count      p50      p90      p99    p99.9      max\n";
+    char line[256];
+    for (unsigned p = 0; p < protocol_count; ++p) {
+        for (unsigned s = 0; s < stage_count; ++s) {
+            const LatencyHistogram& h = stage_latency[p][s];
+            if (h.getCount() == 0) continue;
+            snprintf(line, sizeof(line), "%-10s %-30s %10llu %8.1f %8.1f %8.1f %8.1f %8.1f\n", toString((Protocol)p), toString((Stage)s),
+                (unsigned long long)h.getCount(), h.getPercentile(50.0) / 1000.0, h.getPercentile(90.0) / 1000.0,
+                h.getPercentile(99.0) / 1000.0, h.getPercentile(99.9) / 1000.0, h.getMax() / 1000.0);
+            result.append(line);
+        }
+        for (const auto& destination : destinations) {
+            const LatencyHistogram& h = destination.send_latency[p];
+            if (h.getCount() == 0) continue;
+            snprintf(line, sizeof(line), "%-10s %-30s %10llu %8.1f %8.1f %8.1f %8.1f %8.1f\n", toString((Protocol)p), destination.name.c_str(),
+                (unsigned long long)h.getCount(), h.getPercentile(50.0) / 1000.0, h.getPercentile(90.0) / 1000.0,
+                h.getPercentile(99.0) / 1000.0, h.getPercentile(99.9) / 1000.0, h.getMax() / 1000.0);
+            result.append(line);
+        }
+    }
+    if (num_clamped > 0) {
+        snprintf(line, sizeof(line), "%llu residency times clamped due to clock steps\n", (unsigned long long)num_clamped);
+        result.append(line);
+    }
+    return result;
+}
+
+/**
+ *  Get a printable list of the sampled slow packets, oldest first
+ */
+std::string LatencyTracer::getSlowPacketTrace(void) const {
+    std::string result;
+    char line[256];
+    for (size_t i = 0; i < slow_packets.size(); ++i) {
+        const SlowPacket& slow = slow_packets[(slow_packets.size() < 64 ? i : (slow_index + i) % 64)];
+        snprintf(line, sizeof(line), "slow %s packet from %s rx %llu.%09llu sends %u receive %.1fus bounce %.1fus patch %.1fus send %.1fus total %.1fus\n",
+            toString(slow.protocol), AddressConversion::toString(slow.src).c_str(),
+            (unsigned long long)(slow.rx_time_ns / 1000000000ull), (unsigned long long)(slow.rx_time_ns % 1000000000ull), slow.num_sends,
+            slow.stage_ns[(size_t)Stage::RECEIVE] / 1000.0, slow.stage_ns[(size_t)Stage::BOUNCE_CHECK] / 1000.0, slow.stage_ns[(size_t)Stage::PATCH] / 1000.0,
+            slow.stage_ns[(size_t)Stage::SEND] / 1000.0, slow.stage_ns[(size_t)Stage::TOTAL] / 1000.0);
+        result.append(line);
+    }
+    return result;
+}
+
+/**
+ *  Convert the given protocol to a printable string
+ */
+const char* LatencyTracer::toString(Protocol protocol) {
+    switch (protocol) {
+    case Protocol::EMETER:     return "emeter";
+    case Protocol::INVERTER:   return "inverter";
+    case Protocol::ENCRYPTION: return "encryption";
+    case Protocol::DISCOVERY:  return "discovery";
+    default:                   return "unknown";
+    }
+}
+
+/**
+ *  Convert the given stage to a printable string
+ */
+const char* LatencyTracer::toString(Stage stage) {
+    switch (stage) {
+    case Stage::RECEIVE:      return "receive";
+    case Stage::BOUNCE_CHECK: return "bounce check";
+    case Stage::PATCH:        return "patch";
+    case Stage::SEND:         return "send";
+    case Stage::TOTAL:        return "total";
+    default:                  return "unknown";
+    }
+}
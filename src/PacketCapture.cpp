@@ -0,0 +1,349 @@
+#ifdef _WIN32
+#include <Winsock2.h>
+#include <Ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#endif
+#include <cstring>
+#include <chrono>
+#include <Logger.hpp>
+#include <AddressConversion.hpp>
+#include <PacketCapture.hpp>
+using namespace libspeedwire;
+
+static Logger logger = Logger("PacketCapture");
+
+
+/**
+ *  Asynchronous packet capture tap
+ *  Mirrors received, forwarded and dropped packets into a lock-free single-producer single-consumer ring.
+ *  A background writer thread drains the ring into rotating pcapng files.
+ */
+
+// pcapng block types, option codes and link type
+static const uint32_t pcapng_section_header_block   = 0x0a0d0d0a;
+static const uint32_t pcapng_interface_block        = 0x00000001;
+static const uint32_t pcapng_enhanced_packet_block  = 0x00000006;
+static const uint16_t pcapng_opt_endofopt           = 0;
+static const uint16_t pcapng_opt_comment            = 1;
+static const uint16_t pcapng_if_name                = 2;
+static const uint16_t pcapng_if_tsresol             = 9;
+static const uint16_t pcapng_epb_flags              = 2;
+static const uint16_t linktype_raw                  = 101;     //!< raw ipv4 or ipv6 packets
+
+
+/**
+ *  Constructor
+ */
+PacketCapture::PacketCapture(void) :
+    records(new Record[num_records]),
+    head(0),
+    tail(0),
+    lost(0),
+    enabled(false),
+    running(false),
+    max_file_size(0),
+    max_files(0),
+    file_index(0),
+    file(NULL),
+    file_size(0),
+    lost_reported(0) {
+    rx_interface_ip.fill(0);
+}
+
+/**
+ *  Destructor
+ */
+PacketCapture::~PacketCapture(void) {
+    stop();
+}
+
+/**
+ *  Get the singleton instance
+ */
+PacketCapture& PacketCapture::getInstance(void) {
+    static PacketCapture instance;
+    return instance;
+}
+
+/**
+ *  Start capturing into files named <path>-<n>.pcapng; once a file exceeds the given size, capturing continues
+ *  with the next file, overwriting the oldest one beyond the given number of files
+ */
+bool PacketCapture::start(const std::string& capture_path, uint64_t file_size_limit, unsigned file_count) {
+    stop();
+    path          = capture_path;
+    max_file_size = file_size_limit;
+    max_files     = (file_count > 0 ? file_count : 1);
+    file_index    = 0;
+    if (openFile() == false) {
+        return false;
+    }
+    head.store(0);
+    tail.store(0);
+    running.store(true);
+    writer = std::thread(&PacketCapture::run, this);
+    enabled.store(true);
+    logger.print(LogLevel::LOG_INFO_0, "started packet capture into %s-*.pcapng\n", path.c_str());
+    return true;
+}
+
+/**
+ *  Stop capturing; packets still in the ring are written before the writer thread exits
+ */
+void PacketCapture::stop(void) {
+    enabled.store(false);
+    if (writer.joinable()) {
+        running.store(false);
+        writer.join();
+        logger.print(LogLevel::LOG_INFO_0, "stopped packet capture into %s-*.pcapng\n", path.c_str());
+    }
+    closeFile();
+}
+
+/**
+ *  Copy the given packet into the next free ring slot; this is the only work done on the forwarding thread
+ */
+void PacketCapture::capture(Direction direction, DropReason reason, const char* const interface_ip, const struct sockaddr* const src, const struct sockaddr* const dst, const uint8_t* const packet, const unsigned long size, uint64_t time_ns) {
+    const uint64_t index = head.load(std::memory_order_relaxed);
+    if (index - tail.load(std::memory_order_acquire) >= num_records) {
+        lost.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Record& record = records[index & (num_records - 1)];
+    record.time_ns         = time_ns;
+    record.length          = (uint32_t)size;
+    record.captured_length = (uint32_t)(size < snap_length ? size : snap_length);
+    record.direction       = direction;
+    record.reason          = reason;
+    strncpy(record.interface_ip.data(), interface_ip, record.interface_ip.size() - 1);
+    record.interface_ip[record.interface_ip.size() - 1] = '\0';
+    if (src != NULL) memcpy(&record.src, src, sizeof(record.src)); else memset(&record.src, 0, sizeof(record.src));
+    if (dst != NULL) memcpy(&record.dst, dst, sizeof(record.dst)); else memset(&record.dst, 0, sizeof(record.dst));
+    memcpy(record.data.data(), packet, record.captured_length);
+    if (direction == Direction::RX) {
+        rx_interface_ip = record.interface_ip;
+    }
+    head.store(index + 1, std::memory_order_release);
+}
+
+/**
+ *  Writer thread - drain the ring into the capture files; the thread polls the ring, such that the forwarding
+ *  thread never has to wake it up
+ */
+void PacketCapture::run(void) {
+    while (true) {
+        const bool stopping = (running.load() == false);
+        uint64_t index = tail.load(std::memory_order_relaxed);
+        const uint64_t end = head.load(std::memory_order_acquire);
+        for (; index != end; ++index) {
+            write(records[index & (num_records - 1)]);
+            tail.store(index + 1, std::memory_order_release);
+        }
+        if (file != NULL) {
+            fflush(file);
+        }
+        if (stopping == true) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+/**
+ *  Open the current capture file and write the section header block
+ */
+bool PacketCapture::openFile(void) {
+    closeFile();
+    const std::string name = path + "-" + std::to_string(file_index) + ".pcapng";
+    file = fopen(name.c_str(), "wb");
+    if (file == NULL) {
+        logger.print(LogLevel::LOG_ERROR, "cannot open capture file %s\n", name.c_str());
+        return false;
+    }
+    file_size = 0;
+    interface_ids.clear();
+
+    // byte order magic, version 1.0, unspecified section length
+    std::string body(16, '\0');
+    const uint32_t magic = 0x1a2b3c4d;
+    const uint16_t version[2] = { 1, 0 };
+    const int64_t  section_length = -1;
+    memcpy(&body[0], &magic, 4);
+    memcpy(&body[4], version, 4);
+    memcpy(&body[8], &section_length, 8);
+    writeBlock(pcapng_section_header_block, body);
+    return true;
+}
+
+/**
+ *  Close the current capture file
+ */
+void PacketCapture::closeFile(void) {
+    if (file != NULL) {
+        fclose(file);
+        file = NULL;
+    }
+}
+
+// append a pcapng option, padded to 32 bits
+static void appendOption(std::string& body, uint16_t code, const void* value, uint16_t length) {
+    body.append((const char*)&code, 2);
+    body.append((const char*)&length, 2);
+    if (length > 0) {
+        body.append((const char*)value, length);
+        body.append((4 - (length & 3)) & 3, '\0');
+    }
+}
+
+/**
+ *  Write a pcapng block with the given type and body; the body is padded to 32 bits
+ */
+void PacketCapture::writeBlock(uint32_t type, const std::string& body) {
+    const uint32_t padding = (4 - (body.size() & 3)) & 3;
+    const uint32_t length  = (uint32_t)(12 + body.size() + padding);
+    const uint32_t zero    = 0;
+    fwrite(&type, 4, 1, file);
+    fwrite(&length, 4, 1, file);
+    fwrite(body.data(), 1, body.size(), file);
+    fwrite(&zero, 1, padding, file);
+    fwrite(&length, 4, 1, file);
+    file_size += length;
+}
+
+/**
+ *  Get the pcapng interface id of the given local interface; an interface description block is written
+ *  when an interface appears for the first time in the current file
+ */
+uint32_t PacketCapture::getInterfaceId(const std::string& interface_ip) {
+    auto it = interface_ids.find(interface_ip);
+    if (it != interface_ids.end()) {
+        return it->second;
+    }
+    std::string body(8, '\0');
+    const uint16_t link_type = linktype_raw;
+    const uint32_t snap = snap_length + 48;
+    const uint8_t  resolution = 9;      // nanoseconds
+    memcpy(&body[0], &link_type, 2);
+    memcpy(&body[4], &snap, 4);
+    appendOption(body, pcapng_if_name, interface_ip.data(), (uint16_t)interface_ip.size());
+    appendOption(body, pcapng_if_tsresol, &resolution, 1);
+    appendOption(body, pcapng_opt_endofopt, NULL, 0);
+    writeBlock(pcapng_interface_block, body);
+    uint32_t id = (uint32_t)interface_ids.size();
+    interface_ids[interface_ip] = id;
+    return id;
+}
+
+// compute the ipv4 header checksum
+static uint16_t getIpv4Checksum(const uint8_t* header, size_t length) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < length; i += 2) {
+        sum += ((uint32_t)header[i] << 8) | header[i + 1];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+/**
+ *  Write the given record as an enhanced packet block with synthesized ip and udp headers; unspecified
+ *  addresses are replaced by the local interface address, the multicast destination by the speedwire multicast group
+ */
+void PacketCapture::write(const Record& record) {
+    if (file == NULL) {
+        return;
+    }
+    if (file_size >= max_file_size) {
+        file_index = (file_index + 1) % max_files;
+        if (openFile() == false) {
+            return;
+        }
+    }
+    const std::string interface_ip(record.interface_ip.data());
+    const uint32_t interface_id = getInterfaceId(interface_ip);
+
+    // resolve source and destination addresses; ipv4 headers are synthesized, ipv6 addresses show up as 0.0.0.0
+    struct in_addr local = AddressConversion::toInAddress(AddressConversion::isIpv4(interface_ip) ? interface_ip : std::string("0.0.0.0"));
+    struct in_addr src = local, dst = local;
+    uint16_t src_port = 9522, dst_port = 9522;
+    if (record.src.sa_family == AF_INET) {
+        const struct sockaddr_in& in = AddressConversion::toSockAddrIn(record.src);
+        src = in.sin_addr;
+        src_port = (in.sin_port != 0 ? ntohs(in.sin_port) : src_port);
+    }
+    if (record.dst.sa_family == AF_INET) {
+        const struct sockaddr_in& in = AddressConversion::toSockAddrIn(record.dst);
+        dst = in.sin_addr;
+        dst_port = (in.sin_port != 0 ? ntohs(in.sin_port) : dst_port);
+    }
+    else if (record.direction != Direction::RX) {
+        dst = AddressConversion::toInAddress("239.12.255.254");
+    }
+
+    std::array<uint8_t, 28> headers;
+    headers.fill(0);
+    const uint32_t ip_length = (uint32_t)(headers.size() + record.length);
+    headers[0] = 0x45;
+    headers[2] = (uint8_t)(ip_length >> 8);
+    headers[3] = (uint8_t)(ip_length);
+    headers[8] = 1;                     // ttl
+    headers[9] = 17;                    // udp
+    memcpy(&headers[12], &src, 4);
+    memcpy(&headers[16], &dst, 4);
+    uint16_t checksum = getIpv4Checksum(headers.data(), 20);
+    headers[10] = (uint8_t)(checksum >> 8);
+    headers[11] = (uint8_t)(checksum);
+    const uint32_t udp_length = 8 + record.length;
+    headers[20] = (uint8_t)(src_port >> 8);
+    headers[21] = (uint8_t)(src_port);
+    headers[22] = (uint8_t)(dst_port >> 8);
+    headers[23] = (uint8_t)(dst_port);
+    headers[24] = (uint8_t)(udp_length >> 8);
+    headers[25] = (uint8_t)(udp_length);
+
+    // enhanced packet block: interface id, timestamp, captured and original length, packet data, options
+    const uint32_t captured_length = (uint32_t)headers.size() + record.captured_length;
+    const uint32_t original_length = ip_length;
+    const uint32_t timestamp_high  = (uint32_t)(record.time_ns >> 32);
+    const uint32_t timestamp_low   = (uint32_t)(record.time_ns);
+    std::string body;
+    body.reserve(32 + captured_length + 64);
+    body.append((const char*)&interface_id, 4);
+    body.append((const char*)&timestamp_high, 4);
+    body.append((const char*)&timestamp_low, 4);
+    body.append((const char*)&captured_length, 4);
+    body.append((const char*)&original_length, 4);
+    body.append((const char*)headers.data(), headers.size());
+    body.append((const char*)record.data.data(), record.captured_length);
+    body.append((4 - (body.size() & 3)) & 3, '\0');
+
+    // direction flags: 1 inbound, 2 outbound; drops keep the direction of the packet at the time it was dropped
+    const uint32_t flags = (record.direction == Direction::RX || record.reason == DropReason::BOUNCED || record.reason == DropReason::QUARANTINED ? 1 : 2);
+    appendOption(body, pcapng_epb_flags, &flags, 4);
+    std::string comment = (record.direction == Direction::RX ? "rx" : (record.direction == Direction::TX ? "tx" : std::string("drop: ") + toString(record.reason)));
+    const uint64_t lost_count = lost.load(std::memory_order_relaxed);
+    if (lost_count != lost_reported) {
+        comment += "; " + std::to_string(lost_count - lost_reported) + " packets lost in capture ring";
+        lost_reported = lost_count;
+    }
+    appendOption(body, pcapng_opt_comment, comment.data(), (uint16_t)comment.size());
+    appendOption(body, pcapng_opt_endofopt, NULL, 0);
+    writeBlock(pcapng_enhanced_packet_block, body);
+}
+
+/**
+ *  Convert the given drop reason to a string
+ */
+const char* PacketCapture::toString(DropReason reason) {
+    switch (reason) {
+    case DropReason::NONE:         return "none";
+    case DropReason::BOUNCED:      return "bounced";
+    case DropReason::BACKLOG_FULL: return "backlog full";
+    case DropReason::CIRCUIT_OPEN: return "circuit open";
+    case DropReason::SEND_FAILED:  return "send failed";
+    case DropReason::QUARANTINED:  return "quarantined";
+    default:                       return "unknown";
+    }
+}
@@ -0,0 +1,283 @@
+#ifdef _WIN32
+#include <Winsock2.h>
+#else
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#endif
+#include <cstring>
+#include <Logger.hpp>
+#include <CachedClock.hpp>
+#include <PacketCapture.hpp>
+#include <StormDetector.hpp>
+#include <PacketDispatcher.hpp>
+using namespace libspeedwire;
+
+static Logger logger = Logger("PacketDispatcher");
+
+
+/**
+ *  Speedwire packet dispatcher
+ *  Receives speedwire packets from a set of sockets and dispatches them to the registered receivers.
+ *  In contrast to the libspeedwire receive dispatcher, the kernel receive timestamp of each packet is
+ *  obtained and handed to the latency tracer, such that it travels with the packet through the router.
+ */
+
+/**
+ *  Constructor
+ */
+PacketDispatcher::PacketDispatcher(LocalHost& host, EventLoop& loop) :
+    localhost(host),
+    event_loop(loop),
+    backend(NULL) {
+}
+
+/**
+ *  Add the given receive socket; kernel receive timestamps are enabled and the socket is registered with
+ *  the receive backend or the event loop. A socket shared by several interfaces is added only once.
+ */
+void PacketDispatcher::addSocket(const SpeedwireSocket& socket) {
+    for (const auto& entry : sockets) {
+        if (entry.getSocketFd() == socket.getSocketFd()) {
+            return;
+        }
+    }
+    if (enableControlMessages((int)socket.getSocketFd()) == false) {
+        logger.print(LogLevel::LOG_WARNING, "cannot enable kernel receive timestamps or arrival interfaces for interface %s\n", socket.getLocalInterfaceAddress().c_str());
+    }
+    sockets.push_back(socket);
+    if (backend == NULL || backend->addSocket(socket) == false) {
+        event_loop.add((int)socket.getSocketFd(), EventLoop::READABLE, *this);
+    }
+}
+
+/**
+ *  Add the given receive sockets
+ */
+void PacketDispatcher::addSockets(const std::vector<SpeedwireSocket>& new_sockets) {
+    for (const auto& socket : new_sockets) {
+        addSocket(socket);
+    }
+}
+
+/**
+ *  Remove the given receive socket from the receive backend or the event loop; the socket is not closed
+ */
+void PacketDispatcher::removeSocket(const SpeedwireSocket& socket) {
+    for (auto it = sockets.begin(); it != sockets.end(); ++it) {
+        if (it->getSocketFd() == socket.getSocketFd()) {
+            if (backend != NULL) {
+                backend->removeSocket(*it);
+            }
+            event_loop.remove((int)it->getSocketFd());
+            sockets.erase(it);
+            return;
+        }
+    }
+}
+
+/**
+ *  Add the given connected peer socket; packets arriving on it are dispatched as if they arrived on the given
+ *  interface socket, and receive errors, i.e. icmp errors of earlier sends to the peer, are passed to on_error
+ */
+void PacketDispatcher::addPeerSocket(int fd, const SpeedwireSocket& interface_socket, const std::function<void(void)>& on_error) {
+    enableControlMessages(fd);
+    peer_sockets.push_back(PeerSocket(fd, interface_socket, on_error));
+    event_loop.add(fd, EventLoop::READABLE, *this);
+}
+
+/**
+ *  Remove the given connected peer socket from the event loop; the socket is not closed
+ */
+void PacketDispatcher::removePeerSocket(int fd) {
+    for (auto it = peer_sockets.begin(); it != peer_sockets.end(); ++it) {
+        if (it->fd == fd) {
+            event_loop.remove(fd);
+            peer_sockets.erase(it);
+            return;
+        }
+    }
+}
+
+/**
+ *  Event loop callback - receive and dispatch a packet from the readable socket
+ */
+void PacketDispatcher::handleEvent(int fd, uint32_t events) {
+    for (const auto& socket : sockets) {
+        if ((int)socket.getSocketFd() == fd) {
+            receive(socket);
+            return;
+        }
+    }
+    for (const auto& peer : peer_sockets) {
+        if (peer.fd == fd) {
+            struct sockaddr src;
+            uint64_t rx_time_ns = 0;
+            int ifindex = 0;
+            int nbytes = recv(fd, src, rx_time_ns, ifindex);
+            if (nbytes > 0) {
+                dispatch(peer.interface_socket, recv_buffer.data(), (unsigned long)nbytes, src, rx_time_ns, ifindex);
+            }
+#ifdef _WIN32
+            else if (nbytes < 0 && WSAGetLastError() != WSAEWOULDBLOCK) {
+#else
+            else if (nbytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+#endif
+                peer.on_error();
+            }
+            return;
+        }
+    }
+}
+
+/**
+ *  Receive a packet from the given socket and dispatch it. Returns the number of received bytes.
+ */
+int PacketDispatcher::receive(const SpeedwireSocket& socket) {
+    struct sockaddr src;
+    uint64_t rx_time_ns = 0;
+    int ifindex = 0;
+    int nbytes = recv((int)socket.getSocketFd(), src, rx_time_ns, ifindex);
+    if (nbytes > 0) {
+        dispatch(socket, recv_buffer.data(), (unsigned long)nbytes, src, rx_time_ns, ifindex);
+    }
+    else if (nbytes < 0) {
+        logger.print(LogLevel::LOG_ERROR, "error receiving packet on interface %s\n", socket.getLocalInterfaceAddress().c_str());
+    }
+    return nbytes;
+}
+
+/**
+ *  Dispatch the given packet received on the given socket and arrived on the given interface index; the packet is
+ *  captured, then dropped without any protocol parsing if its source or arrival interface is quarantined by the
+ *  storm detector. An interface index of 0 stands for an unknown arrival interface.
+ */
+void PacketDispatcher::dispatch(const SpeedwireSocket& socket, uint8_t* const buffer, const unsigned long size, struct sockaddr& src, uint64_t rx_time_ns, int ifindex) {
+    PacketCapture& capture = PacketCapture::getInstance();
+    const uint64_t capture_time_ns = (rx_time_ns != 0 ? rx_time_ns : CachedClock::getEpochTimeInMs() * 1000000ull);
+    capture.received(socket.getLocalInterfaceAddress(), src, buffer, size, capture_time_ns);
+    if (StormDetector::getInstance().admit(ifindex, src) == false) {
+        capture.dropped(PacketCapture::DropReason::QUARANTINED, src, buffer, size, capture_time_ns);
+        return;
+    }
+    SpeedwireHeader packet(buffer, size);
+    dispatch(packet, src, rx_time_ns);
+}
+
+/**
+ *  Dispatch the given packet, received at the given kernel timestamp, to the registered receivers
+ */
+void PacketDispatcher::dispatch(SpeedwireHeader& packet, struct sockaddr& src, uint64_t rx_time_ns) {
+    LatencyTracer& tracer = LatencyTracer::getInstance();
+
+    if (packet.isValidData2Packet()) {
+        const SpeedwireData2Packet data2_packet(packet);
+        uint16_t protocolID = data2_packet.getProtocolID();
+
+        if (SpeedwireData2Packet::isEmeterProtocolID(protocolID) || SpeedwireData2Packet::isExtendedEmeterProtocolID(protocolID)) {
+            tracer.begin(rx_time_ns, src, LatencyTracer::Protocol::EMETER);
+            for (auto& receiver : emeter_receivers) {
+                receiver->receive(packet, src);
+            }
+            tracer.end();
+        }
+        else if (data2_packet.isInverterProtocolID() || data2_packet.isEncryptionProtocolID()) {
+            tracer.begin(rx_time_ns, src, (data2_packet.isInverterProtocolID() ? LatencyTracer::Protocol::INVERTER : LatencyTracer::Protocol::ENCRYPTION));
+            for (auto& receiver : inverter_receivers) {
+                receiver->receive(packet, src);
+            }
+            tracer.end();
+        }
+    }
+    else if (packet.isValidDiscoveryPacket()) {
+        tracer.begin(rx_time_ns, src, LatencyTracer::Protocol::DISCOVERY);
+        for (auto& receiver : discovery_receivers) {
+            receiver->receive(packet, src);
+        }
+        tracer.end();
+    }
+}
+
+/**
+ *  Enable kernel receive timestamps and arrival interface indexes on the given socket; returns false if they are
+ *  not available. A socket only accepts the packet info option of its own address family.
+ */
+bool PacketDispatcher::enableControlMessages(int fd) {
+#ifndef _WIN32
+    int enable = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0) {
+        return false;
+    }
+    // ipv6 sockets accept IP_PKTINFO as well, but then only report it for ipv4-mapped traffic; so try both
+    const bool ipv4_info = (setsockopt(fd, IPPROTO_IP,   IP_PKTINFO,       &enable, sizeof(enable)) == 0);
+    const bool ipv6_info = (setsockopt(fd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &enable, sizeof(enable)) == 0);
+    if (ipv4_info == false && ipv6_info == false) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+#ifndef _WIN32
+/**
+ *  Get the arrival interface index from the given control message; returns 0 if it is not a packet info message
+ */
+int PacketDispatcher::getArrivalInterface(const struct cmsghdr* cmsg) {
+    if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+        struct in_pktinfo info;
+        memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+        return info.ipi_ifindex;
+    }
+    if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_PKTINFO) {
+        struct in6_pktinfo info;
+        memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+        return (int)info.ipi6_ifindex;
+    }
+    return 0;
+}
+#endif
+
+/**
+ *  Receive a packet from the given socket into the receive buffer; the kernel receive timestamp is
+ *  returned in rx_time_ns and the arrival interface index in ifindex, each 0 if it is not available
+ */
+int PacketDispatcher::recv(int fd, struct sockaddr& src, uint64_t& rx_time_ns, int& ifindex) {
+    rx_time_ns = 0;
+    ifindex = 0;
+    memset(&src, 0, sizeof(src));
+#ifdef _WIN32
+    int src_len = sizeof(src);
+    int nbytes = ::recvfrom(fd, (char*)recv_buffer.data(), (int)recv_buffer.size(), 0, &src, &src_len);
+#else
+    struct sockaddr_storage addr;
+    struct iovec iov;
+    iov.iov_base = recv_buffer.data();
+    iov.iov_len  = recv_buffer.size();
+    uint8_t control[256];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name       = &addr;
+    msg.msg_namelen    = sizeof(addr);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+
+    int nbytes = (int)recvmsg(fd, &msg, 0);
+    if (nbytes > 0) {
+        memcpy(&src, &addr, sizeof(src));
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                rx_time_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+            }
+            else if (ifindex == 0) {
+                ifindex = getArrivalInterface(cmsg);
+            }
+        }
+    }
+#endif
+    return nbytes;
+}
@@ -5,24 +5,21 @@ using namespace libspeedwire;
 /**
  *  Speedwire packet patcher base class
  *  In some cases it is useful to change the content of a speedwire packet before forwarding it to another network or host
+ *  The patch rules are taken from the configuration snapshot.
  */
 
 /**
  *  Constructor
  */
-PacketPatcher::PacketPatcher(void) {
-    // define an obis data element with the given negative active power total value and convert it to its byte representation
-    ObisData temp = ObisData::NegativeActivePowerTotal;
-    temp.measurementValues.addMeasurement(3480, 0);
-    maxNegativeActivePowerTotalBytes = temp.toByteArray();
-}
+PacketPatcher::PacketPatcher(void) {}
 
 /**
  *  Patch the given speedwire packet in-place
  */
-void PacketPatcher::patch(SpeedwireHeader& speedwire_packet, struct sockaddr& src) {
-#if 1
-    // example implementation for an emeter packet patch
+void PacketPatcher::patch(SpeedwireHeader& speedwire_packet, struct sockaddr& src, const RouterConfig& config) {
+    if (config.patch_rules.size() == 0) {
+        return;
+    }
 
     // check if it is a valid data2 packet
     if (speedwire_packet.isValidData2Packet()) {
@@ -49,13 +46,11 @@ void PacketPatcher::patch(SpeedwireHeader& speedwire_packet, struct sockaddr& sr
                 const uint8_t  tariff  = emeter_packet.getObisTariff(obis);
                 const uint32_t value   = emeter_packet.getObisValue4(obis);
 
-                // limit the negative active total power to some given value
-                const ObisData& negActPowTot = ObisData::NegativeActivePowerTotal;
-                if (channel == negActPowTot.channel && index == negActPowTot.index && type == negActPowTot.type && tariff == negActPowTot.tariff) {
-                    uint32_t max_value = emeter_packet.getObisValue4(maxNegativeActivePowerTotalBytes.data());
-                    if (value > max_value) {
-                        fprintf(stdout, "limited max negative active power from %ul to %ul\n", value, max_value);
-                        emeter_packet.setObisElement((void*)obis, maxNegativeActivePowerTotalBytes.data());
+                // limit the obis element to the maximum value given by the patch rule
+                for (const auto& rule : config.patch_rules) {
+                    if (rule.matches(channel, index, type, tariff) && value > rule.max_value) {
+                        fprintf(stdout, "limited %u:%u.%u.%u from %u to %u\n", channel, index, type, tariff, value, rule.max_value);
+                        emeter_packet.setObisElement((void*)obis, rule.bytes.data());
                     }
                 }
 
@@ -64,5 +59,4 @@ void PacketPatcher::patch(SpeedwireHeader& speedwire_packet, struct sockaddr& sr
             }
         }
     }
-#endif
 }
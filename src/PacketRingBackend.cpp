@@ -0,0 +1,391 @@
+#ifdef __linux__
+
+#include <errno.h>
+#include <unistd.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <cstdio>
+#include <cstring>
+#include <Logger.hpp>
+#include <PacketRingBackend.hpp>
+using namespace libspeedwire;
+
+static Logger logger = Logger("PacketRingBackend");
+
+
+/**
+ *  AF_PACKET TPACKET_V3 receive backend
+ *  Each local interface has a memory-mapped ring of blocks filled by the kernel with ipv4 udp packets to port 9522.
+ *  Packets are dispatched block by block as views into the ring; the udp receive sockets drop packets arriving on an
+ *  interface with a ring by a socket filter, such that each packet is received exactly once.
+ */
+
+/**
+ *  In-kernel filter of the packet sockets; as packet sockets are of type SOCK_DGRAM, offsets are relative to the
+ *  ipv4 header. Fragments are rejected, as they cannot be reassembled from the ring.
+ */
+static struct sock_filter speedwire_filter[] = {
+    BPF_STMT(BPF_LD  | BPF_B   | BPF_ABS, 9),               // ip protocol
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   IPPROTO_UDP, 0, 6),
+    BPF_STMT(BPF_LD  | BPF_H   | BPF_ABS, 6),               // more fragments flag and fragment offset
+    BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K,  0x3fff, 4, 0),
+    BPF_STMT(BPF_LDX | BPF_B   | BPF_MSH, 0),               // ip header length
+    BPF_STMT(BPF_LD  | BPF_H   | BPF_IND, 2),               // udp destination port
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K,   SpeedwireSocket::speedwire_port_9522, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, 0x40000),
+    BPF_STMT(BPF_RET | BPF_K, 0)
+};
+
+
+/**
+ *  Constructor
+ */
+PacketRingBackend::PacketRingBackend(PacketDispatcher& packet_dispatcher, EventLoop& loop) :
+    dispatcher(packet_dispatcher),
+    event_loop(loop),
+    rings(),
+    is_open(false),
+    num_packets(0),
+    num_blocks_processed(0),
+    num_kernel_drops(0) {
+}
+
+/**
+ *  Destructor - all rings are closed and the socket filters of the receive sockets are detached
+ */
+PacketRingBackend::~PacketRingBackend(void) {
+    closeRings();
+}
+
+/**
+ *  Check that packet sockets can be opened; returns false if they are not supported or the process lacks
+ *  CAP_NET_RAW, in which case the event loop backend is used
+ */
+bool PacketRingBackend::open(void) {
+    int fd = socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        logger.print(LogLevel::LOG_WARNING, "packet sockets not available (%s), using event loop backend\n", strerror(errno));
+        return false;
+    }
+    ::close(fd);
+    is_open = true;
+    logger.print(LogLevel::LOG_INFO_0, "using packet ring backend\n");
+    return true;
+}
+
+/**
+ *  Receive the packets of the given socket arriving on its local interface from the packet ring of the interface;
+ *  the ring is opened for the first socket of an interface. The socket stays with the event loop for packets
+ *  arriving on interfaces without a ring, hence this always returns false.
+ */
+bool PacketRingBackend::addSocket(const SpeedwireSocket& socket) {
+    if (is_open == false) {
+        return false;
+    }
+    sockets.push_back(socket);
+    int ifindex = 0;
+    std::string ifname;
+    if (findInterface(socket.getLocalInterfaceAddress(), ifindex, ifname) == false) {
+        logger.print(LogLevel::LOG_WARNING, "cannot find interface of %s, using event loop for receiving\n", socket.getLocalInterfaceAddress().c_str());
+        updateFilters();
+        return false;
+    }
+    for (auto& ring : rings) {
+        if (ring.ifindex == ifindex) {
+            ring.sockets.push_back(socket);
+            updateFilters();
+            return false;
+        }
+    }
+
+    // the udp sockets stop receiving from the interface before the ring starts, such that no packet is received twice
+    if (updateFilters(ifindex) == false) {
+        return false;
+    }
+    Ring* ring = openRing(ifindex, ifname);
+    if (ring == NULL) {
+        updateFilters();
+        return false;
+    }
+    ring->sockets.push_back(socket);
+    return false;
+}
+
+/**
+ *  Stop receiving the packets of the given socket; the packet ring is closed with the last socket of its interface,
+ *  before the udp sockets receive from the interface again
+ */
+void PacketRingBackend::removeSocket(const SpeedwireSocket& socket) {
+    for (auto it = sockets.begin(); it != sockets.end(); ++it) {
+        if (it->getSocketFd() == socket.getSocketFd()) {
+            setFilter(*it, std::vector<int>());
+            sockets.erase(it);
+            break;
+        }
+    }
+    for (auto ring = rings.begin(); ring != rings.end(); ++ring) {
+        for (auto it = ring->sockets.begin(); it != ring->sockets.end(); ++it) {
+            if (it->getSocketFd() == socket.getSocketFd()) {
+                ring->sockets.erase(it);
+                if (ring->sockets.size() == 0) {
+                    closeRing(*ring);
+                    rings.erase(ring);
+                    updateFilters();
+                }
+                return;
+            }
+        }
+    }
+}
+
+/**
+ *  Event loop callback - process all blocks handed over by the kernel and return them to the kernel
+ */
+void PacketRingBackend::handleEvent(int fd, uint32_t events) {
+    for (auto& ring : rings) {
+        if (ring.fd == fd) {
+            for (unsigned i = 0; i < num_blocks; ++i) {
+                struct tpacket_block_desc* block = (struct tpacket_block_desc*)(ring.map + ring.next_block * block_size);
+                if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+                    break;
+                }
+                processBlock(ring, *block);
+                __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+                ring.next_block = (ring.next_block + 1) % num_blocks;
+            }
+            return;
+        }
+    }
+}
+
+/**
+ *  Dispatch all packets of the given block; each udp payload is dispatched in place, such that receivers
+ *  parse and patch it directly in the ring. Packets sent by this host are skipped.
+ */
+void PacketRingBackend::processBlock(Ring& ring, struct tpacket_block_desc& block) {
+    const SpeedwireSocket& socket = ring.sockets.front();
+    const uint32_t num_pkts = block.hdr.bh1.num_pkts;
+    uint8_t* frame = (uint8_t*)&block + block.hdr.bh1.offset_to_first_pkt;
+
+    for (uint32_t i = 0; i < num_pkts; ++i) {
+        const struct tpacket3_hdr* hdr = (const struct tpacket3_hdr*)frame;
+        const struct sockaddr_ll* sll = (const struct sockaddr_ll*)(frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+        uint8_t* ip = frame + hdr->tp_net;
+        const unsigned long length = hdr->tp_snaplen - (hdr->tp_net - hdr->tp_mac);
+        frame += hdr->tp_next_offset;
+
+        if (sll->sll_pkttype == PACKET_OUTGOING || sll->sll_pkttype == PACKET_OTHERHOST || length < 28) {
+            continue;
+        }
+        // udp checksums are not verified; corrupted frames are already discarded by the link layer
+        const unsigned long header_length = (ip[0] & 0x0f) * 4;
+        uint8_t* udp = ip + header_length;
+        const unsigned long udp_length = ((unsigned long)udp[4] << 8) | udp[5];
+        if (header_length < 20 || udp_length < 8 || header_length + udp_length > length) {
+            continue;
+        }
+
+        struct sockaddr src;
+        memset(&src, 0, sizeof(src));
+        struct sockaddr_in& src4 = *(struct sockaddr_in*)&src;
+        src4.sin_family = AF_INET;
+        memcpy(&src4.sin_addr, ip + 12, sizeof(src4.sin_addr));
+        memcpy(&src4.sin_port, udp, sizeof(src4.sin_port));
+        const uint64_t rx_time_ns = (uint64_t)hdr->tp_sec * 1000000000ull + (uint64_t)hdr->tp_nsec;
+
+        dispatcher.dispatch(socket, udp + 8, udp_length - 8, src, rx_time_ns, sll->sll_ifindex);
+        ++num_packets;
+    }
+    ++num_blocks_processed;
+}
+
+/**
+ *  Open a packet socket with a TPACKET_V3 ring on the given interface and register it with the event loop;
+ *  returns NULL if the ring cannot be set up
+ */
+PacketRingBackend::Ring* PacketRingBackend::openRing(int ifindex, const std::string& ifname) {
+    Ring ring;
+    ring.ifindex = ifindex;
+    ring.ifname  = ifname;
+
+    // the socket does not receive anything until it is bound, i.e. until the filter and the ring are in place
+    ring.fd = socket(AF_PACKET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (ring.fd < 0) {
+        logger.print(LogLevel::LOG_WARNING, "cannot open packet socket for interface %s (%s), using event loop for receiving\n", ifname.c_str(), strerror(errno));
+        return NULL;
+    }
+    struct sock_fprog filter;
+    filter.len    = sizeof(speedwire_filter) / sizeof(speedwire_filter[0]);
+    filter.filter = speedwire_filter;
+    int version = TPACKET_V3;
+    struct tpacket_req3 req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size     = block_size;
+    req.tp_block_nr       = num_blocks;
+    req.tp_frame_size     = frame_size;
+    req.tp_frame_nr       = (block_size / frame_size) * num_blocks;
+    req.tp_retire_blk_tov = block_timeout;
+    if (setsockopt(ring.fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0 ||
+        setsockopt(ring.fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0 ||
+        setsockopt(ring.fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        logger.print(LogLevel::LOG_WARNING, "cannot set up packet ring for interface %s (%s), using event loop for receiving\n", ifname.c_str(), strerror(errno));
+        closeRing(ring);
+        return NULL;
+    }
+    void* map = mmap(NULL, (size_t)block_size * num_blocks, PROT_READ | PROT_WRITE, MAP_SHARED, ring.fd, 0);
+    if (map == MAP_FAILED) {
+        logger.print(LogLevel::LOG_WARNING, "cannot map packet ring for interface %s (%s), using event loop for receiving\n", ifname.c_str(), strerror(errno));
+        closeRing(ring);
+        return NULL;
+    }
+    ring.map = (uint8_t*)map;
+#ifdef PACKET_IGNORE_OUTGOING
+    // not supported before linux 4.20; outgoing packets are skipped while processing blocks anyway
+    int ignore_outgoing = 1;
+    setsockopt(ring.fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore_outgoing, sizeof(ignore_outgoing));
+#endif
+
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sll_family   = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_IP);
+    addr.sll_ifindex  = ifindex;
+    if (bind(ring.fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || event_loop.add(ring.fd, EventLoop::READABLE, *this) == false) {
+        logger.print(LogLevel::LOG_WARNING, "cannot bind packet ring to interface %s (%s), using event loop for receiving\n", ifname.c_str(), strerror(errno));
+        closeRing(ring);
+        return NULL;
+    }
+    logger.print(LogLevel::LOG_INFO_0, "receiving from interface %s through packet ring\n", ifname.c_str());
+    rings.push_back(ring);
+    return &rings.back();
+}
+
+/**
+ *  Unregister, unmap and close the given packet ring
+ */
+void PacketRingBackend::closeRing(Ring& ring) {
+    if (ring.map != NULL) {
+        event_loop.remove(ring.fd);
+        munmap(ring.map, (size_t)block_size * num_blocks);
+        ring.map = NULL;
+    }
+    if (ring.fd >= 0) {
+        ::close(ring.fd);
+        ring.fd = -1;
+    }
+}
+
+/**
+ *  Close all packet rings and detach the socket filters, such that all packets are received through the udp sockets
+ */
+void PacketRingBackend::closeRings(void) {
+    for (auto& ring : rings) {
+        closeRing(ring);
+    }
+    rings.clear();
+    for (const auto& socket : sockets) {
+        setFilter(socket, std::vector<int>());
+    }
+}
+
+/**
+ *  Attach a socket filter to all udp receive sockets, dropping packets arriving on interfaces with a ring and on
+ *  the given interface about to get a ring. If a filter cannot be attached, a ring and a udp socket would receive
+ *  the same packets; all rings are closed and the backend is disabled. Returns false in this case.
+ */
+bool PacketRingBackend::updateFilters(int new_ifindex) {
+    std::vector<int> ifindexes;
+    for (const auto& ring : rings) {
+        ifindexes.push_back(ring.ifindex);
+    }
+    if (new_ifindex > 0) {
+        ifindexes.push_back(new_ifindex);
+    }
+    for (const auto& socket : sockets) {
+        if (setFilter(socket, ifindexes) == false) {
+            logger.print(LogLevel::LOG_WARNING, "cannot filter receive socket of %s (%s), closing all packet rings and using event loop for receiving\n",
+                         socket.getLocalInterfaceAddress().c_str(), strerror(errno));
+            closeRings();
+            is_open = false;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ *  Find the index and name of the interface holding the given local ipv4 address
+ */
+bool PacketRingBackend::findInterface(const std::string& ip, int& ifindex, std::string& ifname) {
+    struct ifaddrs* ifaddr = NULL;
+    if (getifaddrs(&ifaddr) != 0) {
+        return false;
+    }
+    bool found = false;
+    for (struct ifaddrs* ifa = ifaddr; ifa != NULL && found == false; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_INET) {
+            continue;
+        }
+        char buffer[INET_ADDRSTRLEN];
+        if (inet_ntop(AF_INET, &((struct sockaddr_in*)ifa->ifa_addr)->sin_addr, buffer, sizeof(buffer)) != NULL && ip == buffer) {
+            ifindex = (int)if_nametoindex(ifa->ifa_name);
+            ifname  = ifa->ifa_name;
+            found   = (ifindex > 0);
+        }
+    }
+    freeifaddrs(ifaddr);
+    return found;
+}
+
+/**
+ *  Attach a filter to the given udp receive socket, dropping packets arriving on the given interfaces before they
+ *  are queued; the socket keeps its multicast group memberships. Without interfaces, the filter is detached.
+ */
+bool PacketRingBackend::setFilter(const SpeedwireSocket& socket, const std::vector<int>& ifindexes) {
+    if (ifindexes.size() == 0) {
+        // fails harmlessly if no filter is attached
+        int dummy = 0;
+        setsockopt(socket.getSocketFd(), SOL_SOCKET, SO_DETACH_FILTER, &dummy, sizeof(dummy));
+        return true;
+    }
+    if (ifindexes.size() > 255) {
+        errno = E2BIG;
+        return false;
+    }
+    std::vector<struct sock_filter> program;
+    program.push_back(BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t)(SKF_AD_OFF + SKF_AD_IFINDEX)));
+    for (size_t i = 0; i < ifindexes.size(); ++i) {
+        program.push_back(BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (uint32_t)ifindexes[i], (uint8_t)(ifindexes.size() - i), 0));
+    }
+    program.push_back(BPF_STMT(BPF_RET | BPF_K, 0xffffffff));
+    program.push_back(BPF_STMT(BPF_RET | BPF_K, 0));
+
+    struct sock_fprog filter;
+    filter.len    = (unsigned short)program.size();
+    filter.filter = program.data();
+    return (setsockopt(socket.getSocketFd(), SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) == 0);
+}
+
+/**
+ *  Get a report of ring statistics; kernel drops are accumulated, as the kernel resets its counters when read
+ */
+std::string PacketRingBackend::getReport(void) {
+    for (const auto& ring : rings) {
+        struct tpacket_stats_v3 stats;
+        socklen_t length = sizeof(stats);
+        if (getsockopt(ring.fd, SOL_PACKET, PACKET_STATISTICS, &stats, &length) == 0) {
+            num_kernel_drops += stats.tp_drops;
+        }
+    }
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "packet ring: %lu interfaces, %lu packets in %lu blocks, %lu dropped by the kernel\n",
+             (unsigned long)rings.size(), (unsigned long)num_packets, (unsigned long)num_blocks_processed, (unsigned long)num_kernel_drops);
+    return std::string(buffer);
+}
+
+#endif
@@ -0,0 +1,318 @@
+#ifdef _WIN32
+#include <Winsock2.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#endif
+#include <cstring>
+#include <Logger.hpp>
+#include <ConfigManager.hpp>
+#include <PeerSendQueue.hpp>
+using namespace libspeedwire;
+
+static Logger logger = Logger("PeerSendQueue");
+
+PeerSendQueue::ISendBackend* PeerSendQueue::send_backend = NULL;
+
+
+/**
+ *  Per-peer send queue
+ *  Packets are sent on non-blocking sockets, or on the connected socket of the peer, if there is one. If a socket buffer is full, packets are kept in a small bounded
+ *  backlog that is flushed by a retry timer. A circuit breaker stops sending to a peer that keeps failing and probes it
+ *  again with exponential backoff. Backlog size, drop policies and circuit breaker settings are taken from the
+ *  configuration snapshot.
+ */
+
+/**
+ *  Constructor
+ */
+PeerSendQueue::PeerSendQueue(const std::string& peer_name) :
+    name(peer_name),
+    backlog(),
+    peer_fd(-1),
+    backend_fd(-1),
+    retry_timer(),
+    retry_interval_in_ms(5),
+    state(BreakerState::CLOSED),
+    probe_in_flight(false),
+    consecutive_failures(0),
+    probe_timer(),
+    backoff_in_ms(0),
+    num_sent(0),
+    num_dropped(0),
+    num_failed(0) {
+    // retry sending the backlog until it is empty
+    retry_timer.setCallback([this](void) {
+        flush();
+        if (backlog.size() > 0) {
+            TimerWheel::getInstance().schedule(retry_timer, retry_interval_in_ms);
+        }
+    });
+
+    // once the backoff time has elapsed, an open circuit breaker becomes half-open and a single probe is allowed
+    probe_timer.setCallback([this](void) {
+        logger.print(LogLevel::LOG_INFO_0, "probing peer %s after %u ms\n", name.c_str(), backoff_in_ms);
+        state = BreakerState::HALF_OPEN;
+    });
+}
+
+/**
+ *  Destructor - sends still pending in the send backend are no longer reported to this queue
+ */
+PeerSendQueue::~PeerSendQueue(void) {
+    if (send_backend != NULL) {
+        send_backend->cancel(*this);
+    }
+}
+
+/**
+ *  Send the given packet on the given socket to the given destination; if dest is NULL, the packet is sent to
+ *  the multicast address of the socket. If the queue has a peer socket, the packet is sent on the peer socket
+ *  instead. The given socket must be in non-blocking mode. The packet is copied if it cannot be sent immediately.
+ */
+PeerSendQueue::Result PeerSendQueue::send(SpeedwireSocket& socket, const uint8_t* const packet, const unsigned long size, const struct sockaddr* const dest, LatencyTracer::Protocol protocol) {
+    Entry entry(peer_fd >= 0 ? peer_fd : (int)socket.getSocketFd());
+    if (peer_fd >= 0) {
+        memset(&entry.dest, 0, sizeof(entry.dest));
+    }
+    else if (dest != NULL) {
+        memcpy(&entry.dest, dest, (dest->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)));
+        entry.has_dest = true;
+    }
+    else {
+        struct sockaddr_in& multicast = *(struct sockaddr_in*)&entry.dest;
+        memset(&entry.dest, 0, sizeof(entry.dest));
+        multicast.sin_family = AF_INET;
+        multicast.sin_addr   = socket.getSpeedwireMulticastIn4Address();
+        multicast.sin_port   = htons(SpeedwireSocket::speedwire_port_9522);
+        entry.has_dest = true;
+    }
+
+    if (state == BreakerState::OPEN) {
+        ++num_dropped;
+        return Result::BLOCKED;
+    }
+
+    // preserve packet order, if there is a backlog; while a probe is in flight, packets wait for its result
+    if (backlog.size() > 0 || isSendAllowed() == false) {
+        size_t dropped = num_dropped;
+        enqueue(entry, packet, size, protocol);
+        flush();
+        return (num_dropped != dropped ? Result::DROPPED : Result::QUEUED);
+    }
+
+    // hand the packet to the asynchronous send backend, if there is one; its result is reported later
+    onSendStarted();
+    if (send_backend != NULL && send_backend->send(entry.fd, packet, size, (entry.has_dest ? (const struct sockaddr*)&entry.dest : NULL), *this) == true) {
+        backend_fd = entry.fd;
+        return Result::SENT;
+    }
+
+    switch (transmit(entry, packet, size)) {
+    case Status::OK:
+        onSuccess();
+        return Result::SENT;
+    case Status::WOULD_BLOCK:
+        probe_in_flight = false;
+        enqueue(entry, packet, size, protocol);
+        return Result::QUEUED;
+    default:
+        onFailure();
+        return Result::FAILED;
+    }
+}
+
+/**
+ *  Try to send the packets in the backlog, oldest first
+ */
+void PeerSendQueue::flush(void) {
+    while (backlog.size() > 0 && isSendAllowed() == true) {
+        Entry& entry = backlog.front();
+        onSendStarted();
+        Status status = transmit(entry, entry.packet.data(), (unsigned long)entry.packet.size());
+        if (status == Status::WOULD_BLOCK) {
+            probe_in_flight = false;
+            break;
+        }
+        if (status == Status::OK) {
+            onSuccess();
+        }
+        else {
+            onFailure();
+        }
+        backlog.pop_front();
+    }
+    // drop the backlog while the circuit breaker is open
+    if (state == BreakerState::OPEN && backlog.size() > 0) {
+        num_dropped += backlog.size();
+        backlog.clear();
+    }
+}
+
+/**
+ *  Record the result of a send completed by the send backend; the result is the number of bytes sent or a
+ *  negative errno value. Packets that found the socket buffer full are added to the backlog and retried by
+ *  the retry timer, like packets the queue sent itself.
+ */
+void PeerSendQueue::onSendComplete(int result, const uint8_t* const packet, const unsigned long size, const struct sockaddr* const dest) {
+#ifndef _WIN32
+    if (result == -EAGAIN || result == -EWOULDBLOCK || result == -ENOBUFS) {
+        probe_in_flight = false;
+        if (backend_fd < 0 || state == BreakerState::OPEN) {
+            ++num_dropped;
+            return;
+        }
+        Entry entry(backend_fd);
+        if (dest != NULL) {
+            memcpy(&entry.dest, dest, (dest->sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in)));
+            entry.has_dest = true;
+        }
+        enqueue(entry, packet, size, getProtocol(SpeedwireHeader(packet, size)));
+        return;
+    }
+#endif
+    if (result >= 0) {
+        onSuccess();
+    }
+    else {
+        onFailure();
+    }
+}
+
+/**
+ *  Get the protocol of the given speedwire packet
+ */
+LatencyTracer::Protocol PeerSendQueue::getProtocol(const SpeedwireHeader& packet) {
+    if (packet.isValidData2Packet()) {
+        const SpeedwireData2Packet data2_packet(packet);
+        uint16_t protocolID = data2_packet.getProtocolID();
+        if (SpeedwireData2Packet::isEmeterProtocolID(protocolID) || SpeedwireData2Packet::isExtendedEmeterProtocolID(protocolID)) {
+            return LatencyTracer::Protocol::EMETER;
+        }
+        if (data2_packet.isInverterProtocolID()) {
+            return LatencyTracer::Protocol::INVERTER;
+        }
+        if (data2_packet.isEncryptionProtocolID()) {
+            return LatencyTracer::Protocol::ENCRYPTION;
+        }
+    }
+    else if (packet.isValidDiscoveryPacket()) {
+        return LatencyTracer::Protocol::DISCOVERY;
+    }
+    return LatencyTracer::Protocol::UNKNOWN;
+}
+
+/**
+ *  Transmit the given packet to the destination given by the entry
+ */
+PeerSendQueue::Status PeerSendQueue::transmit(Entry& entry, const uint8_t* const packet, const unsigned long size) {
+    int nbytes;
+    if (entry.has_dest == false) {
+        nbytes = (int)::send(entry.fd, (const char*)packet, size, 0);
+    }
+    else {
+        const socklen_t dest_len = (entry.dest.sin6_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+        nbytes = (int)::sendto(entry.fd, (const char*)packet, size, 0, (const struct sockaddr*)&entry.dest, dest_len);
+    }
+    if (nbytes == (int)size) {
+        return Status::OK;
+    }
+#ifdef _WIN32
+    if (nbytes < 0 && WSAGetLastError() == WSAEWOULDBLOCK) {
+#else
+    if (nbytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+#endif
+        return Status::WOULD_BLOCK;
+    }
+    return Status::ERROR;
+}
+
+/**
+ *  Switch the given socket to non-blocking mode; this is idempotent, so shared sockets can be switched by each user
+ */
+bool PeerSendQueue::setNonBlocking(int fd) {
+#ifdef _WIN32
+    u_long mode = 1;
+    if (ioctlsocket(fd, FIONBIO, &mode) != 0) {
+#else
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0 || ((flags & O_NONBLOCK) == 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+#endif
+        logger.print(LogLevel::LOG_ERROR, "cannot set socket %d to non-blocking mode\n", fd);
+        return false;
+    }
+    return true;
+}
+
+/**
+ *  Check with the circuit breaker whether sending is allowed; a half-open circuit breaker allows a single probe
+ *  until its result is known
+ */
+bool PeerSendQueue::isSendAllowed(void) const {
+    return (state == BreakerState::CLOSED || (state == BreakerState::HALF_OPEN && probe_in_flight == false));
+}
+
+/**
+ *  Record the start of a send; while the circuit breaker is half-open, the send is the probe
+ */
+void PeerSendQueue::onSendStarted(void) {
+    if (state == BreakerState::HALF_OPEN) {
+        probe_in_flight = true;
+    }
+}
+
+/**
+ *  Record a successful send; a successful probe closes the circuit breaker
+ */
+void PeerSendQueue::onSuccess(void) {
+    ++num_sent;
+    probe_in_flight = false;
+    consecutive_failures = 0;
+    if (state != BreakerState::CLOSED) {
+        logger.print(LogLevel::LOG_INFO_0, "peer %s recovered, resume sending\n", name.c_str());
+        state = BreakerState::CLOSED;
+        backoff_in_ms = 0;
+    }
+}
+
+/**
+ *  Record a failed send; the circuit breaker opens after too many consecutive failures or a failed probe
+ */
+void PeerSendQueue::onFailure(void) {
+    ++num_failed;
+    probe_in_flight = false;
+    ++consecutive_failures;
+    logger.print(LogLevel::LOG_ERROR, "error transmitting packet to %s\n", name.c_str());
+    const std::shared_ptr<const RouterConfig> config = ConfigManager::getInstance().get();
+    if (state == BreakerState::HALF_OPEN) {
+        backoff_in_ms = (backoff_in_ms < config->max_backoff_in_ms / 2 ? backoff_in_ms * 2 : config->max_backoff_in_ms);
+        state = BreakerState::OPEN;
+        TimerWheel::getInstance().schedule(probe_timer, backoff_in_ms);
+        logger.print(LogLevel::LOG_WARNING, "peer %s still failing, suspend sending for %u ms\n", name.c_str(), backoff_in_ms);
+    }
+    else if (state == BreakerState::CLOSED && consecutive_failures >= config->failure_threshold) {
+        backoff_in_ms = config->min_backoff_in_ms;
+        state = BreakerState::OPEN;
+        TimerWheel::getInstance().schedule(probe_timer, backoff_in_ms);
+        logger.print(LogLevel::LOG_WARNING, "peer %s failed %u times, suspend sending for %u ms\n", name.c_str(), consecutive_failures, backoff_in_ms);
+    }
+}
+
+/**
+ *  Add a copy of the given packet to the backlog; if the backlog is full, the drop policy of the protocol applies
+ */
+void PeerSendQueue::enqueue(const Entry& entry, const uint8_t* const packet, const unsigned long size, LatencyTracer::Protocol protocol) {
+    const std::shared_ptr<const RouterConfig> config = ConfigManager::getInstance().get();
+    while (backlog.size() >= config->max_backlog && backlog.size() > 0) {
+        ++num_dropped;
+        if (config->drop_policy[(size_t)protocol] == DropPolicy::DROP_NEWEST) {
+            return;
+        }
+        backlog.pop_front();
+    }
+    backlog.push_back(entry);
+    backlog.back().packet.assign(packet, packet + size);
+    if (retry_timer.isScheduled() == false) {
+        TimerWheel::getInstance().schedule(retry_timer, retry_interval_in_ms);
+    }
+}
@@ -0,0 +1,241 @@
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <cstring>
+#include <Logger.hpp>
+#include <SpeedwireByteEncoding.hpp>
+#include <CachedClock.hpp>
+#include <ReadingsPublisher.hpp>
+using namespace libspeedwire;
+
+static Logger logger = Logger("ReadingsPublisher");
+
+
+/**
+ *  Readings publisher
+ *  Publishes the latest decoded emeter and inverter values into a shared memory region with a seqlock per device.
+ */
+
+/**
+ *  Constructor
+ */
+ReadingsPublisher::ReadingsPublisher(void) :
+    region(NULL),
+    fd(-1) {
+}
+
+/**
+ *  Destructor - the region is unmapped, but not unlinked, such that readers keep their mapping
+ */
+ReadingsPublisher::~ReadingsPublisher(void) {
+    close();
+}
+
+/**
+ *  Get the singleton instance
+ */
+ReadingsPublisher& ReadingsPublisher::getInstance(void) {
+    static ReadingsPublisher instance;
+    return instance;
+}
+
+/**
+ *  Create or re-initialize the shared memory region with the given name, e.g. /speedwire-router, and map it
+ */
+bool ReadingsPublisher::open(const std::string& region_name) {
+#ifndef _WIN32
+    close();
+    name = region_name;
+    fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        logger.print(LogLevel::LOG_ERROR, "cannot open shared memory region %s\n", name.c_str());
+        return false;
+    }
+    if (ftruncate(fd, sizeof(SharedReadings::Region)) != 0) {
+        logger.print(LogLevel::LOG_ERROR, "cannot resize shared memory region %s\n", name.c_str());
+        close();
+        return false;
+    }
+    void* addr = mmap(NULL, sizeof(SharedReadings::Region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        logger.print(LogLevel::LOG_ERROR, "cannot map shared memory region %s\n", name.c_str());
+        close();
+        return false;
+    }
+    region = (SharedReadings::Region*)addr;
+
+    // readers check the layout fields before they use the region; invalidate them while it is re-initialized
+    region->magic = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    region->num_devices.store(0, std::memory_order_release);
+    memset((void*)region->devices, 0, sizeof(region->devices));
+    region->version       = SharedReadings::version;
+    region->header_size   = (uint16_t)offsetof(SharedReadings::Region, devices);
+    region->device_size   = sizeof(SharedReadings::Device);
+    region->max_devices   = SharedReadings::max_devices;
+    region->max_values    = SharedReadings::max_values;
+    region->start_time_ms = CachedClock::getEpochTimeInMs();
+    memset(region->reserved, 0, sizeof(region->reserved));
+    std::atomic_thread_fence(std::memory_order_release);
+    region->magic = SharedReadings::magic;
+    device_index.clear();
+    logger.print(LogLevel::LOG_INFO_0, "publishing readings into shared memory region %s\n", name.c_str());
+    return true;
+#else
+    logger.print(LogLevel::LOG_WARNING, "shared memory readings are not supported on this platform\n");
+    return false;
+#endif
+}
+
+/**
+ *  Unmap and close the shared memory region
+ */
+void ReadingsPublisher::close(void) {
+#ifndef _WIN32
+    if (region != NULL) {
+        munmap((void*)region, sizeof(SharedReadings::Region));
+        region = NULL;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+#endif
+}
+
+/**
+ *  Get the slot of the given device; a new slot is assigned for an unknown device. Returns NULL if all slots are in use.
+ */
+SharedReadings::Device* ReadingsPublisher::getDevice(SharedReadings::DeviceType type, uint16_t susyid, uint32_t serial) {
+    const uint64_t key = ((uint64_t)type << 48) | ((uint64_t)susyid << 32) | serial;
+    auto it = device_index.find(key);
+    if (it != device_index.end()) {
+        return &region->devices[it->second];
+    }
+    const uint32_t index = region->num_devices.load(std::memory_order_relaxed);
+    if (index >= SharedReadings::max_devices) {
+        return NULL;
+    }
+    SharedReadings::Device& device = region->devices[index];
+    device.type   = type;
+    device.susyid = susyid;
+    device.serial = serial;
+    region->num_devices.store(index + 1, std::memory_order_release);
+    device_index[key] = index;
+    return &device;
+}
+
+/**
+ *  Begin an update of the given device slot; the sequence number becomes odd
+ */
+void ReadingsPublisher::beginUpdate(SharedReadings::Device& device) {
+    device.sequence.store(device.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+/**
+ *  End an update of the given device slot; the sequence number becomes even
+ */
+void ReadingsPublisher::endUpdate(SharedReadings::Device& device) {
+    device.update_time_ms = CachedClock::getEpochTimeInMs();
+    device.sequence.store(device.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+/**
+ *  Set the value with the given key in the given device slot; a value with a new key is appended if there is space
+ */
+void ReadingsPublisher::setValue(SharedReadings::Device& device, uint32_t key, uint32_t flags, uint64_t value) {
+    for (uint32_t i = 0; i < device.num_values; ++i) {
+        if (device.values[i].key == key) {
+            device.values[i].flags = flags;
+            device.values[i].value = value;
+            return;
+        }
+    }
+    if (device.num_values < SharedReadings::max_values) {
+        SharedReadings::Value& entry = device.values[device.num_values];
+        entry.key   = key;
+        entry.flags = flags;
+        entry.value = value;
+        ++device.num_values;
+    }
+}
+
+/**
+ *  Publish the obis values of the given emeter packet; the values replace all values of the device
+ */
+void ReadingsPublisher::publish(const SpeedwireEmeterProtocol& emeter_packet) {
+    if (region == NULL) {
+        return;
+    }
+    SharedReadings::Device* device = getDevice(SharedReadings::EMETER, emeter_packet.getSusyID(), emeter_packet.getSerialNumber());
+    if (device == NULL) {
+        return;
+    }
+    beginUpdate(*device);
+    uint32_t num_values = 0;
+    for (const void* obis = emeter_packet.getFirstObisElement(); obis != NULL && num_values < SharedReadings::max_values; obis = emeter_packet.getNextObisElement(obis)) {
+        const uint8_t channel = SpeedwireEmeterProtocol::getObisChannel(obis);
+        const uint8_t type    = SpeedwireEmeterProtocol::getObisType(obis);
+        SharedReadings::Value& entry = device->values[num_values++];
+        entry.key   = SharedReadings::getObisKey(channel, SpeedwireEmeterProtocol::getObisIndex(obis), type, SpeedwireEmeterProtocol::getObisTariff(obis));
+        entry.flags = 0;
+        // counter elements of type 8 carry 8 byte values, all other elements including the software version carry 4 byte values
+        entry.value = (type == 8 ? SpeedwireEmeterProtocol::getObisValue8(obis) : SpeedwireEmeterProtocol::getObisValue4(obis));
+    }
+    device->num_values  = num_values;
+    device->device_time = emeter_packet.getTime();
+    endUpdate(*device);
+}
+
+/**
+ *  Publish the register records of the given inverter response packet; the values are merged into the values
+ *  of the device, such that responses to different queries accumulate
+ */
+void ReadingsPublisher::publish(const SpeedwireInverterProtocol& inverter_packet, const SpeedwireHeader& speedwire_packet) {
+    if (region == NULL || ((uint32_t)inverter_packet.getCommandID() & 0xff) == 0x00) {
+        return;
+    }
+
+    // locate the records following the 36 byte inverter header; the record length follows from the number of records
+    const SpeedwireData2Packet data2_packet(speedwire_packet);
+    const unsigned long offset = data2_packet.getPayloadOffset();
+    const unsigned long length = (unsigned long)data2_packet.getTagLength() - 2;
+    if (length < 36 || offset + length > speedwire_packet.getPacketSize()) {
+        return;
+    }
+    const uint8_t* payload = speedwire_packet.getPacketPointer() + offset;
+    const uint16_t error_code = SpeedwireByteEncoding::getUint16LittleEndian(payload + 18);
+    const uint32_t first = inverter_packet.getFirstRegisterID();
+    const uint32_t last  = inverter_packet.getLastRegisterID();
+    if (error_code != 0 || last < first || last - first >= SharedReadings::max_values) {
+        return;
+    }
+    const unsigned long num_records   = last - first + 1;
+    const unsigned long record_length = (length - 36) / num_records;
+    if (record_length < 12 || (record_length & 3) != 0) {
+        return;
+    }
+
+    SharedReadings::Device* device = getDevice(SharedReadings::INVERTER, inverter_packet.getSrcSusyID(), inverter_packet.getSrcSerialNumber());
+    if (device == NULL) {
+        return;
+    }
+    beginUpdate(*device);
+    for (unsigned long i = 0; i < num_records; ++i) {
+        const uint8_t* record = payload + 36 + i * record_length;
+        const uint32_t id   = SpeedwireByteEncoding::getUint32LittleEndian(record);
+        const uint32_t time = SpeedwireByteEncoding::getUint32LittleEndian(record + 4);
+        // 16 byte records hold a 64 bit counter, other records start with a 32 bit value
+        uint64_t value = SpeedwireByteEncoding::getUint32LittleEndian(record + 8);
+        if (record_length == 16) {
+            value |= (uint64_t)SpeedwireByteEncoding::getUint32LittleEndian(record + 12) << 32;
+        }
+        setValue(*device, id & 0x00ffffff, id >> 24, value);
+        device->device_time = time;
+    }
+    endUpdate(*device);
+}
@@ -0,0 +1,286 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <SpeedwireByteEncoding.hpp>
+#include <RouterConfig.hpp>
+using namespace libspeedwire;
+
+static Logger logger = Logger("RouterConfig");
+
+
+/**
+ *  Router configuration
+ *  An immutable snapshot of the configuration, covering peers, interfaces, patch and trim rules, send queue policies
+ *  and buffer sizes. Snapshots are parsed from a simple line-based configuration file of key = value pairs.
+ */
+
+/**
+ *  Patch rule constructor
+ */
+RouterConfig::PatchRule::PatchRule(uint8_t c, uint8_t i, uint8_t ty, uint8_t ta, uint32_t max) :
+    channel(c), index(i), type(ty), tariff(ta), max_value(max) {
+    // define an obis data element with the given maximum value
+    bytes.fill(0);
+    bytes[0] = channel;
+    bytes[1] = index;
+    bytes[2] = type;
+    bytes[3] = tariff;
+    SpeedwireByteEncoding::setUint32BigEndian(&bytes[4], max_value);
+}
+
+/**
+ *  Constructor - the default configuration
+ */
+RouterConfig::RouterConfig(void) :
+    log_level(LogLevel::LOG_ERROR | LogLevel::LOG_WARNING | LogLevel::LOG_INFO_0 | LogLevel::LOG_INFO_1),
+    peers(),
+    interfaces(),
+    patch_rules(),
+    trim_rules(),
+    proxy_ttl_in_ms(0),
+    history_size(16),
+    max_backlog(8),
+    failure_threshold(5),
+    min_backoff_in_ms(1000),
+    max_backoff_in_ms(60000),
+#ifdef SPEEDWIRE_IO_URING
+    io_backend("io_uring"),
+#else
+    io_backend("poll"),
+#endif
+    capture_path(),
+    capture_file_size(16 * 1024 * 1024),
+    capture_file_count(4),
+    storm_source_rate(50),
+    storm_interface_rate(200),
+    storm_release_windows(5),
+    shared_memory() {
+    // emeter and discovery packets are superseded by newer ones, inverter packets are kept in order
+    drop_policy.fill(PeerSendQueue::DropPolicy::DROP_OLDEST);
+    drop_policy[(size_t)LatencyTracer::Protocol::INVERTER]   = PeerSendQueue::DropPolicy::DROP_NEWEST;
+    drop_policy[(size_t)LatencyTracer::Protocol::ENCRYPTION] = PeerSendQueue::DropPolicy::DROP_NEWEST;
+}
+
+/**
+ *  Parse the given configuration file into this configuration; settings not given in the file keep their
+ *  default values. Returns false if the file cannot be read or contains errors.
+ *
+ *      log_level    = error warning info0 info1         # any of error, warning, info0, info1, info2, info3
+ *      peer         = 192.168.182.18                    # repeatable
+ *      interface    = 192.168.1.10                      # repeatable, all interfaces if not given
+ *      patch_limit  = 0:2.4.0 34800                     # channel:index.type.tariff max_value, repeatable
+ *      trim         = 192.168.182.18 0:1.4.0 0:2.4.0    # peer channel:index.type.tariff ..., repeatable
+ *      proxy_ttl    = 5000                              # inverter response cache time-to-live in ms, 0 to disable
+ *      history_size = 16
+ *      backlog_size = 8
+ *      drop_policy  = inverter newest                   # emeter|inverter|encryption|discovery|unknown oldest|newest
+ *      breaker      = 5 1000 60000                      # failure threshold, min and max backoff in ms
+ *      io_backend   = poll                              # io_uring, packet_ring or poll, applied at startup only
+ *      capture      = /tmp/speedwire 16 4               # pcapng file path prefix, file size in MB, number of files
+ *      storm        = 50 200 5                          # bounce drops per second per source and per interface, release seconds
+ *      shared_memory = /speedwire-router                # shm_open name of the readings region, applied at startup only
+ */
+bool RouterConfig::parse(const std::string& path) {
+    std::ifstream file(path);
+    if (file.is_open() == false) {
+        logger.print(LogLevel::LOG_ERROR, "cannot open configuration file %s\n", path.c_str());
+        return false;
+    }
+
+    bool result = true;
+    unsigned line_number = 0;
+    std::string line;
+    while (std::getline(file, line)) {
+        ++line_number;
+
+        // strip comments and split into key and value
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+        size_t equals = line.find('=');
+        std::istringstream key_stream(line.substr(0, equals));
+        std::string key;
+        if (!(key_stream >> key)) {
+            continue;
+        }
+        std::istringstream value(equals != std::string::npos ? line.substr(equals + 1) : std::string());
+
+        bool valid = (equals != std::string::npos);
+        if (valid == false) {
+            // invalid line, reported below
+        }
+        else if (key == "log_level") {
+            log_level = (LogLevel)0;
+            std::string level;
+            while (value >> level) {
+                if      (level == "error")   log_level = log_level | LogLevel::LOG_ERROR;
+                else if (level == "warning") log_level = log_level | LogLevel::LOG_WARNING;
+                else if (level == "info0")   log_level = log_level | LogLevel::LOG_INFO_0;
+                else if (level == "info1")   log_level = log_level | LogLevel::LOG_INFO_1;
+                else if (level == "info2")   log_level = log_level | LogLevel::LOG_INFO_2;
+                else if (level == "info3")   log_level = log_level | LogLevel::LOG_INFO_3;
+                else valid = false;
+            }
+        }
+        else if (key == "peer" || key == "interface") {
+            std::string ip;
+            valid = (bool)(value >> ip);
+            if (valid) {
+                (key == "peer" ? peers : interfaces).push_back(ip);
+            }
+        }
+        else if (key == "patch_limit") {
+            std::string obis;
+            unsigned long max_value = 0;
+            unsigned channel = 0, index = 0, type = 0, tariff = 0;
+            valid = (value >> obis >> max_value) && sscanf(obis.c_str(), "%u:%u.%u.%u", &channel, &index, &type, &tariff) == 4;
+            // only obis elements holding a 4 byte value can be limited
+            if (valid && type == 4 && channel <= 255 && index <= 255 && tariff <= 255 && max_value <= 0xffffffff) {
+                patch_rules.push_back(PatchRule((uint8_t)channel, (uint8_t)index, (uint8_t)type, (uint8_t)tariff, (uint32_t)max_value));
+            }
+            else {
+                valid = false;
+            }
+        }
+        else if (key == "trim") {
+            std::string peer, obis;
+            valid = (bool)(value >> peer);
+            TrimRule rule(peer);
+            while (valid && (value >> obis)) {
+                unsigned channel = 0, index = 0, type = 0, tariff = 0;
+                valid = sscanf(obis.c_str(), "%u:%u.%u.%u", &channel, &index, &type, &tariff) == 4 && channel <= 255 && index <= 255 && type <= 255 && tariff <= 255;
+                std::array<uint8_t, 4> element = { { (uint8_t)channel, (uint8_t)index, (uint8_t)type, (uint8_t)tariff } };
+                rule.obis.push_back(element);
+            }
+            valid = valid && rule.obis.size() > 0;
+            if (valid) {
+                // repeated lines for the same peer extend its rule
+                TrimRule* existing = NULL;
+                for (auto& entry : trim_rules) {
+                    existing = (entry.peer == peer ? &entry : existing);
+                }
+                if (existing != NULL) {
+                    existing->obis.insert(existing->obis.end(), rule.obis.begin(), rule.obis.end());
+                }
+                else {
+                    trim_rules.push_back(rule);
+                }
+            }
+        }
+        else if (key == "proxy_ttl") {
+            unsigned long ttl = 0;
+            valid = (value >> ttl) && ttl <= 3600000;
+            if (valid) {
+                proxy_ttl_in_ms = (uint32_t)ttl;
+            }
+        }
+        else if (key == "history_size" || key == "backlog_size") {
+            unsigned long size = 0;
+            valid = (value >> size) && size > 0 && size <= 4096;
+            if (valid) {
+                (key == "history_size" ? history_size : max_backlog) = size;
+            }
+        }
+        else if (key == "drop_policy") {
+            static const char* const protocols[LatencyTracer::protocol_count] = { "emeter", "inverter", "encryption", "discovery", "unknown" };
+            std::string protocol, policy;
+            valid = (bool)(value >> protocol >> policy) && (policy == "oldest" || policy == "newest");
+            size_t i = 0;
+            while (valid && i < LatencyTracer::protocol_count && protocol != protocols[i]) {
+                ++i;
+            }
+            if (valid && i < LatencyTracer::protocol_count) {
+                drop_policy[i] = (policy == "newest" ? PeerSendQueue::DropPolicy::DROP_NEWEST : PeerSendQueue::DropPolicy::DROP_OLDEST);
+            }
+            else {
+                valid = false;
+            }
+        }
+        else if (key == "breaker") {
+            uint32_t threshold = 0, min_backoff = 0, max_backoff = 0;
+            valid = (value >> threshold >> min_backoff >> max_backoff) && threshold > 0 && min_backoff > 0 && max_backoff >= min_backoff;
+            if (valid) {
+                failure_threshold = threshold;
+                min_backoff_in_ms = min_backoff;
+                max_backoff_in_ms = max_backoff;
+            }
+        }
+        else if (key == "io_backend") {
+            valid = (bool)(value >> io_backend) && (io_backend == "io_uring" || io_backend == "packet_ring" || io_backend == "poll");
+        }
+        else if (key == "capture") {
+            unsigned long size_in_mb = 0, count = 0;
+            valid = (value >> capture_path >> size_in_mb >> count) && size_in_mb > 0 && size_in_mb <= 4096 && count > 0 && count <= 1000;
+            if (valid) {
+                capture_file_size  = (uint64_t)size_in_mb * 1024 * 1024;
+                capture_file_count = (unsigned)count;
+            }
+        }
+        else if (key == "storm") {
+            uint32_t source_rate = 0, interface_rate = 0, release_windows = 0;
+            valid = (value >> source_rate >> interface_rate >> release_windows) && release_windows > 0;
+            if (valid) {
+                storm_source_rate     = source_rate;
+                storm_interface_rate  = interface_rate;
+                storm_release_windows = release_windows;
+            }
+        }
+        else if (key == "shared_memory") {
+            valid = (value >> shared_memory) && shared_memory.size() > 1 && shared_memory[0] == '/' && shared_memory.find('/', 1) == std::string::npos;
+        }
+        else {
+            logger.print(LogLevel::LOG_ERROR, "%s:%u: unknown key %s\n", path.c_str(), line_number, key.c_str());
+            result = false;
+            continue;
+        }
+
+        // trailing garbage is an error as well
+        std::string trailing;
+        if (valid == false || (value >> trailing)) {
+            logger.print(LogLevel::LOG_ERROR, "%s:%u: invalid value for %s\n", path.c_str(), line_number, key.c_str());
+            result = false;
+        }
+    }
+    return result;
+}
+
+/**
+ *  Check if the given ip address is a configured peer
+ */
+bool RouterConfig::isPeer(const std::string& ip) const {
+    for (const auto& peer : peers) {
+        if (peer == ip) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ *  Find the trim rule of the given peer; returns NULL if emeter packets are forwarded to the peer untrimmed
+ */
+const RouterConfig::TrimRule* RouterConfig::findTrimRule(const std::string& peer_ip) const {
+    for (const auto& rule : trim_rules) {
+        if (rule.peer == peer_ip) {
+            return &rule;
+        }
+    }
+    return NULL;
+}
+
+/**
+ *  Check if packets are forwarded to the given local interface; if no interfaces are configured, all are enabled
+ */
+bool RouterConfig::isInterfaceEnabled(const std::string& ip) const {
+    if (interfaces.size() == 0) {
+        return true;
+    }
+    for (const auto& entry : interfaces) {
+        if (entry == ip) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -7,6 +7,12 @@
 #include <SpeedwireSocketFactory.hpp>
 #include <ObisData.hpp>
 #include <Logger.hpp>
+#include <CachedClock.hpp>
+#include <ConfigManager.hpp>
+#include <InterfaceTable.hpp>
+#include <PacketCapture.hpp>
+#include <ReadingsPublisher.hpp>
+#include <StormDetector.hpp>
 using namespace libspeedwire;
 
 static Logger logger = Logger("EmeterPacketReceiver");
@@ -23,7 +29,8 @@ EmeterPacketReceiver::EmeterPacketReceiver(LocalHost& host, std::vector<Speedwir
   : EmeterPacketReceiverBase(host),
     senders(sender),
     bounceDetector(),
-    packetPatcher() {
+    packetPatcher(),
+    tracer(LatencyTracer::getInstance()) {
     protocolID = SpeedwireData2Packet::sma_emeter_protocol_id;
 }
 
@@ -32,6 +39,10 @@ EmeterPacketReceiver::EmeterPacketReceiver(LocalHost& host, std::vector<Speedwir
  */
 void EmeterPacketReceiver::receive(SpeedwireHeader& speedwire_packet, struct sockaddr& src) {
 
+    // take the configuration snapshot once for the whole packet
+    const std::shared_ptr<const RouterConfig> config = ConfigManager::getInstance().get();
+    bounceDetector.setHistorySize(config->history_size);
+
     // check if it is a valid data2 packet
     if (speedwire_packet.isValidData2Packet()) {
         const SpeedwireData2Packet data2_packet(speedwire_packet);
@@ -50,13 +61,23 @@ void EmeterPacketReceiver::receive(SpeedwireHeader& speedwire_packet, struct soc
             // perform some simple multicast bounce back prevention
             if (bounceDetector.isBouncedPacket(emeter_packet, src) == true) {
                 logger.print(LogLevel::LOG_INFO_1, "received bounced emeter packet from %s susyid %u serial %lu time %lu => DROPPED\n", AddressConversion::toString(src).c_str(), susyid, serial, timer);
+                PacketCapture::getInstance().dropped(PacketCapture::DropReason::BOUNCED, src, speedwire_packet.getPacketPointer(), speedwire_packet.getPacketSize(), tracer.getLastTimeNs());
+                StormDetector::getInstance().bounced(src);
                 return;
             }
             bounceDetector.receive(emeter_packet, src);
+            tracer.mark(LatencyTracer::Stage::BOUNCE_CHECK);
             logger.print(LogLevel::LOG_INFO_1, "received emeter packet from %s susyid %u serial %lu time %lu\n", AddressConversion::toString(src).c_str(), susyid, serial, timer);
 
+            // publish the unpatched readings to local consumers
+            ReadingsPublisher& publisher = ReadingsPublisher::getInstance();
+            if (publisher.isOpen() == true) {
+                publisher.publish(emeter_packet);
+            }
+
             // patch packet if required
-            packetPatcher.patch(speedwire_packet, src);
+            packetPatcher.patch(speedwire_packet, src, *config);
+            tracer.mark(LatencyTracer::Stage::PATCH);
 
             // loop across obis data in the emeter packet
             //for (void* obis = emeter_packet.getFirstObisElement(); obis != NULL; obis = emeter_packet.getNextObisElement(obis)) {
@@ -80,15 +101,31 @@ InverterPacketReceiver::InverterPacketReceiver(LocalHost& host, std::vector<Spee
     localHost(host),
     senders(sender),
     bounceDetector(),
-    packetPatcher() {
+    packetPatcher(),
+    queryCache(TimerWheel::getInstance()),
+    proxyMode(false),
+    tracer(LatencyTracer::getInstance()) {
     protocolID = SpeedwireData2Packet::sma_inverter_protocol_id;
 }
 
+/**
+ *  Enable proxy mode - repeated inverter queries are answered from a response cache with the given time-to-live
+ *  and identical in-flight queries are coalesced into a single upstream query
+ */
+void InverterPacketReceiver::enableProxyMode(uint32_t ttl_in_ms) {
+    queryCache.setTimeToLive(ttl_in_ms);
+    proxyMode = true;
+}
+
 /**
  *  Receive method - can be called with arbitrary speedwire packets
  */
 void InverterPacketReceiver::receive(SpeedwireHeader& speedwire_packet, struct sockaddr& src) {
 
+    // take the configuration snapshot once for the whole packet
+    const std::shared_ptr<const RouterConfig> config = ConfigManager::getInstance().get();
+    bounceDetector.setHistorySize(config->history_size);
+
     // check if it is a valid data2 packet
     if (speedwire_packet.isValidData2Packet()) {
         const SpeedwireData2Packet data2_packet(speedwire_packet);
@@ -102,19 +139,56 @@ void InverterPacketReceiver::receive(SpeedwireHeader& speedwire_packet, struct s
 
             uint16_t susyid = inverter_packet.getSrcSusyID();
             uint32_t serial = inverter_packet.getSrcSerialNumber();
-            uint32_t timer  = (uint32_t)LocalHost::getUnixEpochTimeInMs();
+            uint32_t timer  = (uint32_t)CachedClock::getTimeInMs();
 
             // perform some simple multicast bounce back prevention
             if (bounceDetector.isBouncedPacket(inverter_packet, src) == true) {
                 logger.print(LogLevel::LOG_INFO_1, "received bounced inverter packet from %s susyid %u serial %lu time %lu => DROPPED\n", AddressConversion::toString(src).c_str(), susyid, serial, timer);
+                PacketCapture::getInstance().dropped(PacketCapture::DropReason::BOUNCED, src, speedwire_packet.getPacketPointer(), speedwire_packet.getPacketSize(), tracer.getLastTimeNs());
+                StormDetector::getInstance().bounced(src);
                 return;
             }
             bounceDetector.receive(inverter_packet, src);
+            tracer.mark(LatencyTracer::Stage::BOUNCE_CHECK);
             std::string reqresp = (((uint32_t)inverter_packet.getCommandID() & 0xff) == 0x00 ? "request" : "response");
             logger.print(LogLevel::LOG_INFO_1, "received inverter %s packet from %s susyid %u serial %lu time %lu\n", reqresp.c_str(), AddressConversion::toString(src).c_str(), susyid, serial, timer);
             std::string istr = inverter_packet.toString();
             logger.print(LogLevel::LOG_INFO_1, "%s\n", istr.c_str());
 
+            // publish the readings of responses to local consumers
+            ReadingsPublisher& publisher = ReadingsPublisher::getInstance();
+            if (publisher.isOpen() == true) {
+                publisher.publish(inverter_packet, speedwire_packet);
+            }
+
+            // in proxy mode, answer repeated queries from the cache and coalesce identical in-flight queries
+            if (proxyMode == true) {
+                if (((uint32_t)inverter_packet.getCommandID() & 0xff) == 0x00) {
+                    std::vector<uint8_t> response;
+                    InverterQueryCache::Result result = queryCache.request(inverter_packet, src, timer, response);
+                    if (result == InverterQueryCache::Result::CACHED) {
+                        logger.print(LogLevel::LOG_INFO_1, "answer inverter request from %s from cache\n", AddressConversion::toString(src).c_str());
+                        sendToRequester(response, src);
+                        return;
+                    }
+                    if (result == InverterQueryCache::Result::COALESCED) {
+                        logger.print(LogLevel::LOG_INFO_1, "coalesced inverter request from %s with in-flight request\n", AddressConversion::toString(src).c_str());
+                        return;
+                    }
+                }
+                else {
+                    std::vector<InverterQueryCache::Requester> waiters;
+                    if (queryCache.response(inverter_packet, speedwire_packet, timer, waiters) == true) {
+                        for (const auto& waiter : waiters) {
+                            std::vector<uint8_t> response(speedwire_packet.getPacketPointer(), speedwire_packet.getPacketPointer() + speedwire_packet.getPacketSize());
+                            InverterQueryCache::rewrite(response, waiter);
+                            logger.print(LogLevel::LOG_INFO_1, "answer coalesced inverter request from %s\n", AddressConversion::toString(waiter.src).c_str());
+                            sendToRequester(response, waiter.src);
+                        }
+                    }
+                }
+            }
+
 #if 0
             // check if it is a broadcast request packet from a node on a different subnet
             if (inverter_packet.getDstSusyID() == 0xffff && inverter_packet.getDstSerialNumber() == 0xffffffff && (inverter_packet.getCommandID() & 0xff) == 0x00) {
@@ -136,7 +210,8 @@ void InverterPacketReceiver::receive(SpeedwireHeader& speedwire_packet, struct s
             }
 #endif
             // patch packet if required
-            packetPatcher.patch(speedwire_packet, src);
+            packetPatcher.patch(speedwire_packet, src, *config);
+            tracer.mark(LatencyTracer::Stage::PATCH);
 
             // forward the emeter packet to all registered producers
             for (auto& sender : senders) {
@@ -150,21 +225,25 @@ void InverterPacketReceiver::receive(SpeedwireHeader& speedwire_packet, struct s
             uint8_t  type   = encryption_packet.getPacketType();
             uint16_t susyid = encryption_packet.getSrcSusyID();
             uint32_t serial = encryption_packet.getSrcSerialNumber();
-            uint32_t timer  = (uint32_t)LocalHost::getUnixEpochTimeInMs();
+            uint32_t timer  = (uint32_t)CachedClock::getTimeInMs();
 
             // perform some simple multicast bounce back prevention
             if (bounceDetector.isBouncedPacket(encryption_packet, src) == true) {
                 logger.print(LogLevel::LOG_INFO_1, "received bounced encryption packet from %s susyid %u serial %lu time %lu => DROPPED\n", AddressConversion::toString(src).c_str(), susyid, serial, timer);
+                PacketCapture::getInstance().dropped(PacketCapture::DropReason::BOUNCED, src, speedwire_packet.getPacketPointer(), speedwire_packet.getPacketSize(), tracer.getLastTimeNs());
+                StormDetector::getInstance().bounced(src);
                 return;
             }
             bounceDetector.receive(encryption_packet, src);
+            tracer.mark(LatencyTracer::Stage::BOUNCE_CHECK);
             std::string reqresp = (type == 0x01 ? "request" : (type == 0x02 ? "response" : "unknown"));
             logger.print(LogLevel::LOG_INFO_1, "received encryption %s packet from %s susyid %u serial %lu time %lu\n", reqresp.c_str(), AddressConversion::toString(src).c_str(), susyid, serial, timer);
             std::string istr = encryption_packet.toString();
             logger.print(LogLevel::LOG_INFO_1, "%s\n", istr.c_str());
 
             // patch packet if required
-            packetPatcher.patch(speedwire_packet, src);
+            packetPatcher.patch(speedwire_packet, src, *config);
+            tracer.mark(LatencyTracer::Stage::PATCH);
 
             // forward the emeter packet to all registered producers
             for (auto& sender : senders) {
@@ -213,6 +292,31 @@ void InverterPacketReceiver::receive(SpeedwireHeader& speedwire_packet, struct s
 }
 
 
+/**
+ *  Send a locally generated inverter response as a unicast packet to the given requester
+ */
+void InverterPacketReceiver::sendToRequester(const std::vector<uint8_t>& packet, const struct sockaddr& dst) {
+    if (dst.sa_family != AF_INET) {
+        return;
+    }
+    struct in_addr dst_addr = AddressConversion::toSockAddrIn(dst).sin_addr;
+
+    // try to find the local interface to reach the requester; fall back to the first local interface
+    const InterfaceTable& interface_table = InterfaceTable::getInstance();
+    if (interface_table.getIPv4Addresses().size() == 0) {
+        return;
+    }
+    std::string interface_ip = interface_table.findInterface(dst_addr);
+    if (interface_ip.length() == 0) {
+        interface_ip = interface_table.getIPv4Addresses()[0];
+    }
+
+    // send through the send queue of the requester, such that a slow requester cannot block the receive path
+    const SpeedwireHeader speedwire_packet(packet.data(), (unsigned long)packet.size());
+    ReplyPacketSender::getSender(localHost, interface_ip, AddressConversion::toString(dst_addr)).reply(speedwire_packet, dst);
+}
+
+
 /**
  *  Constructor
  */
@@ -221,7 +325,8 @@ DiscoveryPacketReceiver::DiscoveryPacketReceiver(LocalHost& host, std::vector<Sp
     localHost(host),
     senders(sender),
     bounceDetector(),
-    packetPatcher() {
+    packetPatcher(),
+    tracer(LatencyTracer::getInstance()) {
     protocolID = 0x0000;
 }
 
@@ -230,6 +335,10 @@ DiscoveryPacketReceiver::DiscoveryPacketReceiver(LocalHost& host, std::vector<Sp
  */
 void DiscoveryPacketReceiver::receive(SpeedwireHeader& speedwire_packet, struct sockaddr& src) {
 
+    // take the configuration snapshot once for the whole packet
+    const std::shared_ptr<const RouterConfig> config = ConfigManager::getInstance().get();
+    bounceDetector.setHistorySize(config->history_size);
+
     // check if it is a valid discovery packet
     if (speedwire_packet.isValidDiscoveryPacket()) {
 
@@ -240,12 +349,15 @@ void DiscoveryPacketReceiver::receive(SpeedwireHeader& speedwire_packet, struct
         std::string reqresp = (is_discovery_request ? "request" : (is_discovery_response ? "response" : ""));
 
         // perform some simple multicast bounce back prevention
-        uint32_t timer = (uint32_t)LocalHost::getUnixEpochTimeInMs();
+        uint32_t timer = (uint32_t)CachedClock::getTimeInMs();
         if (bounceDetector.isBouncedPacket(speedwire_packet, src) == true) {
             logger.print(LogLevel::LOG_INFO_1, "received bounced discovery %s packet from %s time %lu => DROPPED\n", reqresp.c_str(), AddressConversion::toString(src).c_str(), timer);
+            PacketCapture::getInstance().dropped(PacketCapture::DropReason::BOUNCED, src, speedwire_packet.getPacketPointer(), speedwire_packet.getPacketSize(), tracer.getLastTimeNs());
+            StormDetector::getInstance().bounced(src);
             return;
         }
         bounceDetector.receive(speedwire_packet, src);
+        tracer.mark(LatencyTracer::Stage::BOUNCE_CHECK);
         logger.print(LogLevel::LOG_INFO_1, "received discovery %s packet from %s time %lu\n", reqresp.c_str(), AddressConversion::toString(src).c_str(), timer);
 
         // forward the discovery request packet to all registered producers
@@ -259,25 +371,15 @@ void DiscoveryPacketReceiver::receive(SpeedwireHeader& speedwire_packet, struct
         if (is_discovery_response) {
             const BounceDetector::History& history = bounceDetector.getHistory();
             for (const auto& entry : history) {
-                if (entry.packet_type == BounceDetector::PacketType::DISCOVERY_REQUEST &&
-                    SpeedwireTime::calculateAbsTimeDifference(entry.create_time, (uint32_t)LocalHost::getUnixEpochTimeInMs()) <= 1000) {
+                if (entry.packet_type == BounceDetector::PacketType::DISCOVERY_REQUEST) {
                     struct in_addr entry_addr = AddressConversion::toSockAddrIn(entry.src_ip).sin_addr;
 
                     // try to find the local interface to reach the requester
-                    const std::vector<std::string> &if_addresses = localHost.getLocalIPv4Addresses();
-                    for (const auto& local_interface_ip : if_addresses) {
-                        uint32_t prefix = localHost.getInterfacePrefixLength(local_interface_ip);
-                        if (AddressConversion::resideOnSameSubnet(entry_addr, AddressConversion::toInAddress(local_interface_ip), prefix)) {
-
-                            // forward the discovery response as a unicast packet to the given unicast peer ip address
-                            SpeedwireSocket socket = SpeedwireSocketFactory::getInstance(localHost)->getSendSocket(SpeedwireSocketFactory::SocketType::UNICAST, local_interface_ip);
-                            logger.print(LogLevel::LOG_INFO_1, "forward discovery response packet to unicast host %s (via interface %s)\n",
-                                AddressConversion::toString(entry.src_ip).c_str(), socket.getLocalInterfaceAddress().c_str());
-                            int nbytes = socket.sendto(speedwire_packet.getPacketPointer(), speedwire_packet.getPacketSize(), entry.src_ip);
-                            if (nbytes != speedwire_packet.getPacketSize()) {
-                                logger.print(LogLevel::LOG_ERROR, "error transmitting unicast packet to %s\n", local_interface_ip.c_str());
-                            }
-                        }
+                    const std::string local_interface_ip = InterfaceTable::getInstance().findInterface(entry_addr);
+                    if (local_interface_ip.length() > 0) {
+
+                        // forward the discovery response as a unicast packet through the send queue of the requester
+                        ReplyPacketSender::getSender(localHost, local_interface_ip, AddressConversion::toString(entry_addr)).reply(speedwire_packet, entry.src_ip);
                     }
                 }
             }
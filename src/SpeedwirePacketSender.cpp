@@ -1,3 +1,9 @@
+#ifdef _WIN32
+#include <Winsock2.h>
+#else
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 #include <memory.h>
 #include <LocalHost.hpp>
 #include <AddressConversion.hpp>
@@ -5,16 +11,26 @@
 #include <SpeedwirePacketSender.hpp>
 #include <SpeedwireSocketFactory.hpp>
 #include <SpeedwireSocket.hpp>
+#include <ConfigManager.hpp>
+#include <CachedClock.hpp>
+#include <TimerWheel.hpp>
+#include <PacketCapture.hpp>
+#include <PacketDispatcher.hpp>
 using namespace libspeedwire;
 
 static Logger logger = Logger("SpeedwirePacketSender");
 
+SpeedwirePacketSender::ITransport* SpeedwirePacketSender::transport = NULL;
+PacketDispatcher* UnicastPacketSender::dispatcher = NULL;
+std::map<std::string, ReplyPacketSender*> ReplyPacketSender::instances;
+
 
 /**
  *  Speedwire packet sender base class
  */
 SpeedwirePacketSender::SpeedwirePacketSender(const LocalHost& _localhost, const std::string& _local_interface_ip, const std::string& _peer_ip) :
-    local_host(_localhost), local_interface_ip(_local_interface_ip), peer_ip(_peer_ip) {
+    local_host(_localhost), local_interface_ip(_local_interface_ip), peer_ip(_peer_ip), tracer(LatencyTracer::getInstance()),
+    send_queue(_peer_ip + " via " + _local_interface_ip) {
 
     memset(&local_interface_in_addr,  0, sizeof(local_interface_in_addr));
     memset(&local_interface_in6_addr, 0, sizeof(local_interface_in6_addr));
@@ -35,6 +51,63 @@ SpeedwirePacketSender::SpeedwirePacketSender(const LocalHost& _localhost, const
         is_ipv6 = false;
     }
     local_interface_prefix_length = local_host.getInterfacePrefixLength(local_interface_ip);
+    trace_id = tracer.registerDestination(peer_ip + " via " + local_interface_ip);
+
+    // the send socket of the interface is shared by all senders on the interface and must not block any of them
+    if (transport == NULL) {
+        PeerSendQueue::setNonBlocking((int)SpeedwireSocketFactory::getInstance(local_host)->getSendSocket(SpeedwireSocketFactory::SocketType::UNICAST, local_interface_ip).getSocketFd());
+    }
+}
+
+/**
+ *  Transmit the given packet through the send queue of this sender; if dest is NULL, the packet is sent
+ *  to the speedwire multicast address. If a transport replaces the speedwire sockets, the packet is handed
+ *  to the transport instead.
+ */
+void SpeedwirePacketSender::transmit(const SpeedwireHeader& packet, const struct sockaddr* const dest) {
+    unsigned long size = 0;
+    const uint8_t* buffer = getSendBuffer(packet, size);
+    if (transport != NULL) {
+        transport->send(*this, buffer, size, dest);
+        tracer.sent(trace_id);
+        PacketCapture::getInstance().forwarded(local_interface_ip, dest, buffer, size, tracer.getLastTimeNs());
+        return;
+    }
+    SpeedwireSocket socket = SpeedwireSocketFactory::getInstance(local_host)->getSendSocket(SpeedwireSocketFactory::SocketType::UNICAST, local_interface_ip);
+    PeerSendQueue::Result result = send_queue.send(socket, buffer, size, dest, PeerSendQueue::getProtocol(packet));
+    if (result == PeerSendQueue::Result::SENT) {
+        tracer.sent(trace_id);
+    }
+
+    // mirror the bytes actually handed to the send queue, including patched or trimmed content; a full backlog
+    // drops the oldest packet or this one, depending on the drop policy
+    PacketCapture& capture = PacketCapture::getInstance();
+    if (capture.isEnabled()) {
+        PacketCapture::DropReason reason = PacketCapture::DropReason::NONE;
+        switch (result) {
+        case PeerSendQueue::Result::DROPPED: reason = PacketCapture::DropReason::BACKLOG_FULL; break;
+        case PeerSendQueue::Result::BLOCKED: reason = PacketCapture::DropReason::CIRCUIT_OPEN; break;
+        case PeerSendQueue::Result::FAILED:  reason = PacketCapture::DropReason::SEND_FAILED;  break;
+        default: break;
+        }
+        capture.forwarded(local_interface_ip, dest, buffer, size, tracer.getLastTimeNs(), reason);
+    }
+}
+
+/**
+ *  Get the bytes to transmit for the given packet; if an obis allow-list is configured, emeter packets
+ *  are trimmed into the trim buffer of this sender
+ */
+const uint8_t* SpeedwirePacketSender::getSendBuffer(const SpeedwireHeader& packet, unsigned long& size) {
+    if (emeter_trimmer.isEnabled()) {
+        unsigned long trimmed_size = emeter_trimmer.trim(packet, trim_buffer.data(), (unsigned long)trim_buffer.size());
+        if (trimmed_size > 0) {
+            size = trimmed_size;
+            return trim_buffer.data();
+        }
+    }
+    size = packet.getPacketSize();
+    return packet.getPacketPointer();
 }
 
 
@@ -50,6 +123,11 @@ MulticastPacketSender::MulticastPacketSender(const LocalHost& localhost, const s
 void MulticastPacketSender::send(SpeedwireHeader& packet, const struct sockaddr& src) {
     bool forward = false;
 
+    // check if forwarding to the local interface is enabled by the configuration
+    if (ConfigManager::getInstance().get()->isInterfaceEnabled(local_interface_ip) == false) {
+        return;
+    }
+
     // if it is an IPv4 packet and the local interface is also IPv4
     if (src.sa_family == AF_INET && is_ipv4 == true) {
         // if the multicast packet was sent by a host on a different subnet
@@ -63,15 +141,10 @@ void MulticastPacketSender::send(SpeedwireHeader& packet, const struct sockaddr&
 
     // forward the packet as a multicast packet
     if (forward == true) {
-        //SpeedwireSocket socket = SpeedwireSocketFactory::getInstance(local_host)->getSendSocket(SpeedwireSocketFactory::SocketType::MULTICAST, local_interface_ip);
-        SpeedwireSocket socket = SpeedwireSocketFactory::getInstance(local_host)->getSendSocket(SpeedwireSocketFactory::SocketType::UNICAST, local_interface_ip);
         //char loop = 0;
         //int result1 = setsockopt(socket.getSocketFd(), IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
-        logger.print(LogLevel::LOG_INFO_1, "forward emeter packet to speedwire multicast address (via interface %s)\n", socket.getLocalInterfaceAddress().c_str());
-        int nbytes = socket.send(packet.getPacketPointer(), packet.getPacketSize());
-        if (nbytes != packet.getPacketSize()) {
-            logger.print(LogLevel::LOG_ERROR, "error transmitting multicast packet to %s\n", local_interface_ip.c_str());
-        }
+        logger.print(LogLevel::LOG_INFO_1, "forward emeter packet to speedwire multicast address (via interface %s)\n", local_interface_ip.c_str());
+        transmit(packet, NULL);
     }
 }
 
@@ -79,10 +152,91 @@ void MulticastPacketSender::send(SpeedwireHeader& packet, const struct sockaddr&
 // ====================================================================================================
 
 /**
- *  Speedwire packet sender class for multicast packets
+ *  Speedwire packet sender class for unicast packets
  */
 UnicastPacketSender::UnicastPacketSender(const LocalHost& localhost, const std::string& local_interface, const std::string& peer_ip) :
-    SpeedwirePacketSender(localhost, local_interface, peer_ip) {
+    SpeedwirePacketSender(localhost, local_interface, peer_ip),
+    peer_fd(-1) {
+
+    // without a dispatcher, answers arriving on a connected socket could not be received
+    if (transport == NULL && dispatcher != NULL) {
+        peer_fd = openPeerSocket();
+    }
+    if (peer_fd >= 0) {
+        SpeedwireSocket& interface_socket = SpeedwireSocketFactory::getInstance(local_host)->getSendSocket(SpeedwireSocketFactory::SocketType::UNICAST, local_interface_ip);
+        dispatcher->addPeerSocket(peer_fd, interface_socket, [this](void) { send_queue.onPeerError(); });
+        send_queue.setPeerSocket(peer_fd);
+    }
+}
+
+/**
+ *  Destructor - the connected socket of the peer is removed from the dispatcher and closed
+ */
+UnicastPacketSender::~UnicastPacketSender(void) {
+    if (peer_fd >= 0) {
+        if (dispatcher != NULL) {
+            dispatcher->removePeerSocket(peer_fd);
+        }
+#ifdef _WIN32
+        closesocket(peer_fd);
+#else
+        close(peer_fd);
+#endif
+    }
+}
+
+/**
+ *  Open a non-blocking socket connected to the peer; the speedwire port is kept as source port if possible, such
+ *  that peers answer to the usual port, otherwise an ephemeral port is used. Returns -1 on failure, in which case
+ *  packets are sent on the shared socket of the interface.
+ */
+int UnicastPacketSender::openPeerSocket(void) {
+    struct sockaddr_in6 local, peer;    // large enough for ipv4 and ipv6 addresses
+    memset(&local, 0, sizeof(local));
+    memset(&peer,  0, sizeof(peer));
+    socklen_t length = 0;
+    if (is_ipv4 == true && AddressConversion::isIpv4(peer_ip)) {
+        struct sockaddr_in& local4 = *(struct sockaddr_in*)&local;
+        struct sockaddr_in& peer4  = *(struct sockaddr_in*)&peer;
+        local4.sin_family = peer4.sin_family = AF_INET;
+        local4.sin_addr = local_interface_in_addr;
+        peer4.sin_addr  = AddressConversion::toInAddress(peer_ip);
+        local4.sin_port = peer4.sin_port = htons(SpeedwireSocket::speedwire_port_9522);
+        length = sizeof(struct sockaddr_in);
+    }
+    else if (is_ipv6 == true && AddressConversion::isIpv6(peer_ip)) {
+        local.sin6_family = peer.sin6_family = AF_INET6;
+        local.sin6_addr = local_interface_in6_addr;
+        peer.sin6_addr  = AddressConversion::toIn6Address(peer_ip);
+        local.sin6_port = peer.sin6_port = htons(SpeedwireSocket::speedwire_port_9522);
+        length = sizeof(struct sockaddr_in6);
+    }
+    else {
+        return -1;
+    }
+
+    int fd = (int)::socket(local.sin6_family, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        logger.print(LogLevel::LOG_ERROR, "cannot open socket for peer %s\n", peer_ip.c_str());
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+    bool bound = (bind(fd, (struct sockaddr*)&local, length) == 0);
+    if (bound == false) {
+        local.sin6_port = 0;    // same offset for sockaddr_in and sockaddr_in6
+        bound = (bind(fd, (struct sockaddr*)&local, length) == 0);
+    }
+    if (bound == false || connect(fd, (struct sockaddr*)&peer, length) != 0 || PeerSendQueue::setNonBlocking(fd) == false) {
+        logger.print(LogLevel::LOG_ERROR, "cannot connect socket to peer %s (via interface %s), use the interface socket\n", peer_ip.c_str(), local_interface_ip.c_str());
+#ifdef _WIN32
+        closesocket(fd);
+#else
+        close(fd);
+#endif
+        return -1;
+    }
+    return fd;
 }
 
 void UnicastPacketSender::send(SpeedwireHeader& packet, const struct sockaddr& src) {
@@ -96,16 +250,12 @@ void UnicastPacketSender::send(SpeedwireHeader& packet, const struct sockaddr& s
 
         if (AddressConversion::resideOnSameSubnet(src_in.sin_addr, peer, local_interface_prefix_length) == false) {
             // forward the packet as a unicast packet to the given unicast peer ip address
-            SpeedwireSocket socket = SpeedwireSocketFactory::getInstance(local_host)->getSendSocket(SpeedwireSocketFactory::SocketType::UNICAST, local_interface_ip);
             sockaddr_in sockaddr;
             sockaddr.sin_family = AF_INET;
             sockaddr.sin_addr = peer;
             sockaddr.sin_port = htons(SpeedwireSocket::speedwire_port_9522);
-            logger.print(LogLevel::LOG_INFO_1, "forward speedwire packet to unicast host %s (via interface %s)\n", peer_ip.c_str(), socket.getLocalInterfaceAddress().c_str());
-            int nbytes = socket.sendto(packet.getPacketPointer(), packet.getPacketSize(), sockaddr);
-            if (nbytes != packet.getPacketSize()) {
-                logger.print(LogLevel::LOG_ERROR, "error transmitting unicast packet to %s\n", local_interface_ip.c_str());
-            }
+            logger.print(LogLevel::LOG_INFO_1, "forward speedwire packet to unicast host %s (via interface %s)\n", peer_ip.c_str(), local_interface_ip.c_str());
+            transmit(packet, (const struct sockaddr*)&sockaddr);
         }
     }
     // if it is an IPv6 packet
@@ -117,16 +267,98 @@ void UnicastPacketSender::send(SpeedwireHeader& packet, const struct sockaddr& s
 
         if (AddressConversion::resideOnSameSubnet(src_in.sin6_addr, peer, local_interface_prefix_length) == false) {
             // forward the packet as a unicast packet to the given unicast peer ip address
-            SpeedwireSocket socket = SpeedwireSocketFactory::getInstance(local_host)->getSendSocket(SpeedwireSocketFactory::SocketType::UNICAST, local_interface_ip);
             struct sockaddr_in6 sockaddr;
             sockaddr.sin6_family = AF_INET6;
             sockaddr.sin6_addr = peer;
             sockaddr.sin6_port = htons(SpeedwireSocket::speedwire_port_9522);
-            logger.print(LogLevel::LOG_INFO_1, "forward speedwire packet to unicast host %s (via interface %s)\n", peer_ip.c_str(), socket.getLocalInterfaceAddress().c_str());
-            int nbytes = socket.sendto(packet.getPacketPointer(), packet.getPacketSize(), sockaddr);
-            if (nbytes != packet.getPacketSize()) {
-                logger.print(LogLevel::LOG_ERROR, "error transmitting unicast packet to %s\n", local_interface_ip.c_str());
-            }
+            logger.print(LogLevel::LOG_INFO_1, "forward speedwire packet to unicast host %s (via interface %s)\n", peer_ip.c_str(), local_interface_ip.c_str());
+            transmit(packet, (const struct sockaddr*)&sockaddr);
+        }
+    }
+}
+
+
+// ====================================================================================================
+
+/**
+ *  Speedwire packet sender class for unicast answers to a requester
+ */
+ReplyPacketSender::ReplyPacketSender(const LocalHost& localhost, const std::string& local_interface, const std::string& requester_ip) :
+    SpeedwirePacketSender(localhost, local_interface, requester_ip),
+    last_used_in_ms(CachedClock::getTimeInMs()) {
+}
+
+/**
+ *  Get the timer removing idle senders; it is created after the timer wheel, such that it is destroyed before it
+ */
+static TimerWheel::Timer& getIdleTimer(void) {
+    TimerWheel::getInstance();
+    static TimerWheel::Timer idle_timer;
+    return idle_timer;
+}
+
+/**
+ *  Get the sender for the given requester via the given local interface; the sender is created on first use,
+ *  such that all answers to a requester share its send queue and circuit breaker
+ */
+ReplyPacketSender& ReplyPacketSender::getSender(const LocalHost& localhost, const std::string& local_interface, const std::string& requester_ip) {
+    const std::string key = requester_ip + " via " + local_interface;
+    auto it = instances.find(key);
+    if (it != instances.end()) {
+        it->second->last_used_in_ms = CachedClock::getTimeInMs();
+        return *it->second;
+    }
+    ReplyPacketSender* sender = new ReplyPacketSender(localhost, local_interface, requester_ip);
+    instances[key] = sender;
+    TimerWheel::Timer& idle_timer = getIdleTimer();
+    if (idle_timer.isScheduled() == false) {
+        idle_timer.setCallback(&ReplyPacketSender::expireIdleSenders);
+        TimerWheel::getInstance().schedule(idle_timer, idle_timeout_in_ms);
+    }
+    return *sender;
+}
+
+/**
+ *  Timer callback - remove the senders of requesters that have not been answered for idle_timeout_in_ms; senders
+ *  still holding a backlog are kept until it has been sent
+ */
+void ReplyPacketSender::expireIdleSenders(void) {
+    const uint64_t now = CachedClock::getTimeInMs();
+    for (auto it = instances.begin(); it != instances.end(); ) {
+        ReplyPacketSender* sender = it->second;
+        if (now - sender->last_used_in_ms >= idle_timeout_in_ms && sender->send_queue.hasBacklog() == false) {
+            logger.print(LogLevel::LOG_INFO_1, "removed idle requester %s\n", it->first.c_str());
+            delete sender;
+            it = instances.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    if (instances.size() > 0) {
+        TimerWheel::getInstance().schedule(getIdleTimer(), idle_timeout_in_ms);
+    }
+}
+
+/**
+ *  Remove the senders of all requesters via the given local interface, e.g. once the interface has gone away
+ */
+void ReplyPacketSender::removeSenders(const std::string& local_interface) {
+    for (auto it = instances.begin(); it != instances.end(); ) {
+        if (it->second->getLocalInterfaceIP() == local_interface) {
+            delete it->second;
+            it = instances.erase(it);
+        }
+        else {
+            ++it;
         }
     }
-}
\ No newline at end of file
+}
+
+/**
+ *  Send the given answer as a unicast packet to the given requester address and port
+ */
+void ReplyPacketSender::reply(const SpeedwireHeader& packet, const struct sockaddr& requester) {
+    logger.print(LogLevel::LOG_INFO_1, "send answer to unicast host %s (via interface %s)\n", peer_ip.c_str(), local_interface_ip.c_str());
+    transmit(packet, &requester);
+}
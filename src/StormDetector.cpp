@@ -0,0 +1,215 @@
+#ifdef _WIN32
+#include <Winsock2.h>
+#include <Iphlpapi.h>
+#else
+#include <net/if.h>
+#endif
+#include <cstdio>
+#include <cstring>
+#include <Logger.hpp>
+#include <AddressConversion.hpp>
+#include <ConfigManager.hpp>
+#include <StormDetector.hpp>
+using namespace libspeedwire;
+
+static Logger logger = Logger("StormDetector");
+
+
+/**
+ *  Bounce storm detector
+ *  Counts bounce drops per source address and per arrival interface and quarantines sources and interfaces
+ *  exceeding the configured rate; quarantined packets are dropped before any protocol parsing.
+ */
+
+/**
+ *  Constructor - the window timer is started right away
+ */
+StormDetector::StormDetector(TimerWheel& wheel) :
+    current_interface(NULL),
+    num_quarantined(0),
+    num_storms(0),
+    num_dropped(0),
+    timer_wheel(wheel) {
+    window_timer.setCallback([this](void) { rollWindow(); });
+    timer_wheel.schedule(window_timer, window_in_ms);
+}
+
+/**
+ *  Get the singleton instance
+ */
+StormDetector& StormDetector::getInstance(void) {
+    static StormDetector instance(TimerWheel::getInstance());
+    return instance;
+}
+
+/**
+ *  Get the key of the given source address in the source table
+ */
+uint64_t StormDetector::getKey(const struct sockaddr& src) {
+    if (src.sa_family == AF_INET) {
+        return AddressConversion::toSockAddrIn(src).sin_addr.s_addr;
+    }
+    // hash other address families; a collision merely merges the counters of two sources
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < sizeof(src); ++i) {
+        hash = (hash ^ ((const uint8_t*)&src)[i]) * 1099511628211ull;
+    }
+    return hash | (1ull << 63);
+}
+
+/**
+ *  Find the interface of the given interface index; it is added if it is not yet known. Interfaces are kept when
+ *  their addresses go away, as the interface index stays the same while the link exists.
+ */
+StormDetector::Interface* StormDetector::findInterface(int ifindex) {
+    for (auto& iface : interfaces) {
+        if (iface.ifindex == ifindex) {
+            return &iface;
+        }
+    }
+    char name[IF_NAMESIZE];
+    if (ifindex <= 0 || if_indextoname((unsigned)ifindex, name) == NULL) {
+        snprintf(name, sizeof(name), "#%d", ifindex);
+    }
+    interfaces.push_back(Interface(ifindex, name));
+    return &interfaces.back();
+}
+
+/**
+ *  Slow path of the early drop check, taken only while a quarantine is active
+ */
+bool StormDetector::admitQuarantined(const struct sockaddr& src) {
+    if (current_interface != NULL && current_interface->quarantined == true) {
+        return sample(*current_interface);
+    }
+    auto it = sources.find(getKey(src));
+    if (it != sources.end() && it->second.quarantined == true) {
+        return sample(it->second);
+    }
+    return true;
+}
+
+/**
+ *  Count a packet arriving during a quarantine; returns true for one in sample_interval packets, which is passed
+ *  on to the bounce detector to measure the bounce rate, and false for packets to be dropped
+ */
+bool StormDetector::sample(Counters& counters) {
+    if (++counters.arrivals % sample_interval == 0) {
+        return true;
+    }
+    ++counters.dropped;
+    ++num_dropped;
+    return false;
+}
+
+/**
+ *  Count a packet dropped by the bounce detector; the source or arrival interface is quarantined if its bounce
+ *  drops within the current window reach the configured rate
+ */
+void StormDetector::bounced(const struct sockaddr& src) {
+    std::shared_ptr<const RouterConfig> config = ConfigManager::getInstance().get();
+
+    if (current_interface != NULL) {
+        ++current_interface->bounces;
+        if (current_interface->quarantined == false && config->storm_interface_rate > 0 && current_interface->bounces >= config->storm_interface_rate) {
+            quarantine(*current_interface, "interface", current_interface->name, current_interface->bounces);
+        }
+    }
+
+    const uint64_t key = getKey(src);
+    auto it = sources.find(key);
+    if (it == sources.end()) {
+        if (sources.size() >= max_sources) {
+            return;
+        }
+        it = sources.insert(std::make_pair(key, Source())).first;
+        it->second.addr = src;
+    }
+    Source& source = it->second;
+    ++source.bounces;
+    if (source.quarantined == false && config->storm_source_rate > 0 && source.bounces >= config->storm_source_rate) {
+        quarantine(source, "source", AddressConversion::toString(src), source.bounces);
+    }
+}
+
+/**
+ *  Quarantine the given source or interface
+ */
+void StormDetector::quarantine(Counters& counters, const char* kind, const std::string& name, uint32_t rate) {
+    counters.quarantined   = true;
+    counters.arrivals      = 0;
+    counters.quiet_windows = 0;
+    counters.dropped       = 0;
+    ++num_quarantined;
+    ++num_storms;
+    logger.print(LogLevel::LOG_WARNING, "bounce storm from %s %s: %u bounced packets within %u ms => QUARANTINED\n", kind, name.c_str(), rate, window_in_ms);
+}
+
+/**
+ *  Release the given source or interface from quarantine, once its bounce rate, estimated from the sampled
+ *  packets, has stayed at or below the release rate for the given number of windows. Returns true if it has
+ *  been released.
+ */
+bool StormDetector::release(Counters& counters, uint32_t release_rate, uint32_t release_windows, const char* kind, const std::string& name) {
+    const uint64_t bounce_rate = (uint64_t)counters.bounces * sample_interval;
+    counters.quiet_windows = (bounce_rate <= release_rate ? counters.quiet_windows + 1 : 0);
+    if (counters.quiet_windows < release_windows) {
+        return false;
+    }
+    counters.quarantined = false;
+    --num_quarantined;
+    logger.print(LogLevel::LOG_INFO_0, "bounce storm from %s %s ended, %lu packets dropped => RELEASED\n", kind, name.c_str(), (unsigned long)counters.dropped);
+    return true;
+}
+
+/**
+ *  Timer callback - evaluate quarantines at the end of each window, forget sources without bounce drops and
+ *  start the next window
+ */
+void StormDetector::rollWindow(void) {
+    std::shared_ptr<const RouterConfig> config = ConfigManager::getInstance().get();
+
+    for (auto& iface : interfaces) {
+        if (iface.quarantined == true) {
+            release(iface, config->storm_interface_rate / 4, config->storm_release_windows, "interface", iface.name);
+        }
+        iface.bounces  = 0;
+        iface.arrivals = 0;
+    }
+    for (auto it = sources.begin(); it != sources.end(); ) {
+        Source& source = it->second;
+        if (source.quarantined == true) {
+            release(source, config->storm_source_rate / 4, config->storm_release_windows, "source", AddressConversion::toString(source.addr));
+        }
+        if (source.quarantined == false && source.bounces == 0) {
+            it = sources.erase(it);
+            continue;
+        }
+        source.bounces  = 0;
+        source.arrivals = 0;
+        ++it;
+    }
+    timer_wheel.schedule(window_timer, window_in_ms);
+}
+
+/**
+ *  Get a report of storm statistics and active quarantines
+ */
+std::string StormDetector::getReport(void) const {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "bounce storms: %lu quarantines, %lu packets dropped, %lu active\n", (unsigned long)num_storms, (unsigned long)num_dropped, (unsigned long)num_quarantined);
+    std::string result(buffer);
+    for (const auto& iface : interfaces) {
+        if (iface.quarantined == true) {
+            snprintf(buffer, sizeof(buffer), "  quarantined interface %s: %lu packets dropped\n", iface.name.c_str(), (unsigned long)iface.dropped);
+            result.append(buffer);
+        }
+    }
+    for (const auto& entry : sources) {
+        if (entry.second.quarantined == true) {
+            snprintf(buffer, sizeof(buffer), "  quarantined source %s: %lu packets dropped\n", AddressConversion::toString(entry.second.addr).c_str(), (unsigned long)entry.second.dropped);
+            result.append(buffer);
+        }
+    }
+    return result;
+}
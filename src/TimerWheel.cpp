@@ -0,0 +1,219 @@
+#include <CachedClock.hpp>
+#include <TimerWheel.hpp>
+
+
+/**
+ *  Hierarchical timer wheel
+ *  Timers are kept in intrusive lists hanging off four wheel levels; scheduling, cancelling and expiring a
+ *  timer takes O(1). Timers on higher levels are cascaded down as time advances.
+ */
+
+/**
+ *  Timer destructor - a scheduled timer is cancelled
+ */
+TimerWheel::Timer::~Timer(void) {
+    if (wheel != NULL) {
+        wheel->cancel(*this);
+    }
+}
+
+/**
+ *  Constructor
+ */
+TimerWheel::TimerWheel(uint32_t tick) :
+    tick_in_ms(tick > 0 ? tick : 1),
+    num_timers(0) {
+    current_tick = CachedClock::getTimeInMs() / tick_in_ms;
+    level0.fill(NULL);
+    for (auto& level : levelN) {
+        level.fill(NULL);
+    }
+}
+
+/**
+ *  Get the singleton instance
+ */
+TimerWheel& TimerWheel::getInstance(void) {
+    static TimerWheel instance;
+    return instance;
+}
+
+/**
+ *  Schedule the given timer to expire after the given delay; an already scheduled timer is rescheduled
+ */
+void TimerWheel::schedule(Timer& timer, uint32_t delay_in_ms) {
+    cancel(timer);
+    // the wheel may lag behind the cached clock until its next advance; delays are relative to the clock
+    uint64_t now_tick  = CachedClock::getTimeInMs() / tick_in_ms;
+    uint64_t base_tick = (now_tick > current_tick ? now_tick : current_tick);
+    timer.expiry_tick  = base_tick + (delay_in_ms + tick_in_ms - 1) / tick_in_ms;
+    if (timer.expiry_tick <= current_tick) {
+        timer.expiry_tick = current_tick + 1;
+    }
+    timer.wheel = this;
+    insert(timer);
+    ++num_timers;
+}
+
+/**
+ *  Cancel the given timer; cancelling a timer that is not scheduled has no effect
+ */
+void TimerWheel::cancel(Timer& timer) {
+    if (timer.slot != NULL) {
+        unlink(timer);
+        --num_timers;
+    }
+    timer.wheel = NULL;
+}
+
+/**
+ *  Advance the wheel to the given time and invoke the callbacks of all expired timers
+ */
+void TimerWheel::advance(uint64_t now_in_ms) {
+    const uint64_t target_tick = now_in_ms / tick_in_ms;
+    bool check_level0 = true;
+    while (current_tick < target_tick) {
+        if (num_timers == 0) {
+            current_tick = target_tick;
+            break;
+        }
+
+        // across a larger gap, e.g. after the event loop stalled, skip to the next cascade while level 0 is empty
+        if (check_level0 == true && target_tick - current_tick > levelN_slots) {
+            check_level0 = false;
+            if (isLevel0Empty() == true) {
+                const uint64_t last_tick = current_tick | (level0_slots - 1);
+                if (last_tick >= target_tick) {
+                    current_tick = target_tick;
+                    break;
+                }
+                current_tick = last_tick;
+            }
+        }
+        ++current_tick;
+
+        // cascade timers from higher levels whenever the lower level wraps around
+        unsigned index0 = (unsigned)(current_tick & (level0_slots - 1));
+        if (index0 == 0) {
+            unsigned index1 = (unsigned)((current_tick >> level0_bits) & (levelN_slots - 1));
+            if (index1 == 0) {
+                unsigned index2 = (unsigned)((current_tick >> (level0_bits + levelN_bits)) & (levelN_slots - 1));
+                if (index2 == 0) {
+                    cascade(3, (unsigned)((current_tick >> (level0_bits + 2 * levelN_bits)) & (levelN_slots - 1)));
+                }
+                cascade(2, index2);
+            }
+            cascade(1, index1);
+            check_level0 = true;
+        }
+
+        // move the expired timers to a local list, such that callbacks can safely cancel or reschedule any timer
+        Timer* expired = level0[index0];
+        level0[index0] = NULL;
+        for (Timer* timer = expired; timer != NULL; timer = timer->next) {
+            timer->slot = &expired;
+        }
+        while (expired != NULL) {
+            Timer* timer = expired;
+            unlink(*timer);
+            timer->wheel = NULL;
+            --num_timers;
+            if (timer->callback) {
+                timer->callback();
+            }
+        }
+    }
+}
+
+/**
+ *  Get the time in ms until the next timer expires or the next cascade is due; -1 if no timer is scheduled
+ */
+int64_t TimerWheel::getTimeUntilNextExpiry(uint64_t now_in_ms) const {
+    if (num_timers == 0) {
+        return -1;
+    }
+    uint64_t next_tick = (current_tick | (level0_slots - 1)) + 1;
+    for (uint64_t tick = current_tick + 1; tick < current_tick + 1 + level0_slots; ++tick) {
+        if (level0[tick & (level0_slots - 1)] != NULL) {
+            next_tick = tick;
+            break;
+        }
+    }
+    uint64_t next_time = next_tick * tick_in_ms;
+    return (next_time > now_in_ms ? (int64_t)(next_time - now_in_ms) : 0);
+}
+
+/**
+ *  Check if level 0 holds no timers; then no timer expires before the next cascade
+ */
+bool TimerWheel::isLevel0Empty(void) const {
+    for (const auto& slot : level0) {
+        if (slot != NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ *  Insert the given timer into the wheel level and slot corresponding to its remaining time
+ */
+void TimerWheel::insert(Timer& timer) {
+    if (timer.expiry_tick < current_tick) {
+        timer.expiry_tick = current_tick;
+    }
+    uint64_t delta = timer.expiry_tick - current_tick;
+    Timer** head;
+    if (delta < level0_slots) {
+        head = &level0[timer.expiry_tick & (level0_slots - 1)];
+    }
+    else {
+        unsigned level = 1;
+        unsigned shift = level0_bits;
+        while (level < 3 && delta >= (1ull << (shift + levelN_bits))) {
+            ++level;
+            shift += levelN_bits;
+        }
+        head = &levelN[level - 1][(timer.expiry_tick >> shift) & (levelN_slots - 1)];
+    }
+    timer.prev = NULL;
+    timer.next = *head;
+    if (*head != NULL) {
+        (*head)->prev = &timer;
+    }
+    *head = &timer;
+    timer.slot = head;
+}
+
+/**
+ *  Unlink the given timer from the list it is in
+ */
+void TimerWheel::unlink(Timer& timer) {
+    if (timer.prev != NULL) {
+        timer.prev->next = timer.next;
+    }
+    else {
+        *timer.slot = timer.next;
+    }
+    if (timer.next != NULL) {
+        timer.next->prev = timer.prev;
+    }
+    timer.prev = NULL;
+    timer.next = NULL;
+    timer.slot = NULL;
+}
+
+/**
+ *  Re-insert all timers of the given slot of the given level; they move to lower levels
+ */
+void TimerWheel::cascade(unsigned level, unsigned index) {
+    Timer* list = levelN[level - 1][index];
+    levelN[level - 1][index] = NULL;
+    while (list != NULL) {
+        Timer* timer = list;
+        list = timer->next;
+        timer->prev = NULL;
+        timer->next = NULL;
+        insert(*timer);
+    }
+}
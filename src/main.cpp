@@ -1,14 +1,35 @@
+#ifdef _WIN32
+#include <Winsock2.h>
+#else
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#include <csignal>
+#include <cstring>
+#include <set>
 #include <LocalHost.hpp>
 #include <Logger.hpp>
+#include <ObisData.hpp>
 #include <SpeedwireAuthentication.hpp>
 #include <SpeedwireCommand.hpp>
 #include <SpeedwireDiscovery.hpp>
 #include <SpeedwireHeader.hpp>
-#include <SpeedwireReceiveDispatcher.hpp>
 #include <SpeedwirePacketReceiver.hpp>
 #include <SpeedwirePacketSender.hpp>
 #include <SpeedwireSocketFactory.hpp>
 #include <SpeedwireSocket.hpp>
+#include <PacketDispatcher.hpp>
+#include <EventLoop.hpp>
+#include <InterfaceMonitor.hpp>
+#include <InterfaceTable.hpp>
+#include <LatencyTracer.hpp>
+#include <ConfigManager.hpp>
+#include <PacketCapture.hpp>
+#include <ReadingsPublisher.hpp>
+#include <StormDetector.hpp>
+#include <IoUringBackend.hpp>
+#include <PacketRingBackend.hpp>
 using namespace libspeedwire;
 
 static Logger logger("main");
@@ -23,24 +44,62 @@ public:
     }
 };
 
+#ifndef _WIN32
+static void signalHandler(int signal) {
+    // request a configuration reload or a latency report; both are handled from the main loop
+    if (signal == SIGHUP) {
+        ConfigManager::getInstance().requestReload();
+    }
+    else {
+        LatencyTracer::getInstance().requestReport();
+    }
+}
+#endif
+
+// get the local interface address the kernel would use to reach the given peer; no packet is sent
+static std::string getRouteInterfaceAddress(const std::string& peer_ip) {
+    std::string result;
+    int fd = (int)socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in peer;
+    memset(&peer, 0, sizeof(peer));
+    peer.sin_family = AF_INET;
+    peer.sin_addr = AddressConversion::toInAddress(peer_ip);
+    peer.sin_port = htons(SpeedwireSocket::speedwire_port_9522);
+    struct sockaddr_in local;
+    socklen_t local_length = sizeof(local);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&peer, sizeof(peer)) == 0 && getsockname(fd, (struct sockaddr*)&local, &local_length) == 0) {
+        result = AddressConversion::toString(local.sin_addr);
+    }
+#ifdef _WIN32
+    if (fd >= 0) closesocket(fd);
+#else
+    if (fd >= 0) close(fd);
+#endif
+    return result;
+}
+
 
 int main(int argc, char **argv) {
 
-    // configure logger and logging levels
+    // configure logger with the default logging levels
     ILogListener *log_listener = new LogListener();
-    LogLevel log_level = LogLevel::LOG_ERROR | LogLevel::LOG_WARNING;
-    log_level = log_level | LogLevel::LOG_INFO_0;
-    log_level = log_level | LogLevel::LOG_INFO_1;
-    //log_level = log_level | LogLevel::LOG_INFO_2;
-    //log_level = log_level | LogLevel::LOG_INFO_3;
-    Logger::setLogListener(log_listener, log_level);
+    ConfigManager& config_manager = ConfigManager::getInstance();
+    Logger::setLogListener(log_listener, config_manager.get()->log_level);
+
+    // load the configuration file given on the command line; if it cannot be loaded, defaults are used
+    const std::string config_path = (argc > 1 ? argv[1] : "speedwire-router.conf");
+    config_manager.load(config_path);
+    std::shared_ptr<const RouterConfig> config = config_manager.get();
+    Logger::setLogListener(log_listener, config->log_level);
 
     // discover sma devices on the local network
     
     LocalHost& localhost = LocalHost::getInstance();
     logger.print(LogLevel::LOG_INFO_0, "starting device discovery ...\n");
     SpeedwireDiscovery discoverer(localhost);
-    discoverer.preRegisterDevice("192.168.182.18");
+    for (const auto& peer_ip : config->peers) {
+        discoverer.preRegisterDevice(peer_ip);
+    }
     int num_devices = discoverer.discoverDevices();
     logger.print(LogLevel::LOG_INFO_0, "... finished device discovery\n");
     if (num_devices == 0) {
@@ -50,7 +109,15 @@ int main(int argc, char **argv) {
 
     // open socket(s) to receive sma emeter packets from any local interface
     SpeedwireSocketFactory *socket_factory = SpeedwireSocketFactory::getInstance(localhost);
-    const std::vector<SpeedwireSocket> recv_sockets = socket_factory->getRecvSockets(SpeedwireSocketFactory::SocketType::ANYCAST, localhost.getLocalIPv4Addresses());
+    std::vector<SpeedwireSocket> recv_sockets = socket_factory->getRecvSockets(SpeedwireSocketFactory::SocketType::ANYCAST, localhost.getLocalIPv4Addresses());
+
+    // configure the event loop; all timeouts are driven by the timer wheel
+    TimerWheel& timer_wheel = TimerWheel::getInstance();
+    EventLoop event_loop(timer_wheel);
+
+    // configure the speedwire packet receive dispatcher; it also receives answers on the connected sockets of unicast peers
+    PacketDispatcher dispatcher(localhost, event_loop);
+    UnicastPacketSender::setDispatcher(&dispatcher);
 
     // configure speedwire packet sender for multicast to each local interface
     std::vector<SpeedwirePacketSender*> multicast_packet_senders;
@@ -61,16 +128,15 @@ int main(int argc, char **argv) {
     }
 
     // configure speedwire packet sender for unicast to single speedwire devices not directly reachable by multicast
+    // the interface table also covers interfaces added by the interface monitor after startup
+    auto is_reachable_by_multicast = [](const std::string& peer_ip) {
+        return InterfaceTable::getInstance().findInterface(AddressConversion::toInAddress(peer_ip)).length() > 0;
+    };
+    std::vector<std::string> unicast_peers;
     for (auto& device : devices) {
         const std::string& peer_ip = device.deviceIpAddress;
-        bool is_reachable_by_multicast = false;
-        for (auto& addr : ipv4_addresses) {
-            if (AddressConversion::resideOnSameSubnet(AddressConversion::toInAddress(peer_ip), AddressConversion::toInAddress(addr), localhost.getInterfacePrefixLength(addr)) == true) {
-                is_reachable_by_multicast = true;
-                break;
-            }
-        }
-        if (is_reachable_by_multicast == false) {
+        if (is_reachable_by_multicast(peer_ip) == false) {
+            unicast_peers.push_back(peer_ip);
             SpeedwireSocket& send_socket = socket_factory->getSendSocket(SpeedwireSocketFactory::SocketType::UNICAST, peer_ip);
             multicast_packet_senders.push_back(new UnicastPacketSender(localhost, device.interfaceIpAddress, peer_ip));
         }
@@ -81,12 +147,145 @@ int main(int argc, char **argv) {
     InverterPacketReceiver inverter_packet_receiver(localhost, multicast_packet_senders);
     DiscoveryPacketReceiver discovery_packet_receiver(localhost, multicast_packet_senders);
 
+    // restrict emeter packets forwarded to a peer to the obis elements of its trim rule, and answer repeated inverter
+    // queries from a response cache if proxy_ttl is set; both are applied again on each reload
+    auto apply_peer_settings = [&](const RouterConfig& next) {
+        for (auto& sender : multicast_packet_senders) {
+            EmeterPacketTrimmer& trimmer = sender->getEmeterPacketTrimmer();
+            trimmer.clear();
+            const RouterConfig::TrimRule* rule = next.findTrimRule(sender->getPeerIP());
+            if (rule != NULL) {
+                for (const auto& obis : rule->obis) {
+                    trimmer.addObisElement(obis[0], obis[1], obis[2], obis[3]);
+                }
+            }
+        }
+        if (next.proxy_ttl_in_ms > 0) {
+            inverter_packet_receiver.enableProxyMode(next.proxy_ttl_in_ms);
+        }
+        else {
+            inverter_packet_receiver.disableProxyMode();
+        }
+    };
+    apply_peer_settings(*config);
+
+    // configure forwarding latency tracing; a report is printed on SIGUSR1
+    LatencyTracer& tracer = LatencyTracer::getInstance();
+    tracer.setSlowPacketThreshold(10000000, 1);
+#ifndef _WIN32
+    signal(SIGUSR1, signalHandler);
+    signal(SIGHUP,  signalHandler);
+#endif
+
+    // optionally capture received, forwarded and dropped packets into rotating pcapng files, see capture in the configuration file
+    PacketCapture& capture = PacketCapture::getInstance();
+    if (config->capture_path.size() > 0) {
+        capture.start(config->capture_path, config->capture_file_size, config->capture_file_count);
+    }
+
+    // optionally publish the latest emeter and inverter readings into shared memory, see SharedReadings.hpp for readers
+    if (config->shared_memory.size() > 0) {
+        ReadingsPublisher::getInstance().open(config->shared_memory);
+    }
+
     // configure speedwire packet receive dispatcher
-    SpeedwireReceiveDispatcher dispatcher(localhost);
     dispatcher.registerReceiver(emeter_packet_receiver);
     dispatcher.registerReceiver(inverter_packet_receiver);
     dispatcher.registerReceiver(discovery_packet_receiver);
 
+    bool io_backend_available = (config->io_backend == "poll");
+#ifdef SPEEDWIRE_IO_URING
+    // optionally receive and send through io_uring; if the kernel does not support it, the event loop is used
+    IoUringBackend io_uring_backend(dispatcher, event_loop);
+    if (config->io_backend == "io_uring" && io_uring_backend.open() == true) {
+        dispatcher.setReceiveBackend(&io_uring_backend);
+        PeerSendQueue::setSendBackend(&io_uring_backend);
+        io_backend_available = true;
+    }
+#endif
+#ifdef __linux__
+    // optionally receive through memory-mapped AF_PACKET rings; without CAP_NET_RAW, the event loop is used
+    PacketRingBackend packet_ring_backend(dispatcher, event_loop);
+    if (config->io_backend == "packet_ring" && packet_ring_backend.open() == true) {
+        dispatcher.setReceiveBackend(&packet_ring_backend);
+        io_backend_available = true;
+    }
+#endif
+    if (io_backend_available == false) {
+        logger.print(LogLevel::LOG_WARNING, "i/o backend %s is not available in this build or on this host, using poll\n", config->io_backend.c_str());
+    }
+    dispatcher.addSockets(recv_sockets);
+
+    // add unicast senders for the given peers not directly reachable by multicast, unless they already have one
+    auto add_unicast_senders = [&](const std::vector<std::string>& peer_ips) {
+        for (const auto& peer_ip : peer_ips) {
+            bool exists = false;
+            for (auto& sender : multicast_packet_senders) {
+                exists |= (sender->getPeerIP() == peer_ip);
+            }
+            if (exists == true || is_reachable_by_multicast(peer_ip) == true) {
+                continue;
+            }
+            std::string interface_ip = getRouteInterfaceAddress(peer_ip);
+            if (interface_ip.size() > 0) {
+                logger.print(LogLevel::LOG_INFO_0, "added peer %s (via interface %s)\n", peer_ip.c_str(), interface_ip.c_str());
+                multicast_packet_senders.push_back(new UnicastPacketSender(localhost, interface_ip, peer_ip));
+            }
+        }
+    };
+
+    // attach and detach receive sockets and senders when local interface addresses come and go; unicast peers
+    // are set up again through the interfaces they are now reachable by
+    InterfaceMonitor interface_monitor(localhost, event_loop, dispatcher, multicast_packet_senders);
+    interface_monitor.addChangeListener([&](const std::string& ip, bool added) {
+        add_unicast_senders(unicast_peers);
+        add_unicast_senders(config_manager.get()->peers);
+        apply_peer_settings(*config_manager.get());
+    });
+    interface_monitor.open();
+
+    // optionally log latency percentiles periodically, here every 10 minutes
+    TimerWheel::Timer report_timer;
+    report_timer.setCallback([&](void) {
+        logger.print(LogLevel::LOG_INFO_1, "%s", tracer.getPercentiles().c_str());
+        logger.print(LogLevel::LOG_INFO_1, "%s", StormDetector::getInstance().getReport().c_str());
+        timer_wheel.schedule(report_timer, 600000);
+    });
+    //timer_wheel.schedule(report_timer, 600000);
+
+    // reload the configuration on SIGHUP or if the configuration file changes; the new snapshot is swapped in
+    // atomically, then unicast senders are added and removed for the configured peers
+    config_manager.watch(event_loop);
+    config_manager.addReloadListener([&](const RouterConfig& next) {
+        Logger::setLogListener(log_listener, next.log_level);
+
+        // start, stop or restart packet capturing if its settings have changed
+        if (next.capture_path != config->capture_path || next.capture_file_size != config->capture_file_size || next.capture_file_count != config->capture_file_count) {
+            capture.stop();
+            if (next.capture_path.size() > 0) {
+                capture.start(next.capture_path, next.capture_file_size, next.capture_file_count);
+            }
+        }
+
+        // remove unicast senders for peers that are no longer configured
+        for (auto it = multicast_packet_senders.begin(); it != multicast_packet_senders.end(); ) {
+            UnicastPacketSender* sender = dynamic_cast<UnicastPacketSender*>(*it);
+            if (sender != NULL && config->isPeer(sender->getPeerIP()) == true && next.isPeer(sender->getPeerIP()) == false) {
+                logger.print(LogLevel::LOG_INFO_0, "removed peer %s\n", sender->getPeerIP().c_str());
+                delete sender;
+                it = multicast_packet_senders.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+
+        // add unicast senders for new peers not directly reachable by multicast
+        add_unicast_senders(next.peers);
+        apply_peer_settings(next);
+        config = config_manager.get();
+    });
+
 #if 0
     SpeedwireAuthentication authenticator(localhost, discoverer.getDevices());
     authenticator.logoffAnyFromAny();
@@ -99,7 +298,19 @@ int main(int argc, char **argv) {
     //
     const int poll_timeout_in_ms = 2000;
     while(true) {
-        dispatcher.dispatch(recv_sockets, poll_timeout_in_ms);
+        event_loop.runOnce(poll_timeout_in_ms);
+        config_manager.reloadIfRequested();
+
+        if (tracer.isReportRequested()) {
+            logger.print(LogLevel::LOG_INFO_0, "%s", tracer.getPercentiles().c_str());
+            logger.print(LogLevel::LOG_INFO_0, "%s", tracer.getSlowPacketTrace().c_str());
+            logger.print(LogLevel::LOG_INFO_0, "%s", StormDetector::getInstance().getReport().c_str());
+#ifdef __linux__
+            if (packet_ring_backend.isOpen() == true) {
+                logger.print(LogLevel::LOG_INFO_0, "%s", packet_ring_backend.getReport().c_str());
+            }
+#endif
+        }
     }
 
     return 0;
@@ -0,0 +1,97 @@
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <SpeedwireByteEncoding.hpp>
+#include <SpeedwireHeader.hpp>
+#include <SpeedwireEmeterProtocol.hpp>
+#include <ObisData.hpp>
+#include <EmeterPacketTrimmer.hpp>
+#include "UnitTest.hpp"
+using namespace libspeedwire;
+
+using UnitTest::check;
+
+/**
+ *  Extended emeter datagram (protocol id 0x6081) as recorded from a meter with serial number 1901234567;
+ *  17 obis elements including the software version, followed by the end-of-data tag
+ */
+static const uint8_t recorded_emeter_packet[] = {
+    0x53, 0x4d, 0x41, 0x00, 0x00, 0x04, 0x02, 0xa0, 0x00, 0x00, 0x00, 0x01, 0x00, 0xac, 0x00, 0x10,
+    0x60, 0x81, 0x01, 0x5d, 0x71, 0x52, 0x89, 0x87, 0x1a, 0x2b, 0x3c, 0x4d, 0x00, 0x01, 0x04, 0x00,
+    0x00, 0x00, 0x04, 0xd2, 0x00, 0x01, 0x08, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x4d, 0x76, 0x60, 0xe2,
+    0x00, 0x02, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x08, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x5c, 0xc8, 0x7c, 0x00, 0x00, 0x03, 0x04, 0x00, 0x00, 0x00, 0x00, 0x57, 0x00, 0x03, 0x08, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0xc5, 0x48, 0xa0, 0x60, 0x00, 0x04, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x04, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x83, 0xba, 0x96, 0xd0, 0x00, 0x09, 0x04, 0x00,
+    0x00, 0x00, 0x05, 0x15, 0x00, 0x09, 0x08, 0x00, 0x00, 0x00, 0x00, 0x0e, 0x35, 0x48, 0x68, 0xc0,
+    0x00, 0x0d, 0x04, 0x00, 0x00, 0x00, 0x03, 0xb4, 0x00, 0x0e, 0x04, 0x00, 0x00, 0x00, 0xc3, 0x5c,
+    0x00, 0x15, 0x04, 0x00, 0x00, 0x00, 0x01, 0x9c, 0x00, 0x15, 0x08, 0x00, 0x00, 0x00, 0x00, 0x04,
+    0x19, 0x1d, 0x74, 0xb0, 0x00, 0x1f, 0x04, 0x00, 0x00, 0x00, 0x07, 0x51, 0x00, 0x20, 0x04, 0x00,
+    0x00, 0x03, 0x88, 0x20, 0x90, 0x00, 0x00, 0x00, 0x02, 0x00, 0x12, 0x52, 0x00, 0x00, 0x00, 0x00
+};
+
+/**
+ *  Check that the trimmer keeps exactly the allowed obis elements and the software version, and that the
+ *  data2 tag length of the trimmed packet matches its new size
+ */
+int main(int argc, char** argv) {
+    std::vector<uint8_t> packet(recorded_emeter_packet, recorded_emeter_packet + sizeof(recorded_emeter_packet));
+    SpeedwireHeader header(packet.data(), (unsigned long)packet.size());
+    std::vector<uint8_t> buffer(packet.size());
+
+    // a trimmer without an allow-list leaves packets alone
+    EmeterPacketTrimmer trimmer;
+    check(trimmer.isEnabled() == false, "trimmer starts disabled");
+    check(trimmer.trim(header, buffer.data(), (unsigned long)buffer.size()) == 0, "disabled trimmer does not trim");
+
+    // keep positive and negative active power, the energy counter of the positive active power and the l1 voltage
+    trimmer.addObisElement(ObisData::PositiveActivePowerTotal);
+    trimmer.addObisElement(ObisData::NegativeActivePowerTotal);
+    trimmer.addObisElement(0, 1, 8, 0);
+    trimmer.addObisElement(0, 32, 4, 0);
+    check(trimmer.isEnabled() == true, "trimmer is enabled by its allow-list");
+    check(trimmer.trim(header, buffer.data(), 16) == 0, "packet is not trimmed into a buffer that is too small");
+
+    const unsigned long length = trimmer.trim(header, buffer.data(), (unsigned long)buffer.size());
+    check(length == 28 + 8 + 12 + 8 + 8 + 8 + 4, "trimmed packet size");
+    if (length == 0) {
+        return UnitTest::finish();
+    }
+    buffer.resize(length);
+
+    // the speedwire header and the emeter header are unchanged, apart from the data2 tag length
+    check(memcmp(buffer.data(), packet.data(), 12) == 0 && memcmp(buffer.data() + 14, packet.data() + 14, 14) == 0, "headers are copied");
+    check(SpeedwireByteEncoding::getUint16BigEndian(buffer.data() + 12) == length - 16 - 4, "data2 tag length is rewritten");
+    check(memcmp(buffer.data() + length - 4, packet.data() + packet.size() - 4, 4) == 0, "end-of-data tag is kept");
+
+    // walk the obis elements of the trimmed packet
+    SpeedwireHeader trimmed_header(buffer.data(), (unsigned long)buffer.size());
+    const SpeedwireData2Packet trimmed_data2(trimmed_header);
+    const SpeedwireEmeterProtocol trimmed_emeter(trimmed_data2);
+    const uint32_t expected[] = { 0x00010400, 0x00010800, 0x00020400, 0x00200400, 0x90000000 };
+    const size_t num_expected = sizeof(expected) / sizeof(expected[0]);
+    size_t num_obis = 0;
+    bool in_order = true;
+    for (const void* obis = trimmed_emeter.getFirstObisElement(); obis != NULL; obis = trimmed_emeter.getNextObisElement(obis)) {
+        const uint32_t key = ((uint32_t)SpeedwireEmeterProtocol::getObisChannel(obis) << 24) | ((uint32_t)SpeedwireEmeterProtocol::getObisIndex(obis) << 16) |
+                             ((uint32_t)SpeedwireEmeterProtocol::getObisType(obis) << 8) | SpeedwireEmeterProtocol::getObisTariff(obis);
+        in_order &= (num_obis < num_expected && expected[num_obis] == key);
+        switch (key) {
+        case 0x00010400: check(SpeedwireEmeterProtocol::getObisValue4(obis) == 1234, "positive active power value is kept"); break;
+        case 0x00010800: check(SpeedwireEmeterProtocol::getObisValue8(obis) == 52839211234ull, "positive active energy counter is kept"); break;
+        case 0x00200400: check(SpeedwireEmeterProtocol::getObisValue4(obis) == 231456, "l1 voltage value is kept"); break;
+        case 0x90000000: check(SpeedwireEmeterProtocol::getObisValue4(obis) == 0x02001252, "software version value is kept"); break;
+        default: break;
+        }
+        ++num_obis;
+    }
+    check(num_obis == num_expected && in_order == true, "only the allowed obis elements and the software version remain, in their original order");
+
+    // packets of other protocols are not trimmed
+    std::vector<uint8_t> inverter_packet(packet);
+    SpeedwireByteEncoding::setUint16BigEndian(&inverter_packet[16], 0x6065);
+    SpeedwireHeader inverter_header(inverter_packet.data(), (unsigned long)inverter_packet.size());
+    check(trimmer.trim(inverter_header, buffer.data(), (unsigned long)packet.size()) == 0, "inverter packet is not trimmed");
+
+    return UnitTest::finish();
+}
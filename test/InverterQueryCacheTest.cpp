@@ -0,0 +1,108 @@
+#ifdef _WIN32
+#include <Winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <SpeedwireByteEncoding.hpp>
+#include <TimerWheel.hpp>
+#include <InverterQueryCache.hpp>
+#include "UnitTest.hpp"
+using namespace libspeedwire;
+
+using UnitTest::check;
+
+/**
+ *  Assemble an inverter packet; for responses, the register id fields hold record indices as sent by the inverter
+ */
+static std::vector<uint8_t> getInverterPacket(uint16_t dst_susyid, uint32_t dst_serial, uint16_t src_susyid, uint32_t src_serial,
+                                              uint32_t command_id, uint16_t packet_id, uint32_t first, uint32_t last) {
+    std::vector<uint8_t> packet = { 'S', 'M', 'A', 0x00, 0x00, 0x04, 0x02, 0xa0, 0x00, 0x00, 0x00, 0x01, 0x00, 0x26, 0x00, 0x10, 0x60, 0x65 };
+    packet.resize(packet.size() + 36 + 4);
+    uint8_t* payload = &packet[18];
+    payload[0] = 9;
+    payload[1] = 0xa0;
+    SpeedwireByteEncoding::setUint16LittleEndian(payload + 2,  dst_susyid);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 4,  dst_serial);
+    SpeedwireByteEncoding::setUint16LittleEndian(payload + 10, src_susyid);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 12, src_serial);
+    SpeedwireByteEncoding::setUint16LittleEndian(payload + 22, packet_id);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 24, command_id);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 28, first);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 32, last);
+    return packet;
+}
+
+static struct sockaddr getSockAddr(uint32_t ip) {
+    struct sockaddr addr;
+    memset(&addr, 0, sizeof(addr));
+    struct sockaddr_in& addr4 = *(struct sockaddr_in*)&addr;
+    addr4.sin_family = AF_INET;
+    addr4.sin_addr.s_addr = htonl(ip);
+    return addr;
+}
+
+/**
+ *  Check that a coalesced requester receives the response to the forwarded query, rewritten for itself,
+ *  and that the response is cached for later requesters
+ */
+int main(int argc, char** argv) {
+    TimerWheel timer_wheel;
+    InverterQueryCache cache(timer_wheel);
+    const uint16_t inverter_susyid = 0x0080;
+    const uint32_t inverter_serial = 3000000001;
+    const struct sockaddr requester_a = getSockAddr(0xc0a80a01);
+    const struct sockaddr requester_b = getSockAddr(0xc0a80a02);
+    std::vector<uint8_t> response;
+
+    // requester a queries the inverter, requester b sends the identical query while it is in flight
+    std::vector<uint8_t> query_a = getInverterPacket(inverter_susyid, inverter_serial, 0x007d, 1001, 0x53800200, 0x0011, 0x00251e00, 0x00251eff);
+    std::vector<uint8_t> query_b = getInverterPacket(inverter_susyid, inverter_serial, 0x007d, 1002, 0x53800200, 0x0042, 0x00251e00, 0x00251eff);
+    SpeedwireHeader header_a(query_a.data(), (unsigned long)query_a.size());
+    SpeedwireHeader header_b(query_b.data(), (unsigned long)query_b.size());
+    const SpeedwireInverterProtocol packet_a((SpeedwireData2Packet(header_a)));
+    const SpeedwireInverterProtocol packet_b((SpeedwireData2Packet(header_b)));
+    check(cache.request(packet_a, requester_a, 1000, response) == InverterQueryCache::Result::FORWARD, "first query is forwarded");
+    check(cache.request(packet_b, requester_b, 1010, response) == InverterQueryCache::Result::COALESCED, "identical query is coalesced");
+
+    // an unrelated response with another packet id does not complete the query
+    std::vector<InverterQueryCache::Requester> waiters;
+    std::vector<uint8_t> other = getInverterPacket(0x007d, 1003, inverter_susyid, inverter_serial, 0x53800201, 0x8077, 0, 0);
+    SpeedwireHeader other_header(other.data(), (unsigned long)other.size());
+    const SpeedwireInverterProtocol other_packet((SpeedwireData2Packet(other_header)));
+    check(cache.response(other_packet, other_header, 1020, waiters) == false && waiters.size() == 0, "response to another query is not matched");
+
+    // the inverter answers the forwarded query; its register id fields hold record indices
+    std::vector<uint8_t> answer = getInverterPacket(0x007d, 1001, inverter_susyid, inverter_serial, 0x53800201, 0x8011, 0, 0);
+    SpeedwireHeader answer_header(answer.data(), (unsigned long)answer.size());
+    const SpeedwireInverterProtocol answer_packet((SpeedwireData2Packet(answer_header)));
+    check(cache.response(answer_packet, answer_header, 1050, waiters) == true, "response to the forwarded query is cached");
+    check(waiters.size() == 1 && waiters[0].src_serial == 1002 && waiters[0].packet_id == 0x0042, "coalesced requester is handed over for an answer");
+
+    // the answer for the coalesced requester carries its own device and packet id
+    if (waiters.size() == 1) {
+        std::vector<uint8_t> rewritten = answer;
+        InverterQueryCache::rewrite(rewritten, waiters[0]);
+        SpeedwireHeader rewritten_header(rewritten.data(), (unsigned long)rewritten.size());
+        const SpeedwireInverterProtocol rewritten_packet((SpeedwireData2Packet(rewritten_header)));
+        check(rewritten_packet.getDstSerialNumber() == 1002 && rewritten_packet.getPacketID() == 0x8042, "answer is rewritten for the coalesced requester");
+    }
+
+    // a later identical query is answered from the cache
+    check(cache.request(packet_b, requester_b, 1100, response) == InverterQueryCache::Result::CACHED && response.size() == answer.size(), "later query is answered from the cache");
+
+    // broadcast queries are answered by any inverter, hence they are neither cached nor coalesced
+    std::vector<uint8_t> broadcast = getInverterPacket(0xffff, 0xffffffff, 0x007d, 1001, 0x53800200, 0x0012, 0x00251e00, 0x00251eff);
+    SpeedwireHeader broadcast_header(broadcast.data(), (unsigned long)broadcast.size());
+    const SpeedwireInverterProtocol broadcast_packet((SpeedwireData2Packet(broadcast_header)));
+    check(cache.request(broadcast_packet, requester_a, 1200, response) == InverterQueryCache::Result::FORWARD, "broadcast query is forwarded");
+    check(cache.request(broadcast_packet, requester_b, 1210, response) == InverterQueryCache::Result::FORWARD, "identical broadcast query is not coalesced");
+    std::vector<uint8_t> broadcast_answer = getInverterPacket(0x007d, 1001, inverter_susyid, inverter_serial, 0x53800201, 0x8012, 0, 0);
+    SpeedwireHeader broadcast_answer_header(broadcast_answer.data(), (unsigned long)broadcast_answer.size());
+    const SpeedwireInverterProtocol broadcast_answer_packet((SpeedwireData2Packet(broadcast_answer_header)));
+    check(cache.response(broadcast_answer_packet, broadcast_answer_header, 1250, waiters) == false, "response to a broadcast query is not cached");
+
+    return UnitTest::finish();
+}
@@ -0,0 +1,173 @@
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include <SpeedwireByteEncoding.hpp>
+#include <ReadingsPublisher.hpp>
+#include <SharedReadings.hpp>
+#include "UnitTest.hpp"
+using namespace libspeedwire;
+
+using UnitTest::check;
+
+/**
+ *  Assemble an emeter packet with a 4 byte power value, an 8 byte energy counter and the software version
+ */
+static std::vector<uint8_t> getEmeterPacket(uint32_t serial, uint32_t time, uint32_t power, uint64_t energy) {
+    std::vector<uint8_t> packet = { 'S', 'M', 'A', 0x00, 0x00, 0x04, 0x02, 0xa0, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x10, 0x60, 0x69 };
+    packet.resize(packet.size() + 10 + 8 + 12 + 8 + 4);
+    uint8_t* payload = &packet[18];
+    SpeedwireByteEncoding::setUint16BigEndian(payload + 0, 349);
+    SpeedwireByteEncoding::setUint32BigEndian(payload + 2, serial);
+    SpeedwireByteEncoding::setUint32BigEndian(payload + 6, time);
+    const uint8_t power_obis[4]   = { 0, 1, 4, 0 };
+    const uint8_t energy_obis[4]  = { 0, 1, 8, 0 };
+    const uint8_t version_obis[4] = { 144, 0, 0, 0 };
+    memcpy(payload + 10, power_obis, 4);
+    SpeedwireByteEncoding::setUint32BigEndian(payload + 14, power);
+    memcpy(payload + 18, energy_obis, 4);
+    SpeedwireByteEncoding::setUint32BigEndian(payload + 22, (uint32_t)(energy >> 32));
+    SpeedwireByteEncoding::setUint32BigEndian(payload + 26, (uint32_t)energy);
+    memcpy(payload + 30, version_obis, 4);
+    SpeedwireByteEncoding::setUint32BigEndian(payload + 34, 0x02001252);
+    // the data2 tag length covers the protocol id and the payload, but not the end-of-data tag
+    SpeedwireByteEncoding::setUint16BigEndian(&packet[12], (uint16_t)(packet.size() - 16 - 4));
+    return packet;
+}
+
+/**
+ *  Assemble an inverter response packet with two 16 byte records
+ */
+static std::vector<uint8_t> getInverterPacket(uint16_t susyid, uint32_t serial, uint32_t time, uint32_t value, uint64_t counter) {
+    std::vector<uint8_t> packet = { 'S', 'M', 'A', 0x00, 0x00, 0x04, 0x02, 0xa0, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x10, 0x60, 0x65 };
+    packet.resize(packet.size() + 36 + 2 * 16 + 4);
+    uint8_t* payload = &packet[18];
+    payload[0] = 9 + 4 * 2;
+    payload[1] = 0xa0;
+    SpeedwireByteEncoding::setUint16LittleEndian(payload + 2,  0x007d);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 4,  1001);
+    SpeedwireByteEncoding::setUint16LittleEndian(payload + 10, susyid);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 12, serial);
+    SpeedwireByteEncoding::setUint16LittleEndian(payload + 22, 0x8011);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 24, 0x53800201);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 28, 0);
+    SpeedwireByteEncoding::setUint32LittleEndian(payload + 32, 1);
+    uint8_t* record = payload + 36;
+    SpeedwireByteEncoding::setUint32LittleEndian(record + 0,  0x40263f01);
+    SpeedwireByteEncoding::setUint32LittleEndian(record + 4,  time);
+    SpeedwireByteEncoding::setUint32LittleEndian(record + 8,  value);
+    SpeedwireByteEncoding::setUint32LittleEndian(record + 12, 0);
+    record += 16;
+    SpeedwireByteEncoding::setUint32LittleEndian(record + 0,  0x00260101);
+    SpeedwireByteEncoding::setUint32LittleEndian(record + 4,  time);
+    SpeedwireByteEncoding::setUint32LittleEndian(record + 8,  (uint32_t)counter);
+    SpeedwireByteEncoding::setUint32LittleEndian(record + 12, (uint32_t)(counter >> 32));
+    SpeedwireByteEncoding::setUint16BigEndian(&packet[12], (uint16_t)(packet.size() - 16 - 4));
+    return packet;
+}
+
+static void publishEmeter(ReadingsPublisher& publisher, const std::vector<uint8_t>& packet) {
+    SpeedwireHeader header(packet.data(), (unsigned long)packet.size());
+    const SpeedwireData2Packet data2_packet(header);
+    const SpeedwireEmeterProtocol emeter_packet(data2_packet);
+    publisher.publish(emeter_packet);
+}
+
+static void publishInverter(ReadingsPublisher& publisher, const std::vector<uint8_t>& packet) {
+    SpeedwireHeader header(packet.data(), (unsigned long)packet.size());
+    const SpeedwireData2Packet data2_packet(header);
+    const SpeedwireInverterProtocol inverter_packet(data2_packet);
+    publisher.publish(inverter_packet, header);
+}
+
+/**
+ *  Check that values published by the router are read back by SharedReadings::Reader, and that a reader never
+ *  sees a torn device slot while the router keeps updating it
+ */
+int main(int argc, char** argv) {
+#ifndef _WIN32
+    const std::string name = "/speedwire-router-test-" + std::to_string((long)getpid());
+    ReadingsPublisher& publisher = ReadingsPublisher::getInstance();
+    check(publisher.open(name) == true, "region is created");
+
+    SharedReadings::Reader reader;
+    check(reader.open(name.c_str()) == true, "reader opens the region");
+    check(reader.getNumDevices() == 0, "region starts without devices");
+
+    // emeter round trip, including the 8 byte counter
+    const uint32_t power_key  = SharedReadings::getObisKey(0, 1, 4, 0);
+    const uint32_t energy_key = SharedReadings::getObisKey(0, 1, 8, 0);
+    publishEmeter(publisher, getEmeterPacket(1900000001, 123456, 4711, 0x0000000123456789ull));
+    const SharedReadings::Device* emeter = reader.findDevice(SharedReadings::EMETER, 1900000001);
+    check(emeter != NULL, "emeter slot is found");
+    if (emeter != NULL) {
+        SharedReadings::Snapshot snapshot;
+        check(SharedReadings::Reader::read(*emeter, snapshot) == true, "emeter slot is read");
+        check(snapshot.susyid == 349 && snapshot.num_values == 3 && snapshot.device_time == 123456, "emeter slot header is read back");
+        uint64_t value = 0;
+        check(SharedReadings::Reader::readValue(*emeter, power_key, value) == true && value == 4711, "emeter power value is read back");
+        check(SharedReadings::Reader::readValue(*emeter, energy_key, value) == true && value == 0x0000000123456789ull, "emeter energy counter is read back");
+    }
+
+    // inverter round trip, including the 64 bit counter
+    publishInverter(publisher, getInverterPacket(0x0080, 3000000001, 1700000000, 2500, 0x0000000200000001ull));
+    const SharedReadings::Device* inverter = reader.findDevice(SharedReadings::INVERTER, 3000000001);
+    check(inverter != NULL, "inverter slot is found");
+    if (inverter != NULL) {
+        uint64_t value = 0;
+        check(SharedReadings::Reader::readValue(*inverter, 0x263f01, value) == true && value == 2500, "inverter 32 bit value is read back");
+        check(SharedReadings::Reader::readValue(*inverter, 0x260101, value) == true && value == 0x0000000200000001ull, "inverter 64 bit counter is read back");
+        SharedReadings::Snapshot snapshot;
+        check(SharedReadings::Reader::read(*inverter, snapshot) == true && snapshot.num_values == 2 && snapshot.values[0].flags == 0x40, "inverter data type is kept in the flags");
+    }
+    check(reader.getNumDevices() == 2, "each device gets one slot");
+
+    // torn reads: the writer publishes emeter packets whose power, energy and time values are equal, the reader
+    // checks that every snapshot it gets has equal values
+    publishEmeter(publisher, getEmeterPacket(1900000001, 0, 0, 0));
+    std::atomic<bool> done(false);
+    std::thread writer([&publisher, &done](void) {
+        for (uint32_t i = 1; i <= 200000; ++i) {
+            publishEmeter(publisher, getEmeterPacket(1900000001, i, i, i));
+        }
+        done.store(true);
+    });
+    unsigned long reads = 0;
+    unsigned long torn  = 0;
+    uint32_t last = 0;
+    bool monotonic = true;
+    while (done.load() == false && emeter != NULL) {
+        SharedReadings::Snapshot snapshot;
+        if (SharedReadings::Reader::read(*emeter, snapshot) == false) {
+            continue;
+        }
+        ++reads;
+        uint64_t power = 0, energy = 0;
+        for (uint32_t i = 0; i < snapshot.num_values; ++i) {
+            if (snapshot.values[i].key == power_key)  power  = snapshot.values[i].value;
+            if (snapshot.values[i].key == energy_key) energy = snapshot.values[i].value;
+        }
+        if (power != energy || snapshot.device_time != (uint32_t)power) {
+            ++torn;
+        }
+        monotonic &= (snapshot.device_time >= last);
+        last = snapshot.device_time;
+    }
+    writer.join();
+    check(reads > 0, "reader gets snapshots while the writer is updating");
+    check(torn == 0, "reader never gets a torn snapshot");
+    check(monotonic == true, "reader sees updates in order");
+    fprintf(stdout, "%lu snapshots read concurrently, %lu torn\n", reads, torn);
+
+    reader.close();
+    publisher.close();
+    shm_unlink(name.c_str());
+#endif
+    return UnitTest::finish();
+}
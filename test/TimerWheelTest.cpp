@@ -0,0 +1,140 @@
+#include <cstdio>
+#include <vector>
+#include <CachedClock.hpp>
+#include <TimerWheel.hpp>
+#include "UnitTest.hpp"
+
+using UnitTest::check;
+
+
+// drive the cached clock and the wheel to the given time, like the event loop does on each wakeup
+static void advanceTo(TimerWheel& wheel, uint64_t time_in_ms) {
+    CachedClock::setTimeInMs(time_in_ms);
+    wheel.advance(time_in_ms);
+}
+
+// check that a timer scheduled with the given delay expires exactly then, and not a tick earlier
+static void checkExpiry(uint64_t delay_in_ms, const char* message) {
+    const uint64_t start = 1000000;
+    CachedClock::setTimeInMs(start);
+    TimerWheel wheel(1);
+    int fired = 0;
+    TimerWheel::Timer timer([&](void) { ++fired; });
+    wheel.schedule(timer, (uint32_t)delay_in_ms);
+    advanceTo(wheel, start + delay_in_ms - 1);
+    check(fired == 0 && timer.isScheduled() == true, message);
+    advanceTo(wheel, start + delay_in_ms);
+    check(fired == 1 && timer.isScheduled() == false && wheel.size() == 0, message);
+}
+
+
+int main(int argc, char** argv) {
+    const uint64_t start = 1000000;
+
+    // a scheduled timer expires once, after its delay has elapsed
+    {
+        CachedClock::setTimeInMs(start);
+        TimerWheel wheel(4);
+        int fired = 0;
+        TimerWheel::Timer timer([&](void) { ++fired; });
+        wheel.schedule(timer, 10);
+        check(wheel.size() == 1 && timer.isScheduled() == true, "schedule adds the timer");
+        check(wheel.getTimeUntilNextExpiry(start) == 12, "next expiry is rounded up to the tick");
+        advanceTo(wheel, start + 8);
+        check(fired == 0, "timer does not expire before its delay");
+        advanceTo(wheel, start + 12);
+        check(fired == 1, "timer expires after its delay");
+        advanceTo(wheel, start + 100);
+        check(fired == 1 && wheel.size() == 0 && wheel.getTimeUntilNextExpiry(start + 100) == -1, "timer expires only once");
+    }
+
+    // a cancelled timer does not expire; rescheduling replaces the previous expiry
+    {
+        CachedClock::setTimeInMs(start);
+        TimerWheel wheel(1);
+        int fired_a = 0, fired_b = 0;
+        TimerWheel::Timer a([&](void) { ++fired_a; });
+        TimerWheel::Timer b([&](void) { ++fired_b; });
+        wheel.schedule(a, 20);
+        wheel.schedule(b, 20);
+        wheel.cancel(a);
+        wheel.cancel(a);
+        check(wheel.size() == 1 && a.isScheduled() == false, "cancel removes the timer once");
+        wheel.schedule(b, 50);
+        check(wheel.size() == 1, "rescheduling does not add the timer twice");
+        advanceTo(wheel, start + 49);
+        check(fired_a == 0 && fired_b == 0, "cancelled and rescheduled timers do not expire early");
+        advanceTo(wheel, start + 50);
+        check(fired_a == 0 && fired_b == 1, "rescheduled timer expires at its new expiry");
+    }
+
+    // a timer destroyed while scheduled is cancelled
+    {
+        CachedClock::setTimeInMs(start);
+        TimerWheel wheel(1);
+        {
+            TimerWheel::Timer timer;
+            wheel.schedule(timer, 100000);
+        }
+        check(wheel.size() == 0, "destroyed timer is cancelled");
+        advanceTo(wheel, start + 200000);
+    }
+
+    // timers beyond the range of level 0 are cascaded down and expire exactly on time, on each level
+    checkExpiry(255, "level 0 timer expires on time");
+    checkExpiry(256 + 7, "level 1 timer expires on time");
+    checkExpiry(64 * 256 + 123, "level 2 timer expires on time");
+    checkExpiry(64 * 64 * 256 + 4567, "level 3 timer expires on time");
+
+    // timers on all levels expire in order, also if the wheel advances across all of them at once
+    {
+        CachedClock::setTimeInMs(start);
+        TimerWheel wheel(1);
+        std::vector<int> order;
+        TimerWheel::Timer t0([&](void) { order.push_back(0); });
+        TimerWheel::Timer t1([&](void) { order.push_back(1); });
+        TimerWheel::Timer t2([&](void) { order.push_back(2); });
+        TimerWheel::Timer t3([&](void) { order.push_back(3); });
+        wheel.schedule(t3, 2000000);
+        wheel.schedule(t1, 300);
+        wheel.schedule(t2, 20000);
+        wheel.schedule(t0, 100);
+        advanceTo(wheel, start + 3000000);
+        check(order.size() == 4 && order[0] == 0 && order[1] == 1 && order[2] == 2 && order[3] == 3, "timers on all levels expire in order");
+        check(wheel.size() == 0, "wheel is empty after all timers expired");
+    }
+
+    // a callback can reschedule its own timer
+    {
+        CachedClock::setTimeInMs(start);
+        TimerWheel wheel(1);
+        int fired = 0;
+        TimerWheel::Timer timer;
+        timer.setCallback([&](void) {
+            if (++fired < 3) {
+                wheel.schedule(timer, 1000);
+            }
+        });
+        wheel.schedule(timer, 1000);
+        for (uint64_t time = start; time <= start + 5000; time += 250) {
+            advanceTo(wheel, time);
+        }
+        check(fired == 3 && wheel.size() == 0, "callback reschedules its own timer");
+    }
+
+    // a callback can cancel another timer due on the same tick
+    {
+        CachedClock::setTimeInMs(start);
+        TimerWheel wheel(1);
+        int fired = 0;
+        TimerWheel::Timer a, b;
+        a.setCallback([&](void) { ++fired; wheel.cancel(b); });
+        b.setCallback([&](void) { ++fired; wheel.cancel(a); });
+        wheel.schedule(a, 1000);
+        wheel.schedule(b, 1000);
+        advanceTo(wheel, start + 1000);
+        check(fired == 1 && wheel.size() == 0, "callback cancels a timer due on the same tick");
+    }
+
+    return UnitTest::finish();
+}
@@ -0,0 +1,41 @@
+#ifndef __UNITTEST_HPP__
+#define __UNITTEST_HPP__
+
+#include <cstdio>
+
+
+/**
+ *  Minimal unit test harness shared by all tests
+ *  Failed checks are reported on stderr and counted; main() returns the result of UnitTest::finish().
+ */
+namespace UnitTest {
+
+    inline int& failures(void) {
+        static int count = 0;
+        return count;
+    }
+
+    /**
+     *  Report and count a failed check
+     */
+    inline void check(bool condition, const char* description) {
+        if (condition == false) {
+            fprintf(stderr, "FAILED: %s\n", description);
+            ++failures();
+        }
+    }
+
+    /**
+     *  Print the test summary; returns the exit status of the test
+     */
+    inline int finish(void) {
+        if (failures() == 0) {
+            fprintf(stdout, "all checks passed\n");
+            return 0;
+        }
+        fprintf(stderr, "failed checks: %d\n", failures());
+        return 1;
+    }
+}
+
+#endif